@@ -0,0 +1,95 @@
+//
+//  gofish_plugin.h
+//
+//  Strategy plugin ABI: a shared object built against this header can play either seat of any
+//  mode that takes a BOT (./main --ladder ./my_bot.so most, ./main --server SOCK --opponent ./my_bot.so)
+//  without the engine being rebuilt. Build one with
+//
+//      gcc -shared -fPIC -O2 -o my_bot.so my_bot.c
+//
+
+#ifndef GOFISH_PLUGIN_H
+#define GOFISH_PLUGIN_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Bumped whenever a change would break plugins built against an older header. Fields are only
+// ever appended to the structs below, older plugins keep loading as long as the version matches.
+// Version 2 gave choose_ask() a deadline.
+#define GOFISH_PLUGIN_ABI 2
+
+// Symbol every plugin exports, see gofish_strategy_entry()
+#define GOFISH_PLUGIN_ENTRY "gofish_strategy_entry"
+
+// Kinds of events a strategy observes, the same values as the engine's event log
+#define GOFISH_EVENT_DEAL 0 // player was dealt a card of rank (0 when it is the opponent's card)
+#define GOFISH_EVENT_ASK 1 // player asked for rank
+#define GOFISH_EVENT_TRANSFER 2 // player received count cards of rank from the opponent
+#define GOFISH_EVENT_FISH 3 // player went fish and drew rank (0 for the opponent's draw or an empty pool)
+#define GOFISH_EVENT_DRAW 4 // player ran out of cards and drew rank (0 when it is the opponent's card)
+#define GOFISH_EVENT_BOOK 5 // player completed a book of rank, count is their new score
+#define GOFISH_EVENT_WINNER 6 // game over, player won (0 for a tie), rank/count are the scores
+
+// Clock deadlines are given on: CLOCK_MONOTONIC in nanoseconds, the engine's monotonic_ns()
+static inline uint64_t gofish_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/* Strategy View declaration, everything one player can see of a game. Ranks are 1 (A) to 13 (K) */
+typedef struct gofish_view_s {
+    int32_t player; // Seat being played, 1 or 2
+    int32_t hand[14]; // Cards of each rank in the player's own hand, indexed by rank
+    int32_t known[14]; // Cards of each rank the opponent is known to hold
+    int32_t booked[14]; // Player who completed the book of each rank, 0 while it is in play
+    int32_t opp_cards; // Size of the opponent's hand
+    int32_t deck_cards; // Cards left in the pool
+    int32_t score;
+    int32_t opp_score;
+    int32_t opp_last_ask; // Rank the opponent asked for last, 0 if none yet
+    int32_t last_ask; // Rank the player asked for last, 0 if none yet
+    int32_t turn; // Guesses made so far by both players
+    uint32_t game_id;
+} gofish_view;
+
+/* Strategy Event declaration, one game event as the observing seat is allowed to see it */
+typedef struct gofish_event_s {
+    int32_t type; // GOFISH_EVENT_*
+    int32_t player;
+    int32_t rank;
+    int32_t count;
+} gofish_event;
+
+/*
+ * Strategy declaration, the function table a plugin hands the engine. One state is made per seat
+ * and game, and is only ever used by the thread playing that game, so a strategy that keeps all
+ * of its memory in the state needs no locking however many games run at once.
+ */
+typedef struct gofish_strategy_s {
+    uint32_t abi_version; // GOFISH_PLUGIN_ABI the plugin was built with
+    uint32_t size; // sizeof(gofish_strategy) the plugin was built with
+    const char *name;
+
+    // Makes the state of a new game for seat (1 or 2). seed is fixed by the game and the seat, so
+    // a strategy drawing its random numbers from it plays the same game the same way every time
+    void* (*init)(int seat, uint64_t seed);
+
+    // Returns the rank to ask for, which must be one the player holds. Anything else is replaced by
+    // a rank the player holds. The answer is due by deadline_ns (see gofish_now_ns()), 0 when there
+    // is no deadline: a strategy that thinks for a while should stop short of it and answer with
+    // the best rank found so far. Time past the deadline is counted against the plugin
+    int (*choose_ask)(void *state, const gofish_view *view, uint64_t deadline_ns);
+
+    // Told about every event of the game as it happens, may be NULL
+    void (*observe_event)(void *state, const gofish_event *event);
+
+    // Frees the state once the game is over, may be NULL
+    void (*free)(void *state);
+} gofish_strategy;
+
+// Entry point of a plugin, returns its function table (which has to outlive the call)
+const gofish_strategy* gofish_strategy_entry(void);
+
+#endif
@@ -6,11 +6,36 @@
 //  GoFish Game Implemented using Doubly-Linked Lists and Dynamic Memory Management
 //
 
+#define _POSIX_C_SOURCE 200809L // open_memstream() for the session output buffer
+
 #include <stdio.h>
 #include <string.h> // string functions
+#include <ctype.h> // Suit letters in the terminal UI
 #include <stdlib.h>
 #include <math.h> // Random number generator for shuffling
 #include <time.h> // Used to seed the random number generator
+#include <stdint.h>
+#include <stdatomic.h> // Lock-free event rings between game threads and the log writer
+#include <pthread.h> // Batch simulation workers and the log writer thread
+#include <errno.h>
+#include <fcntl.h> // Non-blocking client sockets
+#include <poll.h> // Waiting on many sessions at once in server mode
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h> // Reading results files back without copying them
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h> // Descriptor limit of the load generator
+#include <sys/wait.h>
+#include <sys/uio.h> // One writev() sends a watcher every chunk it is behind on
+#include <sys/time.h> // Timeouts on metrics scrapes
+#include <netinet/in.h> // Metrics endpoint on a localhost port
+#include <dlfcn.h> // Strategy plugins
+#include "gofish_plugin.h" // ABI strategy plugins are built against
+#ifdef __SSE2__
+#include <emmintrin.h> // Building feature rows 16 ranks at a time
+#endif
 
 // Support for prior C99 Machines
 //#define FILENAME_SIZE 30
@@ -23,15 +48,85 @@
 //#define PLAYER_ONE 1
 //#define PLAYER_TWO 2
 
+#define SUIT_LENGTH 10 // Sizes the suit array inside the Card struct, so it must be a constant expression
+#define SESSION_LINE_SIZE 32 // Longest line a client may send as a guess in server mode
+#define EVENT_RING_SIZE 4096 // Events one game thread can queue for the log writer, must be a power of 2
+#define EVENT_BATCH_SIZE 8192 // Events the log writer gathers before a single fwrite()
+#define RESULT_BLOCK_ROWS 16384 // Games a batch worker collects before writing a block of the results file
+#define NUM_RANKS 13 // Ranks are stored as 1 (A) to 13 (K), arrays indexed by rank have NUM_RANKS + 1 slots
+#define STRATEGY_SITUATIONS 288 // Rows of a strategy table, see strategy_context()
+#define EVAL_WAYS 8 // Entries in each set of the evaluation cache, the CLOCK hand sweeps one set
+#define ANALYSIS_CHUNK 256 // Hidden deals an analysis thread plays out at a time, tallied separately
+#define TUI_ROWS 12 // Size of the screen drawn by the terminal UI
+#define TUI_COLS 80
+#define LADDER_MATCH_DEALS 32 // Deals of one ladder match, each played twice with the seats swapped
+#define SCRIPT_LINE_SIZE 128 // Longest line of a move script, comments included
+#define FEATURE_COLUMNS 80 // Features of one decision point, five groups of 16, see feature_row()
+#define WATCH_QUEUE 16 // Chunks a watcher may fall behind by before it is skipped ahead to a snapshot
+#define SEARCH_DEALS 64 // Hidden deals a search bot plays every ask out on, fewer if its deadline comes first
+#define LATENCY_BUCKETS 320 // Move time buckets, 8 per power of two nanoseconds, see latency_bucket()
+#define METRICS_BUCKETS 24 // Move time buckets of the metrics endpoint, 256ns doubling up to 1s, then +Inf
+#define LOAD_BUFFER_SIZE 8192 // Output a load generator client keeps, enough to find the hand it asks from
+#define STORE_RESERVE ((size_t)1 << 34) // Address space each session store mapping may grow into
+
 const int FILENAME_SIZE = 30;
 const int LINE_SIZE = 15;
-const int SUIT_LENGTH = 10;
 const int NUM_OF_SWAPS = 200;
 const int GUESS_SIZE = 5;
 const int FORCE_SWAP = 3;
 const int CARD_LIMIT = 7; // Limits the number of cards that can be displayed in one row
 const int PLAYER_ONE = 1;
 const int PLAYER_TWO = 2;
+const int SESSION_BACKLOG = 128; // Pending connections the server lets queue up
+const int LOG_DROP = 0; // Full event ring: drop the event and count it
+const int LOG_BLOCK = 1; // Full event ring: wait for the log writer to make room
+const int HINT_CHUNK = 512; // Deals the hint engine samples between checks for a new position
+const long HINT_MAX_SAMPLES = 4000000; // Hint engine goes idle after this many samples of one position
+const int HIST_DECK = 0; // Lists a card can move between, hands are HIST_DECK + player
+const int HIST_BOOK = 3;
+const uint32_t RESULT_MAGIC = 0x42524647; // "GFRB" at the start of every results block
+const uint16_t RESULT_VERSION = 3; // 3: the checksum also covers the header
+const size_t RESULT_ROW_BYTES = sizeof(uint64_t) + sizeof(uint32_t) + 4 * sizeof(uint16_t) + 3 * sizeof(uint8_t); // One game across all the columns of a block
+const uint16_t NO_BOOK = 0xFFFF; // first_book column of a game in which nobody completed a book
+const uint32_t STREAM_DECK = 0; // Random streams of a game: deck shuffle,
+const uint32_t STREAM_PLAYER = 1; // computer player in each seat (STREAM_PLAYER + player - 1),
+const uint32_t STREAM_HINT = 3; // hint engine samples
+const uint32_t STREAM_ANALYSIS = 4; // hidden deals sampled by --analyze
+const uint32_t STREAM_LOAD = 5; // and the think times and asks of each --loadgen client
+const int EXIT_BAD_INPUT = 2; // Exit code when a script asks for something the rules do not allow
+const int EXIT_EARLY_EOF = 3; // Exit code when the input ends before the game is over
+
+// Rank of the first character of a guess, 0 where no rank starts with it ("10" is checked separately)
+const unsigned char RANK_LOOKUP[256] = {
+    ['A'] = 1, ['a'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4, ['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+    ['J'] = 11, ['j'] = 11, ['Q'] = 12, ['q'] = 12, ['K'] = 13, ['k'] = 13
+};
+const double LADDER_MU = 25.0; // TrueSkill prior of a new bot on the ladder
+const double LADDER_SIGMA = 25.0 / 3;
+const double LADDER_BETA = 25.0 / 6; // Performance spread of a single game
+const uint32_t STRATEGY_MAGIC = 0x54534647; // "GFST" at the start of a strategy table file
+const uint16_t STRATEGY_VERSION = 1;
+const uint32_t EVAL_CACHE_MAGIC = 0x43454647; // "GFEC" at the start of an evaluation cache file
+const uint16_t EVAL_CACHE_VERSION = 1;
+const uint32_t EVAL_CACHE_SETS = 8192; // Sets of a new evaluation cache, EVAL_WAYS entries each
+const uint32_t CHECKPOINT_MAGIC = 0x4B434647; // "GFCK" at the start of a checkpoint file
+const uint16_t CHECKPOINT_VERSION = 1;
+const uint16_t SNAPSHOT_VERSION = 1; // Layout of a Game Snapshot, checked for every record restored
+const uint32_t STORE_MAGIC = 0x53534647; // "GFSS" at the start of a session store file
+const uint16_t STORE_VERSION = 1;
+const size_t STORE_GROWTH = 65536; // Records (or index slots) a session store file grows by at a time
+const uint32_t STORE_TAKEN = 0x80000000; // Set in the index entry of a game taken back, its record is reused when it is parked again
+const uint64_t STORE_SWEEP_NS = 100000000; // Time between two looks for sessions to park
+const int THINK_FIXED = 0; // Think time distributions of the load generator
+const int THINK_UNIFORM = 1;
+const int THINK_EXP = 2;
+const uint32_t FEATURE_MAGIC = 0x46464647; // "GFFF" at the start of a feature file
+const uint16_t FEATURE_VERSION = 1;
+const uint16_t FEATURE_U8 = 1; // Element types of the feature tensor
+const uint16_t FEATURE_F32 = 2;
+
+uint32_t crc32_table[256]; // Filled in once by crc32_init()
+int server_stop_pipe[2] = {-1, -1}; // Written to by stop_server() so the server's poll() wakes up
  
 /* Card declaration */
 typedef struct card_s {
@@ -41,26 +136,682 @@ typedef struct card_s {
     struct card_s *next;
 } card;
 
+/* Resume points of the turn loop, see game_resume() */
+enum game_state {
+    GAME_DEAL,          // Deck is ready, hands have not been dealt yet
+    GAME_TURN,          // Start of a turn: check for a winner and for empty hands
+    GAME_AWAIT_GUESS,   // Suspended until the player whose turn it is makes a guess
+    GAME_OVER           // Winner has been declared
+};
+
+/* Kinds of game events, see log_event() */
+enum event_type {
+    EVENT_DEAL,         // player was dealt a card of rank
+    EVENT_ASK,          // player asked for rank
+    EVENT_TRANSFER,     // player received count cards of rank from the opponent
+    EVENT_FISH,         // player went fish and drew rank (0 when the pool was empty)
+    EVENT_DRAW,         // player ran out of cards and drew rank, turns are switched
+    EVENT_BOOK,         // player completed a book of rank, count is their new score
+    EVENT_WINNER        // game over, player won (0 for a tie), rank/count are the scores
+};
+_Static_assert(EVENT_DEAL == GOFISH_EVENT_DEAL && EVENT_ASK == GOFISH_EVENT_ASK && EVENT_TRANSFER == GOFISH_EVENT_TRANSFER
+               && EVENT_FISH == GOFISH_EVENT_FISH && EVENT_DRAW == GOFISH_EVENT_DRAW && EVENT_BOOK == GOFISH_EVENT_BOOK
+               && EVENT_WINNER == GOFISH_EVENT_WINNER, "plugins see the event types of the event log");
+
+/* Game Event declaration, fixed size record written to the event log */
+typedef struct game_event_s {
+    uint32_t game_id;
+    uint16_t turn;
+    uint8_t type;
+    uint8_t player;
+    uint8_t rank;
+    uint8_t count;
+    uint8_t deck; // Cards left in the pool
+    uint8_t unused;
+} game_event;
+
+/* Event Ring declaration, single producer (one game thread) single consumer (log writer) queue */
+typedef struct event_ring_s {
+    _Atomic size_t head; // Next slot the game thread fills
+    char head_pad[64 - sizeof(size_t)]; // Keep head and tail on separate cache lines
+    _Atomic size_t tail; // Next slot the log writer drains
+    char tail_pad[64 - sizeof(size_t)];
+    _Atomic uint64_t dropped; // Events lost to a full ring
+    int policy; // LOG_DROP or LOG_BLOCK
+    game_event slots[EVENT_RING_SIZE];
+} event_ring;
+
+/* Event Log declaration, the rings of every game thread and the thread writing them out */
+typedef struct event_log_s {
+    FILE *file;
+    event_ring *rings;
+    int num_rings;
+    atomic_int running;
+    uint64_t written;
+    pthread_t writer;
+} event_log;
+
+/*
+ * Engine Counters declaration, live totals of one thread for the metrics endpoint. Only the owning
+ * thread writes them, with a relaxed load and store rather than a locked add, and they are only
+ * summed across threads when the metrics are scraped or dumped.
+ */
+typedef struct engine_counters_s {
+    _Atomic uint64_t games;
+    _Atomic uint64_t turns; // Asks made
+    _Atomic uint64_t fish; // Cards drawn from the pool on go fish
+    _Atomic uint64_t books;
+    _Atomic uint64_t cards_allocated;
+    _Atomic uint64_t moves; // Moves timed, see count_move()
+    _Atomic uint64_t move_ns; // Sum of their times
+    _Atomic uint64_t move_max_ns;
+    _Atomic uint64_t move_buckets[METRICS_BUCKETS];
+    _Atomic uint64_t decisions[2]; // Bot decisions of each seat, see count_decision()
+    _Atomic uint64_t decision_ns[2];
+    _Atomic uint64_t decision_max_ns[2];
+    _Atomic uint64_t decision_overruns[2];
+    _Atomic uint64_t decision_fallbacks[2];
+    _Atomic uint64_t decision_buckets[2][METRICS_BUCKETS];
+    struct engine_counters_s *next; // Every block of a run, newest first
+} engine_counters;
+
+/* Metrics declaration, the counters of a run and the thread that serves and dumps them */
+typedef struct metrics_s {
+    const char *address; // --metrics: port on 127.0.0.1 or Unix socket path, NULL if not served
+    const char *dump_path; // --metrics-dump, NULL if not dumped
+    int interval; // --metrics-interval, seconds between dumps
+    const char *mode; // Run being measured, the mode label of every sample
+    int listen_fd;
+    int wake[2]; // Written to once the run is over
+    pthread_t thread;
+    pthread_mutex_t lock; // Guards the list of counter blocks
+    engine_counters *blocks;
+    uint64_t start_ns;
+    _Atomic int64_t sessions; // Gauges kept current by the server loop
+    _Atomic int64_t parked;
+    _Atomic int64_t idle; // Connected clients whose game is parked in the session store
+    _Atomic int64_t queued_bytes;
+    event_log *log; // Ring depths are read when scraped, NULL without --log
+} metrics;
+
+/* Kinds of history entries, each one undoes a single change made during a turn */
+enum history_op {
+    HIST_MOVE,          // a: card code (rank * 4 + suit), b: from << 4 | to list, c: index it was taken from
+    HIST_KNOWN,         // a: player - 1, b: rank, c: old known count
+    HIST_LAST_ASK,      // a: player - 1, b: old rank
+    HIST_SCORE,         // a: player - 1, b: old score
+    HIST_BOOKED,        // a: rank, b: old owner of the book
+    HIST_TURN,          // a: old players_turn
+    HIST_COUNTER        // a: which counter (0 fish_count, 1 forced_swaps, 2 first_book_turn), b | c << 8: old value
+};
+
+/* History Entry declaration, 4 bytes recording one reversible change */
+typedef struct history_entry_s {
+    uint8_t op;
+    uint8_t a;
+    uint8_t b;
+    uint8_t c;
+} history_entry;
+
+/* History Node declaration, one turn of the game: the guess that was made and how to take it back */
+typedef struct history_node_s {
+    int32_t parent; // Position the guess was made from, -1 for the start of the game
+    int32_t first_child; // Most recent guess made from the position this turn leads to
+    int32_t next_sibling; // Other guesses made from the same position as this one
+    uint32_t first_entry; // Entries of the turn are stored back to back
+    uint16_t num_entries;
+    uint8_t guess;
+    uint8_t unused;
+} history_node;
+
+/* History declaration, tree of every turn played so far, branches share their common turns */
+typedef struct history_s {
+    history_node *nodes;
+    int num_nodes;
+    int cap_nodes;
+    history_entry *entries;
+    uint32_t num_entries;
+    uint32_t cap_entries;
+    int current; // Node of the position on the table, -1 for the start of the game
+    int recording; // Node the current turn is being recorded into, -1 when not recording
+    int first_move; // First guess made from the start of the game, -1 if none
+} history;
+
+/*
+ * RNG Stream declaration, counter-based random numbers (Philox4x32-10). Every block of output
+ * is a pure function of key and counter, so a stream can be jumped to, split or regenerated
+ * anywhere without sharing state: the key is the run seed, the counter holds the block number,
+ * the game index and the stream id.
+ */
+typedef struct rng_stream_s {
+    uint32_t key[2];
+    uint32_t counter[4]; // Block number (low, high), game index, stream id
+    uint32_t buffer[4]; // Last block generated
+    int used; // Words of buffer already handed out
+} rng_stream;
+
+/* Game declaration, everything one game needs to be suspended between guesses */
+typedef struct game_s {
+    card *deck_hl;
+    card *deck_hr;
+    card *hand_hl[2]; // Indexed by player - 1
+    card *hand_hr[2];
+    int score[2];
+    int players_turn;
+    int state; // Where game_resume() picks up again
+    FILE *out; // Where the game is printed, NULL for a silent game
+    uint32_t id; // Index of the game within a batch run
+    int turn_count; // Guesses made so far
+    event_ring *log; // Where events are queued, NULL when not logging
+    int known[2][NUM_RANKS + 1]; // Cards of each rank a player is publicly known to hold
+    int booked[NUM_RANKS + 1]; // Player who completed the book of each rank, 0 while it is in play
+    int last_ask[2]; // Rank each player asked for last, 0 before their first guess
+    history *history; // Undo/redo tree, NULL when not kept
+    uint64_t seed; // Run seed, together with id it fixes every random number of the game
+    rng_stream rng; // Shuffles the deck
+    rng_stream bot_rng[2]; // Decisions of a computer player in each seat
+    int fish_count; // Guesses that ended in go fish
+    int forced_swaps; // Turns switched because a player ran out of cards
+    int first_book_turn; // turn_count when the first book was completed, -1 if none yet
+    int hand_count[2][NUM_RANKS + 1]; // Cards of each rank in each hand, kept in step with the lists
+    int deck_count; // Cards left in the deck
+    card *book_hl; // Cards of completed books, in the order they were taken out of play
+    card *book_hr;
+    int swap_seats; // Deal Player 1 the hand Player 2 would get from the same deck and the other way round
+    engine_counters *counters; // Totals for the metrics endpoint, NULL when not kept
+    const gofish_strategy *plugins[2]; // Strategy plugin playing each seat, NULL for none
+    void *plugin_state[2]; // Its state for this game
+} game;
+
+/* Result Block Header declaration, starts every block of a results file */
+typedef struct result_header_s {
+    uint32_t magic; // RESULT_MAGIC
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t num_rows;
+    uint32_t block_size; // Bytes in the block including this header, for skipping to the next one
+    uint64_t run_seed; // --seed of the run the games belong to
+    uint32_t num_games; // Games in the whole run, across every shard
+    uint16_t shard_index; // Shard that wrote the block, game i belongs to shard i % num_shards
+    uint16_t num_shards;
+    uint32_t checksum; // CRC-32 of the whole block, taken with this field set to 0
+    uint32_t reserved;
+} result_header;
+
+/*
+ * Result Block declaration, per-game results of a batch stored column by column. Blocks are
+ * written to file in exactly this column order (each column num_rows long, widest first so
+ * every column stays aligned), padded to a multiple of 8 bytes. Files are just blocks back to
+ * back, so they can be appended to and concatenated freely.
+ */
+typedef struct result_block_s {
+    int num_rows;
+    uint64_t seed[RESULT_BLOCK_ROWS];
+    uint32_t game_index[RESULT_BLOCK_ROWS];
+    uint16_t turns[RESULT_BLOCK_ROWS];
+    uint16_t fish[RESULT_BLOCK_ROWS];
+    uint16_t forced_swaps[RESULT_BLOCK_ROWS];
+    uint16_t first_book[RESULT_BLOCK_ROWS]; // NO_BOOK if nobody completed one
+    uint8_t winner[RESULT_BLOCK_ROWS]; // 0 for a tie
+    uint8_t score1[RESULT_BLOCK_ROWS];
+    uint8_t score2[RESULT_BLOCK_ROWS];
+} result_block;
+
+/* Result File declaration, results file shared by every batch worker */
+typedef struct result_file_s {
+    FILE *file;
+    pthread_mutex_t lock; // Held while a whole block is written
+    uint64_t run_seed; // Copied into the header of every block
+    uint32_t num_games;
+    uint16_t shard_index;
+    uint16_t num_shards;
+} result_file;
+
+/* Result Run declaration, games of one run found while summarizing results files */
+typedef struct result_run_s {
+    uint64_t seed;
+    uint32_t num_games;
+    uint8_t *seen; // Bit per game index
+    uint64_t found; // Rows with an index inside the run, duplicates included
+    uint64_t duplicates;
+} result_run;
+
+/* Game View declaration, everything one player can see of a game, flattened to counts per rank */
+typedef struct game_view_s {
+    int player; // Whose point of view
+    int hand[NUM_RANKS + 1]; // Cards of each rank in the player's own hand
+    int known[NUM_RANKS + 1]; // Cards of each rank the opponent is known to hold
+    int booked[NUM_RANKS + 1]; // Player who completed the book of each rank, 0 while it is in play
+    int opp_cards; // Size of the opponent's hand
+    int deck_cards; // Cards left in the pool
+    int score;
+    int opp_score;
+    int opp_last_ask; // Rank the opponent asked for last, 0 if none yet
+} game_view;
+
+/* Evaluation Entry declaration, one cached evaluation of a canonical position */
+typedef struct eval_entry_s {
+    uint64_t key; // position_key() of the position, 0 for an empty entry
+    uint32_t samples; // Work behind the values, more samples replace fewer
+    uint8_t referenced; // CLOCK bit, set on every hit
+    uint8_t pad[3];
+    float value[NUM_RANKS]; // Per rank, in canonical rank order
+} eval_entry;
+
+/* Evaluation Set declaration, entries a key can be cached in */
+typedef struct eval_set_s {
+    eval_entry entries[EVAL_WAYS];
+    uint32_t hand; // Next entry the CLOCK hand looks at
+    uint32_t pad;
+} eval_set;
+
+/* Evaluation Cache Header declaration, starts an evaluation cache file and is followed by the sets */
+typedef struct eval_header_s {
+    uint32_t magic; // EVAL_CACHE_MAGIC
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t num_sets;
+    uint32_t set_size; // sizeof(eval_set), a file of another layout is started over
+} eval_header;
+
+/*
+ * Evaluation Cache declaration, bounded cache of position evaluations. When opened on a file
+ * the sets are a shared mapping of it, so the cache is saved as it is used and the next run
+ * starts warm.
+ */
+typedef struct eval_cache_s {
+    eval_header *header;
+    eval_set *sets;
+    size_t size; // Bytes mapped
+    uint64_t hits;
+    uint64_t misses;
+} eval_cache;
+
+/* Hint Engine declaration, background thread estimating the best ask while the player thinks */
+typedef struct hint_engine_s {
+    pthread_t thread;
+    pthread_mutex_t lock; // Guards everything below
+    pthread_cond_t wake;
+    game_view view; // Position being evaluated
+    int generation; // Bumped whenever the view changes
+    int quit;
+    long samples; // Deals sampled for the current view
+    long hits[NUM_RANKS + 1]; // Sampled deals in which the opponent held the rank
+    rng_stream rng; // Only touched by the worker
+    eval_cache *cache; // Estimates of positions seen before, NULL when not kept
+} hint_engine;
+
+/* Strategy Header declaration, starts a strategy table file and is followed by the table */
+typedef struct strategy_header_s {
+    uint32_t magic; // STRATEGY_MAGIC
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t num_situations; // STRATEGY_SITUATIONS
+    uint32_t reserved;
+    uint64_t games; // Training games the table was built from
+    uint64_t seed; // Seed of the training run
+} strategy_header;
+
+/*
+ * Bot declaration, computer player that picks its ask with a strategy table: a score for asking
+ * for a rank in each situation (see strategy_context()), the highest scoring rank held wins.
+ * Tables of built-in heuristics are filled in at startup, trained tables are mapped from file.
+ */
+typedef struct bot_s {
+    const char *name;
+    const uint16_t *table; // NULL for the random bot
+    uint16_t builtin[STRATEGY_SITUATIONS]; // Table of a built-in heuristic
+    int search; // Plays each ask out on sampled hidden deals, with the table as both players' policy
+    const gofish_strategy *plugin; // Strategy plugin making every decision, NULL for a table bot
+} bot;
+
+/* Latency Histogram declaration, how long the decisions of one bot took */
+typedef struct latency_histogram_s {
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t decisions;
+    uint64_t overruns; // Decisions that took longer than the budget
+    uint64_t fallbacks; // Decisions that came back illegal and were replaced by the fallback ask
+    uint64_t max_ns;
+} latency_histogram;
+
+/*
+ * Move Clock declaration, the time a bot is given for each decision and how long the decisions of
+ * each seat took. Bots work to the deadline and answer with the best ask found so far (see
+ * bot_decide()), so a search bot plays as much as the budget allows and no more.
+ */
+typedef struct move_clock_s {
+    long budget_ns; // 0 for no deadline
+    latency_histogram seat[2];
+} move_clock;
+
+/* Batch Worker declaration, one simulation thread and its share of the results */
+typedef struct batch_worker_s {
+    pthread_t thread;
+    int index;
+    int num_threads;
+    int num_games; // Games in the whole batch
+    int shard_index; // Only games with index % num_shards == shard_index are played
+    int num_shards;
+    event_ring *log;
+    uint64_t seed; // Seed of the whole batch, game i draws from streams keyed by (seed, i)
+    result_file *results; // NULL when results are not written
+    result_block *block; // Results collected but not yet written
+    const bot *bots; // Computer player in each seat
+    move_clock *clock; // NULL when decisions are not timed
+    engine_counters *counters; // NULL without metrics
+    int wins[3]; // Ties, Player 1 wins, Player 2 wins
+} batch_worker;
+
+/* Hidden Deal declaration, one way the cards a player cannot see may lie */
+typedef struct hidden_deal_s {
+    uint8_t opp[NUM_RANKS + 1]; // Cards of each rank in the opponent's hand
+    uint8_t deck[52]; // Ranks of the pool from the top
+    double weight; // Relative likelihood of the deal
+} hidden_deal;
+
+/* Analysis declaration, work shared by the threads of --analyze */
+typedef struct analysis_s {
+    const game *position; // Player to ask is about to guess
+    const bot *bots; // Policies the rest of the game is played out with
+    uint64_t seed; // Keys the bots' streams, one per hidden deal
+    hidden_deal *deals;
+    int num_deals;
+    int asks[NUM_RANKS]; // Candidate ranks, the ones the player holds
+    int num_asks;
+    double (*tally)[NUM_RANKS][3]; // Per chunk and ask: weight of losses, ties and wins
+    atomic_int next_chunk;
+} analysis;
+
+/* Ladder Entry declaration, rating of one bot on the ladder */
+typedef struct ladder_entry_s {
+    bot b;
+    double mu; // TrueSkill mean and standard deviation
+    double sigma;
+    int games;
+    int wins;
+    latency_histogram latency;
+} ladder_entry;
+
+/* Ladder Match declaration, one scheduled pairing played by the match threads */
+typedef struct ladder_match_s {
+    bot seats[2][2]; // Bots in seat order for the first and the swapped game of each deal
+    uint64_t seed;
+    uint32_t first_deal; // Game index of the first deal, every match gets fresh deals
+    int num_threads;
+    int winner[2 * LADDER_MATCH_DEALS]; // Seat that won game k (deal k / 2, swapped if k is odd), 0 for a tie
+} ladder_match;
+
+/* Ladder Thread declaration, one thread of a ladder match */
+typedef struct ladder_thread_s {
+    pthread_t thread;
+    int index;
+    ladder_match *match;
+    move_clock clock[2]; // For the first and the swapped game of each deal, budget 0 when not timed
+} ladder_thread;
+
+/* Comparison declaration, the deals of one look of a comparison, shared by its threads */
+typedef struct comparison_s {
+    bot seats[2][2]; // Bots in seat order for the first and the mirrored game of each deal
+    uint64_t seed;
+    uint32_t first_deal; // Game index of the first deal of the look
+    uint32_t num_deals;
+    int num_threads;
+    int8_t *outcome; // A's result in game k (deal k / 2, mirrored if k is odd): 1 win, -1 loss, 0 tie
+    int8_t *margin; // A's books minus B's books in game k
+} comparison;
+
+/* Comparison Thread declaration, one thread of a comparison */
+typedef struct compare_thread_s {
+    pthread_t thread;
+    int index;
+    comparison *c;
+} compare_thread;
+
+/* Terminal UI declaration, model of what the terminal shows so a frame only redraws changed cells */
+typedef struct tui_s {
+    char screen[TUI_ROWS][TUI_COLS]; // Cells as last drawn
+    int drawn; // 0 until the first frame cleared the terminal
+    char action[TUI_COLS]; // What the last guess did
+    char message[TUI_COLS]; // Reply to the last thing typed
+} tui;
+
+/* Feature File Header declaration, starts a feature file and locates its two tensors */
+typedef struct feature_header_s {
+    uint32_t magic; // FEATURE_MAGIC
+    uint16_t version;
+    uint16_t header_size;
+    uint64_t num_rows; // Decision points, one row of each tensor
+    uint16_t num_features; // FEATURE_COLUMNS
+    uint16_t dtype; // FEATURE_U8 or FEATURE_F32
+    uint32_t label_size; // sizeof(feature_label)
+    uint64_t label_offset; // Labels follow the num_rows x num_features feature tensor
+} feature_header;
+
+/* Feature Label declaration, what happened at a decision point */
+typedef struct feature_label_s {
+    uint32_t game_id;
+    uint16_t turn;
+    uint8_t ask; // Rank the player asked for
+    uint8_t outcome; // 0 the player lost the game, 1 tie, 2 won
+} feature_label;
+
+/*
+ * Feature Game declaration, a game of an event log being replayed for --features. Counts are kept
+ * 16 ranks to a row (slot rank - 1) so a whole row is one vector. Decision points are held back
+ * until the winner is known and then written out together.
+ */
+typedef struct feature_game_s {
+    uint8_t hand[2][16]; // Cards of each rank in each hand
+    uint8_t known[2][16]; // Cards of each rank each player is publicly known to hold
+    uint8_t booked[16]; // Player who completed each book, 0 while it is in play
+    uint8_t last_ask[2];
+    uint8_t score[2];
+    uint32_t id;
+    int in_use;
+    int num_rows;
+    int cap_rows;
+    uint8_t *rows; // FEATURE_COLUMNS per decision point
+    feature_label *labels;
+} feature_game;
+
+/*
+ * Game Snapshot declaration, everything needed to pick a suspended game up again packed into a
+ * fixed size record. Card lists are stored as card_code() bytes, the per-rank counts are rebuilt
+ * from them and the random streams of the computer players are stored as positions, since any
+ * block of them can be regenerated.
+ */
+typedef struct game_snapshot_s {
+    uint64_t seed; // Seed and index the game was dealt from
+    uint32_t id;
+    uint32_t bot_block[2]; // Next block of each computer player's random stream
+    uint32_t checksum; // CRC-32 of the record with this field zeroed
+    uint16_t version; // SNAPSHOT_VERSION
+    uint16_t turn_count;
+    uint16_t fish_count;
+    uint16_t forced_swaps;
+    int16_t first_book_turn;
+    uint8_t state;
+    uint8_t players_turn;
+    uint8_t score[2];
+    uint8_t num_cards[3]; // Cards in the deck, then in each hand
+    uint8_t bot_used[2]; // Words of the last block each computer player has handed out
+    uint8_t rules; // Rule variant the game is played under, 0 (standard) is the only one so far
+    uint8_t last_ask[2];
+    uint8_t ranks[NUM_RANKS]; // known[0] | known[1] << 2 | booked << 4 for each rank from A up
+    uint8_t cards[52]; // Deck from the top, then the hand of each player in order
+} game_snapshot;
+
+/* Checkpoint Header declaration, starts a checkpoint file and is followed by its snapshots */
+typedef struct checkpoint_header_s {
+    uint32_t magic; // CHECKPOINT_MAGIC
+    uint16_t version;
+    uint16_t record_size; // sizeof(game_snapshot)
+    uint32_t num_games;
+    uint32_t next_index; // Index the next new game of the server is dealt with
+} checkpoint_header;
+
+/*
+ * Checkpoint declaration, games saved by a server that was stopped. The file is mapped read only
+ * and a game is only unpacked when its player asks for it back, so a restart costs the same
+ * however many games were saved.
+ */
+typedef struct checkpoint_s {
+    const checkpoint_header *header;
+    const game_snapshot *games; // Sorted by id
+    uint8_t *taken; // Games already handed back to a player, left out of the next checkpoint
+    uint32_t num_taken;
+    size_t size; // Bytes mapped
+} checkpoint;
+
+/* Session Store Header declaration, fills the first record of a session store file */
+typedef struct store_header_s {
+    uint32_t magic; // STORE_MAGIC
+    uint16_t version;
+    uint16_t record_size; // sizeof(game_snapshot)
+    uint32_t num_records; // Records handed out so far, record n (from 1) is the nth Game Snapshot of the file
+    uint32_t next_index; // Index the next new game of the server is dealt with
+    uint32_t parked; // Games with a record nobody has taken back yet
+} store_header;
+
+/*
+ * Session Store declaration, the tier of the server that games nobody is playing are parked in.
+ * Parking writes a Game Snapshot to the store file, and an index file keeps the record number of
+ * each game id. A game keeps its record once it has one, so the file grows with the games parked.
+ * Both are mapped shared, so a parked game costs no memory of the server's own: its pages belong
+ * to the page cache and the kernel writes them out as it likes.
+ */
+typedef struct session_store_s {
+    const char *path; // --store, NULL when every game stays in memory
+    uint64_t idle_ns; // --idle, sessions waiting on their client this long are parked
+    size_t budget; // --memory-budget in bytes, 0 for no limit on the games kept in memory
+    int fd;
+    int index_fd;
+    store_header *header; // Start of the mapped store file, NULL until open_store()
+    uint32_t *index; // Record number of the game parked under each id (| STORE_TAKEN once taken back), 0 if none
+    size_t num_slots; // Records the store file has room for, the header included
+    size_t index_slots; // Ids the index file has room for
+} session_store;
+
+/* Idle Session declaration, a connected client whose game has been parked in the session store */
+typedef struct idle_session_s {
+    int fd;
+    uint32_t id;
+} idle_session;
+
+/* Think Time declaration, how long a load generator client takes over a move */
+typedef struct think_time_s {
+    int kind; // THINK_FIXED, THINK_UNIFORM or THINK_EXP
+    double a; // Milliseconds: the fixed time, the lower bound or the mean
+    double b; // Upper bound of THINK_UNIFORM
+} think_time;
+
+/* Load Client declaration, one simulated player of the load generator */
+typedef struct load_client_s {
+    int fd; // -1 once the server would not take it back
+    rng_stream rng; // Think times and asks of this client
+    uint64_t sent_ns; // When the move being waited on was sent, 0 before the first move of a game
+    uint64_t move_ns; // When a thinking client sends its move, 0 while it waits on the server
+    size_t len;
+    char output[LOAD_BUFFER_SIZE]; // What the server sent since the last move
+} load_client;
+
+/* Load Step declaration, what one step of a load test measured */
+typedef struct load_step_s {
+    int clients;
+    double seconds;
+    uint64_t games; // Games played to the end
+    uint64_t errors; // Connections refused or lost
+    latency_histogram latency; // Time from sending a move until its reply had arrived
+    double server_cpu; // Percent of one core
+    long rss_kb;
+    double client_cpu;
+} load_step;
+
+/* Broadcast Chunk declaration, a piece of a game stream encoded once and shared by every watcher */
+typedef struct chunk_s {
+    int refs; // Watchers queueing it, plus one while the channel holds it
+    size_t len;
+    char data[];
+} chunk;
+
+/* Watcher declaration, one spectator connection and the chunks it has not been sent yet */
+typedef struct watcher_s {
+    int fd;
+    chunk *queue[WATCH_QUEUE]; // Oldest first
+    int queued;
+    size_t offset; // Bytes of queue[0] already sent
+} watcher;
+
+/*
+ * Channel declaration, a game stream fanned out to any number of watchers. Publishing a chunk
+ * only queues a reference to it per watcher, never a copy. A watcher that lets WATCH_QUEUE
+ * chunks pile up is skipped ahead: what it was behind on is dropped for a snapshot of the game
+ * as it stands, so one slow spectator never holds up the game or the others.
+ */
+typedef struct channel_s {
+    watcher *watchers;
+    int num_watchers;
+    int cap_watchers;
+    chunk *snapshot; // Snapshot of the game as it stands, built when first needed after a publish
+    uint64_t published;
+    uint64_t skips; // Times a watcher was skipped ahead
+} channel;
+
+/* Session declaration, one connected client of the server */
+typedef struct session_s {
+    int fd;
+    game g;
+    char line[SESSION_LINE_SIZE]; // Partial line received so far
+    int line_len;
+    char *pending; // Output the client has not accepted yet
+    size_t pending_len;
+    const bot *opponent; // Plays Player 2, NULL when the client plays both seats
+    move_clock *clock; // Times the opponent's decisions, one clock for the whole server
+    uint64_t last_active; // monotonic_ns() when the client last sent a line (or connected)
+} session;
+
 /* Function Prototypes */
 void print_go_fish_title(void);
 void print_list(card *card);
 void print_formatted_list(card *card); 
-void print_go_fish(void);
-void print_hand(card *hl);
-void print_leftside_card(card *card);
-void print_rightside_card(card *card);
+void print_go_fish(FILE *out);
+void print_hand(FILE *out, card *hl);
+void print_leftside_card(FILE *out, card *card);
+void print_rightside_card(FILE *out, card *card);
+void print_guess_prompt(FILE *out, int players_turn);
+void print_book(FILE *out, int player, int score);
 int get_deck_selection(void);
 void generate_random_deck(card **deck_hl, card **deck_hr);
-void read_in_deck(card **deck_hl, card **hr);
+int read_in_deck(card **deck_hl, card **hr);
+int load_deck(const char *filename, card **deck_hl, card **deck_hr, const char **problem);
+int read_line(FILE *in, char line[], int size);
+int parse_rank(const char *text);
+int run_script(int argc, char *argv[]);
 void add_to_end(card *p, card **hl, card **hr, card *temp_card);
 card* pull_card_data(char line[]);
-void shuffle_deck(card *hl);
+void shuffle_deck(card *hl, rng_stream *rng);
 int find_length(card *hl);
-int rand_gen(int count);
+int rand_gen(int count, rng_stream *rng);
+void rng_init(rng_stream *rng, uint64_t seed, uint32_t game_index, uint32_t stream);
+uint32_t rng_next(rng_stream *rng);
+void rng_fill(rng_stream *rng, uint32_t *out, size_t n);
+void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+void game_seed(game *g, uint64_t seed, uint32_t game_index);
 void swap(card *pt, int i, int j);
 card* remove_member(card *p, card **hl, card **hr);
 void create_player_hands(card **deck_hl, card **deck_hr, card **p1_hl, card **p1_hr, card **p2_hl, card **p2_hr);
-int guess_a_card(int players_turn, int **p1_score_ptr, card **player1_hl, card **player1_hr, card **player2_hl, card **player2_hr, card **deck_hl, card **deck_hr);
+void free_list(card *hl);
+void game_init(game *g, FILE *out);
+void game_free(game *g);
+void game_reset(game *g, const uint8_t order[], int n);
+int play_turns(game *g, hint_engine *hints, tui *screen);
+int get_next_game(void);
+int game_resume(game *g, int guess_rank);
+int game_submit(game *g, char *guess);
+int start_turn(game *g);
+void print_turn(game *g);
+void complete_book(game *g, int player, int rank);
+int guess_a_card(game *g, int guess_rank);
 int validate_guess(char *guess);
 int validate_possession(int guess_rank, card *guesser_hl);
 int convert_guess(char guess[]);
@@ -68,11 +819,148 @@ char convert_rank(int rank);
 int check_if_playable(card *p1_hl, card *p2_hl, card *deck_hl);
 int check_for_winner(int* p1_score, int *p2_score);
 int check_for_book(card *hl);
-int process_guess(int guesser, int guess_rank, int **player_score,  card **p1_hl, card **p1_hr, card **p2_hl, card **p2_hr, card **deck_hl, card **deck_hr);
+int process_guess(game *g, int guesser, int guess_rank);
 void transfer_cards(int num_of_cards, int guess_rank, card **guesser_hl, card **guesser_hr, card **opp_hl, card **opp_hr);
 void go_fish(card **guesser_hl, card **guesser_hr, card **deck_hl, card **deck_hr);
-void remove_book(int rank, card **player_hl, card **player_hr);
-void declare_winner(int p1_score, int p2_score);
+void remove_book(int rank, card **player_hl, card **player_hr, card **book_hl, card **book_hr);
+void insert_member(card *p, int index, card **hl, card **hr);
+int card_code(card *p);
+card* card_from_code(int code);
+int save_game(const game *g, game_snapshot *snap);
+int restore_game(game *g, const game_snapshot *snap);
+int write_checkpoint(const char *path, game_snapshot *games, uint32_t num_games, uint32_t next_index);
+checkpoint* open_checkpoint(const char *path);
+void close_checkpoint(checkpoint *c);
+int find_snapshot(const checkpoint *c, uint32_t id);
+int compare_snapshots(const void *a, const void *b);
+void stop_server(int signum);
+history* new_history(void);
+void free_history(history *h);
+void history_note(game *g, int op, int a, int b, int c);
+void history_note_moves(game *g, card *hl, int rank, int limit, int from, int to);
+void history_begin(game *g, int guess_rank);
+void history_end(game *g);
+int history_undo(game *g);
+int history_redo(game *g, int branch);
+card** history_list(game *g, int list, card ***hr);
+void count_card(game *g, int from, int to, int rank);
+void declare_winner(FILE *out, int p1_score, int p2_score);
+int end_game(game *g);
+void log_event(game *g, int type, int player, int rank, int count);
+int push_event(event_ring *ring, const game_event *event);
+event_log* open_event_log(const char *path, int num_rings, int policy);
+uint64_t close_event_log(event_log *log);
+void* event_writer(void *arg);
+int run_batch(int argc, char *argv[]);
+void* batch_worker_main(void *arg);
+int play_silent_game(game *g, const bot *bots, move_clock *clock);
+int choose_random_ask(game *g);
+int choose_bot_ask(game *g, const bot *b, uint64_t deadline_ns);
+int choose_search_ask(game *g, const bot *b, uint64_t deadline_ns);
+uint64_t monotonic_ns(void);
+int bot_decide(game *g, const bot *b, move_clock *clock);
+int latency_bucket(uint64_t ns);
+uint64_t latency_percentile(const latency_histogram *h, double p);
+void record_latency(latency_histogram *h, uint64_t ns);
+void merge_latency(latency_histogram *into, const latency_histogram *from);
+void print_latency(const char *label, const latency_histogram *h, long budget_ns);
+int metrics_option(metrics *m, const char *name, const char *value);
+int start_metrics(metrics *m, const char *mode);
+void stop_metrics(metrics *m);
+engine_counters* metrics_counters(metrics *m);
+void counter_add(_Atomic uint64_t *counter, uint64_t n);
+void count_move(engine_counters *c, uint64_t ns);
+void count_decision(engine_counters *c, int player, uint64_t ns, int overrun, int fallback);
+void* metrics_worker(void *arg);
+void render_metrics(metrics *m, FILE *out);
+void serve_metrics(metrics *m, int fd);
+int dump_metrics(metrics *m);
+int open_metrics_socket(const char *address);
+int strategy_context(const game *g, int player);
+int strategy_row(const game *g, int player, int rank);
+int load_bot(bot *b, const char *spec);
+int load_plugin(bot *b, const char *path);
+int choose_plugin_ask(game *g, const bot *b, uint64_t deadline_ns);
+void attach_bots(game *g, const bot *bots);
+void attach_plugin(game *g, int player, const gofish_strategy *plugin);
+void detach_bots(game *g);
+void notify_plugins(game *g, int type, int player, int rank, int count);
+int train_strategy(int argc, char *argv[]);
+int analyze_position(int argc, char *argv[]);
+int run_ladder(int argc, char *argv[]);
+void* ladder_worker(void *arg);
+void ladder_update(ladder_entry *winner, ladder_entry *loser);
+double ladder_information(const ladder_entry *a, const ladder_entry *b);
+int run_compare(int argc, char *argv[]);
+void* compare_worker(void *arg);
+double normal_quantile(double p);
+int enumerate_hidden_deals(const game *g, int player, hidden_deal *deals, int limit, double *total);
+int sample_hidden_deals(const game *g, int player, uint64_t seed, hidden_deal *deals, int count);
+int next_rank_permutation(uint8_t *ranks, int n);
+void tui_render(tui *t, const game *g);
+int tui_guess(tui *t, game *g, char *guess);
+void tui_text(char row[], int col, const char *text);
+const char* rank_name(int rank, char name[3]);
+void* analysis_worker(void *arg);
+int play_out_deal(const analysis *a, const hidden_deal *deal, int deal_index, int rank);
+void add_result(result_block *block, const game *g, int winner);
+void write_result_block(result_file *results, result_block *block);
+int summarize_results(int argc, char *argv[]);
+int extract_features(int argc, char *argv[]);
+feature_game* find_feature_game(feature_game *games, uint32_t mask, uint32_t id, int create);
+void drop_feature_game(feature_game *games, uint32_t mask, feature_game *f);
+void feature_row(const feature_game *f, int player, int deck, int turn, uint8_t row[]);
+void feature_floats(const uint8_t row[], float out[]);
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+void crc32_init(void);
+result_run* find_result_run(result_run **runs, int *num_runs, const result_header *header);
+int replay_game(int argc, char *argv[]);
+void game_view_fill(const game *g, int player, game_view *v);
+hint_engine* start_hint_engine(uint64_t seed, eval_cache *cache);
+void stop_hint_engine(hint_engine *h);
+void update_hint(hint_engine *h, const game *g);
+void show_hint(hint_engine *h, FILE *out);
+void* hint_worker(void *arg);
+void save_hint(hint_engine *h);
+uint64_t position_key(const game_view *v, uint64_t salt, int canon[]);
+eval_cache* open_eval_cache(const char *path);
+void close_eval_cache(eval_cache *cache);
+eval_entry* eval_cache_lookup(eval_cache *cache, uint64_t key);
+void eval_cache_store(eval_cache *cache, uint64_t key, uint32_t samples, const float value[]);
+int run_server(const char *path, const char *checkpoint_path, metrics *m, session_store *st, const bot *opponent, move_clock *clock);
+int open_server_socket(const char *path);
+session* open_session(int fd, FILE *out, uint64_t seed, uint32_t index, engine_counters *counters, const bot *opponent, move_clock *clock);
+void play_opponent(session *s);
+void close_session(session *s);
+int flush_session(session *s, FILE *out, char **out_buf, size_t *out_len);
+void read_session(session *s, checkpoint *parked, session_store *st);
+int store_option(session_store *st, const char *name, const char *value);
+int open_store(session_store *st);
+void close_store(session_store *st);
+int grow_store_file(int fd, size_t *slots, size_t needed, size_t slot_size);
+int store_park(session_store *st, const game *g);
+int store_take(session_store *st, uint32_t id, game *g);
+int park_session(session *s, session_store *st, idle_session *idle);
+session* wake_session(const idle_session *idle, session_store *st, FILE *out, engine_counters *counters, const bot *opponent, move_clock *clock);
+int evict_sessions(session **sessions, int num_sessions, session_store *st, idle_session **idle, int *num_idle, int *cap_idle);
+int compare_sessions(const void *a, const void *b);
+int run_loadgen(int argc, char *argv[]);
+int parse_think(const char *spec, think_time *t);
+uint64_t think_ns(const think_time *t, rng_stream *rng);
+int connect_load_client(load_client *c, const char *path);
+int read_load_client(load_client *c, const think_time *think, load_step *s);
+int pick_ask(load_client *c, char ask[8]);
+void record_latency(latency_histogram *h, uint64_t ns);
+void process_usage(pid_t pid, long *ticks, long *rss_kb);
+int write_load_json(const char *path, const load_step *steps, int num_steps, const char *think_spec, double slo_ms, int capacity, uint64_t seed);
+int run_broadcast(int argc, char *argv[]);
+chunk* new_chunk(const char *data, size_t len);
+void release_chunk(chunk *c);
+chunk* broadcast_snapshot(const game *g);
+void channel_publish(channel *ch, chunk *c, const game *g);
+void channel_add(channel *ch, int fd, const game *g);
+void channel_drop(channel *ch, int i);
+int flush_watcher(watcher *w);
 
 
 /*
@@ -85,174 +973,330 @@ void declare_winner(int p1_score, int p2_score);
  * Used the values above will allow for ease of processing guess depending on what the user enters.
  */
 
-int main(void) {
-    
-    // Print header
-    print_go_fish_title();
+int main(int argc, char *argv[]) {
     
-    // Seed the RNG
-    srand((int)time(NULL));
+    // Server mode: one thread schedules every connected game, see run_server()
+    if (argc >= 3 && argc % 2 == 1 && strcmp(argv[1], "--server") == 0) {
+        const char *checkpoint_path = NULL;
+        metrics m;
+        session_store st;
+        bot opponent;
+        move_clock clock;
+        int use_opponent = 0;
+        int usage = 0;
+        memset(&m, 0, sizeof(metrics));
+        memset(&clock, 0, sizeof(move_clock));
+        memset(&st, 0, sizeof(session_store));
+        st.idle_ns = 30000000000ULL;
+        for (int i = 3; i + 1 < argc && !usage; i += 2) {
+            if (strcmp(argv[i], "--checkpoint") == 0) {
+                checkpoint_path = argv[i + 1];
+            } else if (strcmp(argv[i], "--opponent") == 0) {
+                use_opponent = 1;
+                if (load_bot(&opponent, argv[i + 1]) != 0) {
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--deadline") == 0) {
+                clock.budget_ns = atol(argv[i + 1]) * 1000;
+                usage = (clock.budget_ns <= 0);
+            } else if (!metrics_option(&m, argv[i], argv[i + 1]) && !store_option(&st, argv[i], argv[i + 1])) {
+                usage = 1;
+            }
+        }
+        if (!usage) {
+            return run_server(argv[2], checkpoint_path, &m, &st, use_opponent ? &opponent : NULL, &clock);
+        }
+    } else if (argc >= 3 && strcmp(argv[1], "--simulate") == 0) {
+        return run_batch(argc, argv);
+    } else if (argc >= 3 && strcmp(argv[1], "--results") == 0) {
+        return summarize_results(argc, argv);
+    } else if (argc >= 4 && strcmp(argv[1], "--replay") == 0) {
+        return replay_game(argc, argv);
+    } else if (argc >= 4 && strcmp(argv[1], "--train") == 0) {
+        return train_strategy(argc, argv);
+    } else if (argc >= 5 && strcmp(argv[1], "--analyze") == 0) {
+        return analyze_position(argc, argv);
+    } else if (argc >= 3 && strcmp(argv[1], "--ladder") == 0) {
+        return run_ladder(argc, argv);
+    } else if (argc >= 4 && strcmp(argv[1], "--compare") == 0) {
+        return run_compare(argc, argv);
+    } else if (argc >= 3 && strcmp(argv[1], "--script") == 0) {
+        return run_script(argc, argv);
+    } else if (argc >= 3 && strcmp(argv[1], "--features") == 0) {
+        return extract_features(argc, argv);
+    } else if (argc >= 3 && strcmp(argv[1], "--broadcast") == 0) {
+        return run_broadcast(argc, argv);
+    } else if (argc >= 3 && strcmp(argv[1], "--loadgen") == 0) {
+        return run_loadgen(argc, argv);
+    }
     
     /* Variable Declarations */
     int deck_init; // Selection of which deck they'd like to start with, file or random shuffled deck
-    int players_turn = 1; // Binary 1 or 2 that alternates at each players turn
-    int flag = 0;
-    
-    // Declare head and tail pointer to keep track of each end of the list
-    card *deck_hl = NULL;
-    card *deck_hr = NULL;
+    int exit_code = 0;
+    game g; // Deck, both hands and scores
+    hint_engine *hints = NULL; // Only runs when started with --hints
+    eval_cache *cache = NULL; // Only kept when started with --eval-cache
+    tui *screen = NULL; // Only drawn when started with --tui
+    const char *cache_path = NULL;
+    uint64_t seed = (uint64_t)time(NULL);
+    int use_hints = 0;
+    int use_session = 0;
+    int usage = 0;
     
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--hints") == 0) {
+            use_hints = 1;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--eval-cache") == 0 && i + 1 < argc) {
+            cache_path = argv[++i];
+        } else if (strcmp(argv[i], "--tui") == 0) {
+            screen = (tui*)calloc(1, sizeof(tui));
+        } else if (strcmp(argv[i], "--session") == 0) {
+            use_session = 1;
+        } else {
+            usage = 1;
+        }
+    }
+    if (usage) {
+        printf("Usage: %s [--hints [--eval-cache FILE]] [--seed S] [--tui] [--session]\n", argv[0]);
+        printf("       %s --server SOCKET_PATH [--checkpoint FILE] [--opponent BOT [--deadline MICROSECONDS]] [--store FILE [--idle SECONDS] [--memory-budget MB]] [--metrics PORT|SOCKET_PATH] [--metrics-dump FILE [--metrics-interval SECONDS]]\n", argv[0]);
+        printf("       %s --simulate GAMES [--threads N] [--seed S] [--shard i/n] [--bot1 BOT] [--bot2 BOT] [--deadline MICROSECONDS] [--results FILE] [--log FILE] [--log-policy drop|block] [--metrics PORT|SOCKET_PATH] [--metrics-dump FILE [--metrics-interval SECONDS]]\n", argv[0]);
+        printf("       %s --results FILE...\n", argv[0]);
+        printf("       %s --replay SEED GAME_INDEX [--bot1 BOT] [--bot2 BOT]\n", argv[0]);
+        printf("       %s --train TABLE_FILE GAMES [--seed S]\n", argv[0]);
+        printf("       %s --analyze SEED GAME_INDEX TURN [--bot1 BOT] [--bot2 BOT] [--threads N] [--limit DEALS] [--samples DEALS]\n", argv[0]);
+        printf("       %s --ladder BOT BOT... [--threads N] [--seed S] [--target SIGMA] [--max-games GAMES] [--deadline MICROSECONDS]\n", argv[0]);
+        printf("       %s --compare BOT_A BOT_B [--threads N] [--seed S] [--alpha A] [--min-deals DEALS] [--max-deals DEALS]\n", argv[0]);
+        printf("       %s --script FILE (--seed S [--index GAME_INDEX] | --deck FILE) [--quiet]\n", argv[0]);
+        printf("       %s --features OUT_FILE LOG_FILE... [--float]\n", argv[0]);
+        printf("       %s --broadcast SOCKET_PATH [--bot1 BOT] [--bot2 BOT] [--seed S] [--delay MS] [--games GAMES] [--deadline MICROSECONDS]\n", argv[0]);
+        printf("       %s --loadgen SOCKET_PATH [--clients N] [--steps N] [--step-seconds S] [--think fixed:MS|uniform:MIN:MAX|exp:MEAN] [--slo MS] [--seed S] [--pid PID] [--json FILE]\n", argv[0]);
+        printf("BOT is random (default), most, last, a TABLE_FILE written by --train, search:BOT or a strategy plugin PATH.so\n");
+        return 1;
+    }
     
-    // Players hands
-    card *player1_hl = NULL;
-    card *player1_hr = NULL;
-    card *player2_hl = NULL;
-    card *player2_hr = NULL;
-    int player1_score = 0;
-    int player2_score = 0;
-    int *p1_score_ptr = &player1_score;
-    int *p2_score_ptr = &player2_score;
+    // Print header
+    print_go_fish_title();
     
+    game_init(&g, stdout);
+    game_seed(&g, seed, 0); // Interactive game is game 0 of its seed
+    g.history = new_history();
+    if (use_hints) {
+        if (cache_path != NULL) {
+            cache = open_eval_cache(cache_path);
+            if (cache == NULL) {
+                printf("ERROR: Could not open %s for the evaluation cache\n", cache_path);
+            }
+        }
+        hints = start_hint_engine(seed, cache);
+        printf("HINTS ARE ON! Type ? at the guess prompt to see the best ask.\n\n");
+    }
     
     // Get user selection: use shuffled deck(0) or use preformatted file input (1)
     deck_init = get_deck_selection();
     
     // Generate deck based on selectiong
-    if (deck_init == 0) {
+    if (deck_init < 0) {
+        
+        printf("\nERROR: Input ended before a deck was chosen. Ending Program\n");
+        exit_code = EXIT_EARLY_EOF;
         
-        generate_random_deck(&deck_hl, &deck_hr);
-        shuffle_deck(deck_hl);
+    } else if (deck_init == 0) {
+        
+        generate_random_deck(&g.deck_hl, &g.deck_hr);
+        shuffle_deck(g.deck_hl, &g.rng);
         printf("*********************************\n");
         printf("* GENERATED DECK:               *\n");
         printf("*********************************\n");
-        print_hand(deck_hl);
+        print_hand(stdout, g.deck_hl);
         
     } else if (deck_init == 1) {
         
-        read_in_deck(&deck_hl, &deck_hr);
-        printf("*********************************\n");
-        printf("* DECK FROM FILE:               *\n");
-        printf("*********************************\n");
-        print_hand(deck_hl);
+        if (read_in_deck(&g.deck_hl, &g.deck_hr) != 0) {
+            exit_code = EXIT_BAD_INPUT;
+        } else {
+            printf("*********************************\n");
+            printf("* DECK FROM FILE:               *\n");
+            printf("*********************************\n");
+            print_hand(stdout, g.deck_hl);
+        }
         
     }
     
-    // Generate player hands and display the table before gameplay starts
-    create_player_hands(&deck_hl, &deck_hr, &player1_hl, &player1_hr, &player2_hl, &player2_hr);
-    
-    // printf("*********************************\n");
-    // printf("* PLAYER 1 HAND:                *\n");
-    // printf("*********************************\n");
-    // print_hand(player1_hl);
-    
-    // printf("*********************************\n");
-    // printf("* PLAYER 2 HAND:                *\n");
-    // printf("*********************************\n");
-    // print_hand(player2_hl);
-
-    
+    if (screen != NULL) {
+        // The terminal UI draws the game itself
+        g.out = NULL;
+    }
     
-    // Start the Gameplay
-    printf("\n\n*********************************\n");
-    printf("* HANDS DEALT! LET'S BEGIN!     *\n");
-    printf("*********************************\n\n");
+    // Play one game, or as many as the players like with --session reusing everything set up above
+    int tally[3] = {0, 0, 0}; // Ties, then wins of each seat
+    uint32_t game_index = 0;
+    uint8_t deal[52]; // Deck the current game was dealt from, card codes from the top
+    int deal_size = 0;
+    for (card *temp = g.deck_hl; temp != NULL && deal_size < 52; temp = temp->next) {
+        deal[deal_size++] = (uint8_t)card_code(temp);
+    }
+    while (exit_code == 0) {
+        exit_code = play_turns(&g, hints, screen);
+        if (screen != NULL) {
+            if (exit_code == 0) {
+                tui_render(screen, &g);
+            }
+            printf("\033[%d;1H", TUI_ROWS + 1); // Leave the cursor below the game
+            if (exit_code == 0) {
+                declare_winner(stdout, g.score[0], g.score[1]);
+            }
+        }
+        if (!use_session || exit_code != 0) {
+            break;
+        }
+        tally[(g.score[0] > g.score[1]) ? PLAYER_ONE : (g.score[0] < g.score[1]) ? PLAYER_TWO : 0]++;
+        printf("\nSESSION: %d GAMES, PLAYER 1 WON %d, PLAYER 2 WON %d, %d TIED\n", tally[0] + tally[1] + tally[2], tally[1], tally[2], tally[0]);
+        
+        int choice = get_next_game();
+        if (choice != 'n' && choice != 'r') {
+            break;
+        }
+        if (choice == 'n') {
+            // Next deal of the seed, the same one ./main --replay SEED GAME_INDEX deals
+            game_index++;
+            g.swap_seats = 0;
+            game_reset(&g, NULL, 0);
+            game_seed(&g, seed, game_index);
+            shuffle_deck(g.deck_hl, &g.rng);
+            deal_size = 0;
+            for (card *temp = g.deck_hl; temp != NULL && deal_size < 52; temp = temp->next) {
+                deal[deal_size++] = (uint8_t)card_code(temp);
+            }
+        } else {
+            g.swap_seats = !g.swap_seats;
+            game_reset(&g, deal, deal_size);
+        }
+        if (screen != NULL) {
+            screen->drawn = 0; // Start the next game on a blank terminal
+            screen->action[0] = '\0';
+            screen->message[0] = '\0';
+        } else {
+            printf("\n*********************************\n");
+            printf("* GAME %-4u%s *\n", game_index, (g.swap_seats) ? " (SEATS SWAPPED)    " : "                    ");
+            printf("*********************************\n");
+        }
+    }
+    free(screen);
     
-    // First check highly unlikely case where a player is dealt a book at start of game.
-    int book_value = check_for_book(player1_hl);
-    if (book_value != 0) {
-        // Book Detected, remove and increment score
-        remove_book(book_value, &player1_hl, &player1_hr);
-        player1_score++;
-    } else {
-        // No Book detected, Proceed
+    if (exit_code == EXIT_EARLY_EOF && deck_init >= 0) {
+        printf("\nERROR: Input ended before the game was over. Ending Program\n");
+    } else if (exit_code == 0) {
+        printf("\n\nTHANKS FOR PLAYING!\n\n");
     }
-    book_value = check_for_book(player2_hl);
-    if (book_value != 0) {
-        // Book Detected, remove and increment score
-        remove_book(book_value, &player2_hl, &player2_hr);
-        player2_score++;
-    } else {
-        //No Book detected, Proceed
+ 
+    // free memory
+    if (hints != NULL) {
+        stop_hint_engine(hints);
+    }
+    if (cache != NULL) {
+        close_eval_cache(cache);
     }
+    free_history(g.history);
+    game_free(&g);
     
     
+    return exit_code;
+}
+
+
+/************************************************************************
+ * play_turns(): Function that plays an interactive game from the deal  *
+ *      to the end, reading one guess (or ?, undo or redo) per line.    *
+ *      Returns 0 once the winner is declared, EXIT_EARLY_EOF if the    *
+ *      input ends first.                                               *
+ ************************************************************************/
+int play_turns(game *g, hint_engine *hints, tui *screen) {
     
-    // Now loop until a winner is declared
-    while(check_if_playable(player1_hl, player2_hl, deck_hl) != 1) {
-        
-        // Check the hands to ensure the game is still playable or break out if game is over
-        if (find_length(player1_hl) == 0) {
-            // Hand is empty, check to see if there are any more cards to draw from the deck
-            if (find_length(deck_hl) == 0) {
-                // Pool is empty, therefore game is over
-                break;
-            } else {
-                printf("PLAYER 1 RAN OUT OF CARDS! DRAW A CARD\n");
-                go_fish(&player1_hl, &player1_hr, &deck_hl, &deck_hr);
-                flag = FORCE_SWAP;
-            }
+    char guess[SCRIPT_LINE_SIZE];
+    
+    // Deal and play until the first guess is needed, then feed guesses until a winner is declared
+    int state = game_resume(g, 0);
+    while (state == GAME_AWAIT_GUESS) {
+        if (hints != NULL) {
+            // Hand is on screen, let the hint engine work while the player thinks
+            update_hint(hints, g);
         }
-        
-        // Check the hands to ensure the game is still playable or break out if game is over
-        if (find_length(player2_hl) == 0) {
-            // Hand is empty, check to see if there are any more cards to draw from the deck
-            if (find_length(deck_hl) == 0) {
-                // Pool is empty, therefore game is over
-                break;
+        if (screen != NULL) {
+            tui_render(screen, g);
+        }
+        int length = read_line(stdin, guess, SCRIPT_LINE_SIZE);
+        if (length == -1) {
+            // Nobody left to answer the prompt, give up instead of waiting forever
+            return EXIT_EARLY_EOF;
+        } else if (length == 0) {
+            continue;
+        } else if (length < -1) {
+            guess[0] = '\0'; // Too long to be a guess, let it be reported as invalid
+        }
+        if (hints != NULL && strcmp(guess, "?") == 0) {
+            if (screen != NULL) {
+                FILE *message = fmemopen(screen->message, TUI_COLS, "w");
+                show_hint(hints, message);
+                fclose(message);
+                screen->message[strcspn(screen->message, "\n")] = '\0';
             } else {
-                printf("PLAYER 2 RAN OUT OF CARDS! DRAW A CARD\n");
-                go_fish(&player2_hl, &player2_hr, &deck_hl, &deck_hr);
-                flag = FORCE_SWAP;
+                show_hint(hints, stdout);
+                print_guess_prompt(stdout, g->players_turn);
             }
+            continue;
         }
-
-        if (flag == FORCE_SWAP) {
-            printf("SWITCHING TURNS!\n");
-            if (players_turn == PLAYER_ONE) {
-                players_turn = PLAYER_TWO;
+        if (strcmp(guess, "undo") == 0 || strcmp(guess, "redo") == 0) {
+            // Take back the last guess or play it again
+            if (strcmp(guess, "undo") == 0 && history_undo(g)) {
+                if (screen != NULL) {
+                    strcpy(screen->message, "LAST GUESS TAKEN BACK!");
+                } else {
+                    printf("\nLAST GUESS TAKEN BACK!\n");
+                    print_turn(g);
+                }
+            } else if (strcmp(guess, "redo") == 0 && history_redo(g, 0)) {
+                state = g->state;
+                if (screen != NULL) {
+                    strcpy(screen->message, "GUESS PLAYED AGAIN!");
+                }
+            } else if (screen != NULL) {
+                snprintf(screen->message, TUI_COLS, "Nothing to %s!", guess);
             } else {
-                players_turn = PLAYER_ONE;
-            }
-            flag = 0; // Reset flag to playable state
-        } else {
-            if (players_turn == PLAYER_ONE) {
-                // Execute entire processing of a guess within this function call
-                printf("\n*********************************\n");
-                printf("* PLAYER 1 HAND:                *\n");
-                printf("*********************************\n");
-                print_hand(player1_hl);
-                players_turn = guess_a_card(players_turn, &p1_score_ptr, &player1_hl, &player1_hr, &player2_hl, &player2_hr, &deck_hl, &deck_hr);
-            } else if (players_turn == PLAYER_TWO) {
-                // Execute entire processing of a guess within this function call
-                printf("\n*********************************\n");
-                printf("* PLAYER 2 HAND:                *\n");
-                printf("*********************************\n");
-                print_hand(player2_hl);
-                players_turn = guess_a_card(players_turn, &p2_score_ptr, &player2_hl, &player2_hr, &player1_hl, &player1_hr, &deck_hl, &deck_hr);
+                printf("Nothing to %s!\n", guess);
+                print_guess_prompt(stdout, g->players_turn);
             }
+            continue;
         }
-        
-        if (check_for_winner(p1_score_ptr, p2_score_ptr) != 0) {
-            // A winner has been found, declare the winner
-            break;
-        }
-        
+        state = (screen != NULL) ? tui_guess(screen, g, guess) : game_submit(g, guess);
+    }
+    
+    return 0;
+    
+}
 
-    } // end gameplaye whileloop
+
+/************************************************************************
+ * get_next_game(): Function that asks what to play after a game of a   *
+ *      --session: 'n' for the next deal, 'r' for a rematch of the same *
+ *      deal with the hands swapped or 'q' to stop. Returns -1 if the   *
+ *      input ends first.                                               *
+ ************************************************************************/
+int get_next_game(void) {
     
-    declare_winner(*p1_score_ptr, *p2_score_ptr);
-    printf("\n\nTHANKS FOR PLAYING!\n\n");
- 
-    // free memory
-    free(deck_hl);
-    free(deck_hr);
-    free(player1_hl);
-    free(player1_hr);
-    free(player2_hl);
-    free(player2_hr);
+    char line[LINE_SIZE];
     
+    printf("\nNext deal (n), rematch with seats swapped (r) or quit (q)? ");
+    while (read_line(stdin, line, LINE_SIZE) != -1) {
+        if (strcmp(line, "n") == 0 || strcmp(line, "r") == 0 || strcmp(line, "q") == 0) {
+            return line[0];
+        }
+        printf("\nERROR, that is not a valid selection.\n");
+        printf("Next deal (n), rematch with seats swapped (r) or quit (q)? ");
+    }
+    return -1;
     
-    return 0;
 }
 
 
@@ -311,19 +1355,19 @@ void print_go_fish_title() {
 /************************************************************************
  * print_go_fish(): Function that prints large title to signify go fish *
  ************************************************************************/
-void print_go_fish() {
-    printf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n"); // Clear Screen
-    printf("\n><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n");
-    printf("><((('>    ____     _____      _____ _____  _____                 ><((('>\n");
-    printf("><((('>  /         |     |    |        |   |       |    |   | |   ><((('>\n");
-    printf("><((('> |    ____  |     |    |___     |   |_____  |____|   | |   ><((('>\n");
-    printf("><((('> |      |\\  |     |    |        |        |  |    |   | |   ><((('>\n");
-    printf("><((('>  \\____/    |_____|    |      __|__ _____|  |    |   o o   ><((('>\n");
-    printf("><((('>                                                           ><((('>\n");
-    printf("><((('>     Incorrect Guess! Draw a card! Switching Turns!        ><((('>\n");
-    printf("><((('>                                                           ><((('>\n");
-    printf("><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n\n");
-    printf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n"); // Clear screen
+void print_go_fish(FILE *out) {
+    fprintf(out, "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n"); // Clear Screen
+    fprintf(out, "\n><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n");
+    fprintf(out, "><((('>    ____     _____      _____ _____  _____                 ><((('>\n");
+    fprintf(out, "><((('>  /         |     |    |        |   |       |    |   | |   ><((('>\n");
+    fprintf(out, "><((('> |    ____  |     |    |___     |   |_____  |____|   | |   ><((('>\n");
+    fprintf(out, "><((('> |      |\\  |     |    |        |        |  |    |   | |   ><((('>\n");
+    fprintf(out, "><((('>  \\____/    |_____|    |      __|__ _____|  |    |   o o   ><((('>\n");
+    fprintf(out, "><((('>                                                           ><((('>\n");
+    fprintf(out, "><((('>     Incorrect Guess! Draw a card! Switching Turns!        ><((('>\n");
+    fprintf(out, "><((('>                                                           ><((('>\n");
+    fprintf(out, "><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n\n");
+    fprintf(out, "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n"); // Clear screen
 }
 
 
@@ -378,65 +1422,59 @@ void print_formatted_list(card *p) {
  *      the passed-in players hand with formatted graphics and unicode  *
  *      symbols to represent the suits.                                 *
  ************************************************************************/
-void print_hand(card *hl) {
+void print_hand(FILE *out, card *hl) {
     
-    card *temp = (card*)malloc(sizeof(card));
+    card *temp = hl;
     // serves as a flag to maintain pointer to the correct set of cards
-    card *current_start = (card*)malloc(sizeof(card));
+    card *current_start = hl;
     int length = find_length(hl);
     int running_length = length;
     
-    temp = hl;
-    current_start = hl;
-    
     int i;
     while (running_length > 0) {
         i = 0;
         
         while (i < CARD_LIMIT && i < running_length) {
-            printf(" -----  ");
+            fprintf(out, " -----  ");
             i++;
         }
-        printf("\n");
+        fprintf(out, "\n");
         
         i = 0;
         while (i < CARD_LIMIT && i < running_length) {
-            print_leftside_card(temp);
+            print_leftside_card(out, temp);
             temp = temp->next;
             i++;
         }
-        printf("\n");
+        fprintf(out, "\n");
         temp = current_start;
         i = 0;
         while (i < CARD_LIMIT && i < running_length) {
-            printf("|     | ");
+            fprintf(out, "|     | ");
             i++;
         }
-        printf("\n");
+        fprintf(out, "\n");
         
         i = 0;
         while (i < CARD_LIMIT && i < running_length) {
-            print_rightside_card(temp);
+            print_rightside_card(out, temp);
             temp = temp->next;
             i++;
         }
-        printf("\n");
+        fprintf(out, "\n");
         
         i = 0;
         while (i < CARD_LIMIT && i < running_length) {
-            printf(" -----  ");
+            fprintf(out, " -----  ");
             i++;
         }
-        printf("\n");
+        fprintf(out, "\n");
         
         running_length = running_length - CARD_LIMIT;
         current_start = temp;
         
     }
     
-    free(temp);
-    free(current_start);
-    
 }
 
 
@@ -444,32 +1482,32 @@ void print_hand(card *hl) {
  * print_leftside_card(): Function that is specifically tailored to     *
  *      correctly print the top left side of the card with rank & suit  *
  ************************************************************************/
-void print_leftside_card(card *card) {
+void print_leftside_card(FILE *out, card *card) {
     
     // 10 is the special case since it takes up two spaces
     if (card->value == 10) {
-        printf("|10");
+        fprintf(out, "|10");
         if (strcmp(card->suit, "hearts") == 0) {
-            printf("\u2665  | ");
+            fprintf(out, "\u2665  | ");
         } else if (strcmp(card->suit, "diamonds") == 0) {
-            printf("\u2666  | ");
+            fprintf(out, "\u2666  | ");
         } else if (strcmp(card->suit, "spades") == 0) {
-            printf("\u2660  | ");
+            fprintf(out, "\u2660  | ");
         } else {
             // Clubs
-            printf("\u2663  | ");
+            fprintf(out, "\u2663  | ");
         }
     } else {
-        printf("|%c", convert_rank(card->value));
+        fprintf(out, "|%c", convert_rank(card->value));
         if (strcmp(card->suit, "hearts") == 0) {
-            printf("\u2665   | ");
+            fprintf(out, "\u2665   | ");
         } else if (strcmp(card->suit, "diamonds") == 0) {
-            printf("\u2666   | ");
+            fprintf(out, "\u2666   | ");
         } else if (strcmp(card->suit, "spades") == 0) {
-            printf("\u2660   | ");
+            fprintf(out, "\u2660   | ");
         } else {
             // Clubs
-            printf("\u2663   | ");
+            fprintf(out, "\u2663   | ");
         }
     }
     
@@ -482,51 +1520,75 @@ void print_leftside_card(card *card) {
  * print_rightside_card(): Function that is specifically tailored to    *
  *      correctly print the bottom right of the card with rank & suit   *
  ************************************************************************/
-void print_rightside_card(card *card) {
+void print_rightside_card(FILE *out, card *card) {
     
     // |  10\u2665|
     
     // 10 is the special case since it takes up two spaces
     if (card->value == 10) {
-        printf("|  10");
+        fprintf(out, "|  10");
     } else {
-        printf("|   %c", convert_rank(card->value));
+        fprintf(out, "|   %c", convert_rank(card->value));
     }
     
     if (strcmp(card->suit, "hearts") == 0) {
-        printf("\u2665| ");
+        fprintf(out, "\u2665| ");
     } else if (strcmp(card->suit, "diamonds") == 0) {
-        printf("\u2666| ");
+        fprintf(out, "\u2666| ");
     } else if (strcmp(card->suit, "spades") == 0) {
-        printf("\u2660| ");
+        fprintf(out, "\u2660| ");
     } else {
         // Clubs
-        printf("\u2663| ");
+        fprintf(out, "\u2663| ");
     }
     
 }
 
+/************************************************************************
+ * print_guess_prompt(): Function that asks the player whose turn it is *
+ *      for their next guess.                                           *
+ ************************************************************************/
+void print_guess_prompt(FILE *out, int players_turn) {
+    fprintf(out, "Player %d, Make a Guess (please enter A, 2-10, J, Q, or K): \n", players_turn);
+    fprintf(out, "Guess: ");
+}
+
+
+/************************************************************************
+ * print_book(): Function that announces a completed book along with    *
+ *      the new score of the player who completed it.                   *
+ ************************************************************************/
+void print_book(FILE *out, int player, int score) {
+    fprintf(out, "\n*************************************************************\n");
+    fprintf(out, "*\n");
+    fprintf(out, "* NICE JOB COMPLETING A BOOK! PLAYER %d's NEW SCORE IS: %d  \n", player, score);
+    fprintf(out, "*\n");
+    fprintf(out, "*************************************************************\n");
+}
+
 /************************************************************************
  * get_deck_selection(): Function that returns the binary choice (0/1)  *
  *      that the user selected as the deck generation method.           *
  *                                                                      *
  * Parameters - None                                                    *
+ * Returns -1 if the input ends before a selection is made.             *
  ************************************************************************/
 int get_deck_selection(void) {
     
-    int deck_selection;
+    char line[LINE_SIZE];
     
     printf("Would you like a shuffled deck (0) or a deck provided from a file (1)? Please choose 0 or 1: ");
-    scanf("%d", &deck_selection);
     
-    // Loop until valid delection is made
-    while (deck_selection != 0 && deck_selection != 1) {
+    // Loop until valid delection is made, or return -1 once there is no input left to choose with
+    while (read_line(stdin, line, LINE_SIZE) != -1) {
+        if (strcmp(line, "0") == 0 || strcmp(line, "1") == 0) {
+            return line[0] - '0';
+        }
         printf("\nERROR, that is not a valid selection.\n");
         printf("Would you like a shuffled deck (0) or a deck provided from a file (1)? Please choose 0 or 1: ");
-        scanf("%d", &deck_selection);
     }
     
-    return deck_selection;
+    return -1;
     
 }
 
@@ -562,35 +1624,128 @@ void generate_random_deck(card **deck_hl, card **deck_hr) {
 
 
 /************************************************************************
- * read_in_deck(): Function that will attempt to read a file that is    *
- *      formatted in a specfic way so that the function can parse the   *
- *      line and populate a deck of 52 cards.                           *
+ * read_in_deck(): Function that asks the user for the name of a deck   *
+ *      file and loads it with load_deck(). Returns 0 on success, -1    *
+ *      when the file cannot be read or the input ends first.           *
  ************************************************************************/
-void read_in_deck(card **deck_hl, card **deck_hr) {
+int read_in_deck(card **deck_hl, card **deck_hr) {
     
-    
-    char line[LINE_SIZE];
     char filename[FILENAME_SIZE];
-    // Load deck from preformatted file
-    FILE *inp;
     
     // Request the filename from the user
     printf("Enter the filename you wish to read from: ");
-    scanf("%s", filename);
+    int length = read_line(stdin, filename, FILENAME_SIZE);
+    if (length == -1) {
+        printf("\nERROR: Input ended before a filename was given. Ending Program\n");
+        return -1;
+    }
     
     // Attempt to open and read given file
-    inp = fopen(filename, "r");
-    if (inp == NULL) {
+    const char *problem = NULL;
+    int bad_line = (length < -1) ? -1 : load_deck(filename, deck_hl, deck_hr, &problem);
+    if (bad_line < 0) {
         printf("ERROR: Could not open file. Ending Program\n");
-        exit(-1);
+        return -1;
+    } else if (bad_line > 0) {
+        printf("ERROR: %s:%d: %s. Ending Program\n", filename, bad_line, problem);
+        return -1;
+    }
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * load_deck(): Function that will attempt to read a file that is       *
+ *      formatted in a specfic way so that the function can parse the   *
+ *      line and populate a deck of 52 cards. Every line must be a card *
+ *      pull_card_data() accepts, and the file must hold each of the 52 *
+ *      cards exactly once. Returns 0, -1 if the file cannot be opened, *
+ *      or the number of the first bad line with problem set to what is *
+ *      wrong with it, in which case the deck is left empty.            *
+ ************************************************************************/
+int load_deck(const char *filename, card **deck_hl, card **deck_hr, const char **problem) {
+    
+    char line[LINE_SIZE];
+    int seen[NUM_RANKS * 4 + 4] = {0}; // Indexed by card_code()
+    int num_cards = 0, line_number = 0, bad_line = 0;
+    int length;
+    // Load deck from preformatted file
+    FILE *inp = fopen(filename, "r");
+    if (inp == NULL) {
+        return -1;
     }
     
     // Loop through file reading and parsing contents line by line
-    while (fgets(line, LINE_SIZE, inp) != NULL) {
-        card *temp_card = (card*)malloc(sizeof(card));
-        temp_card = pull_card_data(line); // Parse data from line
-        add_to_end(*deck_hr, deck_hl, deck_hr, temp_card);
+    while (bad_line == 0 && (length = read_line(inp, line, LINE_SIZE)) != -1) {
+        line_number++;
+        card *temp_card = (length < 0) ? NULL : pull_card_data(line); // Parse data from line
+        if (temp_card == NULL) {
+            *problem = "not a card, expected a rank (A, 2-10, J, Q or K) and a suit (hearts, diamonds, clubs or spades)";
+            bad_line = line_number;
+        } else if (num_cards == 52) {
+            *problem = "more than 52 cards";
+            bad_line = line_number;
+        } else if (seen[card_code(temp_card)]++) {
+            *problem = "this card is already in the deck";
+            bad_line = line_number;
+        } else {
+            add_to_end(*deck_hr, deck_hl, deck_hr, temp_card);
+            num_cards++;
+            continue;
+        }
+        free(temp_card);
+    }
+    if (bad_line == 0 && num_cards < 52) {
+        *problem = "the deck ends before all 52 cards";
+        bad_line = line_number + 1;
+    }
+    
+    fclose(inp);
+    if (bad_line != 0) {
+        free_list(*deck_hl);
+        *deck_hl = *deck_hr = NULL;
     }
+    return bad_line;
+    
+}
+
+
+/************************************************************************
+ * read_line(): Function that reads one line of input into line[] with  *
+ *      the newline and surrounding whitespace stripped. Unlike scanf() *
+ *      it always consumes the whole line, so bad input cannot be read  *
+ *      again and again. Returns the length of the line, -1 at the end  *
+ *      of the input, or -2 for a line too long for line[] (the start   *
+ *      of it is kept, the rest is thrown away).                        *
+ ************************************************************************/
+int read_line(FILE *in, char line[], int size) {
+    
+    if (fgets(line, size, in) == NULL) {
+        return -1;
+    }
+    
+    int length = (int)strlen(line);
+    int too_long = (length == size - 1 && line[length - 1] != '\n');
+    if (too_long) {
+        // Throw away the rest of the line
+        int c;
+        while ((c = fgetc(in)) != EOF && c != '\n') {
+        }
+    }
+    
+    // Strip the newline, a carriage return and spaces from both ends
+    while (length > 0 && isspace((unsigned char)line[length - 1])) {
+        length--;
+    }
+    line[length] = '\0';
+    int start = 0;
+    while (isspace((unsigned char)line[start])) {
+        start++;
+    }
+    memmove(line, line + start, length - start + 1);
+    
+    return too_long ? -2 : length - start;
     
 }
 
@@ -627,47 +1782,38 @@ void add_to_end(card *p, card **hl, card **hr, card *temp_card) {
 /************************************************************************
  * pull_card_data(): Function that accepts the current line being read  *
  *      from the file and uses the pre-determined format to parse the   *
- *      data, create a Card Struct and return that Card Struct.         *
+ *      data, create a Card Struct and return that Card Struct. Returns *
+ *      NULL if the line is not a rank and a suit.                      *
  *                                                                      *
- * Parameters: line - current line being read from the file.            *
+ * Parameters: line - current line being read from the file, with the   *
+ *                  newline already stripped (see read_line()).         *
  * -> format of line: Rank Suit ----> EXAMPLE: 8 spades OR K diamonds   *
  ************************************************************************/
 card* pull_card_data(char line[]) {
     
-    char *temp;
-    int i;
-    card *temp_card = (card*)malloc(sizeof(card));
-    
-    // Remove trailing new line when reading from file
-    line[strlen(line) - 1] = '\0';
+    static const char *suits[] = {"hearts", "diamonds", "clubs", "spades"};
+    char *temp = strchr(line, ' ');
     
-    // Parse data and begin process of creating Linked List
-    if (line[0] == 'J') {
-        temp_card->value = 11;
-    } else if (line[0] == 'Q') {
-        temp_card->value = 12;
-    } else if (line[0] == 'K') {
-        temp_card->value = 13;
-    } else {
-        temp_card->value = atoi(&line[0]); // Pull integer value
+    if (temp == NULL) {
+        return NULL;
     }
-    temp = &line[2]; // Set pointer to begin pulling suit
-    i = 0;
+    *temp = '\0'; // Split the rank from the suit
+    int rank = parse_rank(line);
+    *temp = ' ';
     
-    // Move pointer one more (covers the 10 case)
-    if (*temp == ' ') {
+    // Move pointer past the spaces to the suit
+    while (*temp == ' ') {
         temp++;
     }
-    // Loop until the end of the line, saving them into suit attribute
-    while (*temp != '\0') {
-        temp_card->suit[i] = *temp;
-        temp++;
-        i++;
+    for (int i = 0; i < 4; i++) {
+        if (rank != 0 && strcmp(temp, suits[i]) == 0) {
+            card *temp_card = (card*)malloc(sizeof(card));
+            temp_card->value = rank;
+            strcpy(temp_card->suit, suits[i]);
+            return temp_card;
+        }
     }
-    
-    temp_card->suit[i] = '\0'; // terminate the string
-    
-    return temp_card;
+    return NULL;
     
 }
 
@@ -678,21 +1824,24 @@ card* pull_card_data(char line[]) {
  *      shuffling method. Performs a specifiec number of swaps on two   *
  *      randomly selected indices of the LinkedList.                    *
  ************************************************************************/
-void shuffle_deck(card *hl) {
+void shuffle_deck(card *hl, rng_stream *rng) {
     
     // Find number of cards present in the pool
     int num_cards = find_length(hl);
     
     int num_swaps = NUM_OF_SWAPS;
     int idx_1, idx_2;
+    uint32_t words[2 * NUM_OF_SWAPS]; // Random bits for every swap, generated in bulk
+    
+    rng_fill(rng, words, 2 * num_swaps);
     for (int i = 0; i < num_swaps; i++) {
-        idx_1 = rand_gen(num_cards);
-        idx_2 = rand_gen(num_cards);
+        idx_1 = (int)(((uint64_t)words[2 * i] * num_cards) >> 32);
+        idx_2 = (int)(((uint64_t)words[2 * i + 1] * num_cards) >> 32);
         
         // Need to ensure that we don't swap a card with itself
         while (idx_2 == idx_1) {
             // Grab another random index
-            idx_2 = rand_gen(num_cards);
+            idx_2 = rand_gen(num_cards, rng);
         }
         swap(hl, idx_1, idx_2);
     }
@@ -711,16 +1860,13 @@ int find_length(card *hl) {
     
     int length = 0;
     
-    card *curr = (card*)malloc(sizeof(card));
-    curr = hl;
+    card *curr = hl;
     
     while (curr != NULL) {
         length++;
         curr = curr->next;
     }
     
-    free(curr);
-    
     return length;
 }
 
@@ -730,17 +1876,123 @@ int find_length(card *hl) {
  *      of the LinkedList in order to pull two indices to swap their    *
  *      values (i.e. their value and suit of card)                      *
  ************************************************************************/
-int rand_gen(int count) {
+int rand_gen(int count, rng_stream *rng) {
     double frac;
-    frac = (double)rand()/((double)RAND_MAX+1);
+    frac = (double)rng_next(rng)/4294967296.0; // 2^32
     return floor(count*frac);
 }
 
 
 /************************************************************************
- * swap(): Function that accepts the two target indices and the pointer *
- *      to the head of the LinkedList. Traverses the list pulling the   *
- *      nodes at the given indices (i, j) then performs a swap of the   *
+ * game_seed(): Function that gives a game its deck stream and a stream *
+ *      for the computer player in each seat. Game game_index of a run  *
+ *      always plays out the same whatever thread or order it runs in.  *
+ ************************************************************************/
+void game_seed(game *g, uint64_t seed, uint32_t game_index) {
+    g->seed = seed;
+    g->id = game_index;
+    rng_init(&g->rng, seed, game_index, STREAM_DECK);
+    rng_init(&g->bot_rng[0], seed, game_index, STREAM_PLAYER);
+    rng_init(&g->bot_rng[1], seed, game_index, STREAM_PLAYER + 1);
+}
+
+
+/************************************************************************
+ * rng_init(): Function that positions a RNG Stream at the start of the *
+ *      stream identified by (seed, game_index, stream). Two streams    *
+ *      with different identifiers never overlap.                       *
+ ************************************************************************/
+void rng_init(rng_stream *rng, uint64_t seed, uint32_t game_index, uint32_t stream) {
+    rng->key[0] = (uint32_t)seed;
+    rng->key[1] = (uint32_t)(seed >> 32);
+    rng->counter[0] = 0;
+    rng->counter[1] = 0;
+    rng->counter[2] = game_index;
+    rng->counter[3] = stream;
+    rng->used = 4; // Buffer is empty
+}
+
+
+/************************************************************************
+ * rng_next(): Function that returns the next 32 random bits of a RNG   *
+ *      Stream, generating a new block of four words when needed.       *
+ ************************************************************************/
+uint32_t rng_next(rng_stream *rng) {
+    
+    if (rng->used == 4) {
+        philox4x32(rng->counter, rng->key, rng->buffer);
+        if (++rng->counter[0] == 0) {
+            rng->counter[1]++;
+        }
+        rng->used = 0;
+    }
+    return rng->buffer[rng->used++];
+    
+}
+
+
+/************************************************************************
+ * rng_fill(): Function that fills out with the next n words of a RNG   *
+ *      Stream, generating whole blocks straight into out. Produces the *
+ *      same words as n calls to rng_next().                            *
+ ************************************************************************/
+void rng_fill(rng_stream *rng, uint32_t *out, size_t n) {
+    
+    size_t i = 0;
+    
+    // Use up what is left of the buffered block first
+    while (i < n && rng->used < 4) {
+        out[i++] = rng->buffer[rng->used++];
+    }
+    
+    while (n - i >= 4) {
+        philox4x32(rng->counter, rng->key, &out[i]);
+        if (++rng->counter[0] == 0) {
+            rng->counter[1]++;
+        }
+        i += 4;
+    }
+    
+    while (i < n) {
+        out[i++] = rng_next(rng);
+    }
+    
+}
+
+
+/************************************************************************
+ * philox4x32(): Function that computes one block of the Philox4x32-10  *
+ *      counter-based generator: 10 rounds of multiply/xor mixing of    *
+ *      the counter under the key.                                      *
+ ************************************************************************/
+void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+    
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    
+    for (int round = 0; round < 10; round++) {
+        uint64_t product0 = (uint64_t)0xD2511F53 * c0;
+        uint64_t product1 = (uint64_t)0xCD9E8D57 * c2;
+        c0 = (uint32_t)(product1 >> 32) ^ c1 ^ k0;
+        c1 = (uint32_t)product1;
+        c2 = (uint32_t)(product0 >> 32) ^ c3 ^ k1;
+        c3 = (uint32_t)product0;
+        k0 += 0x9E3779B9;
+        k1 += 0xBB67AE85;
+    }
+    
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+    
+}
+
+
+/************************************************************************
+ * swap(): Function that accepts the two target indices and the pointer *
+ *      to the head of the LinkedList. Traverses the list pulling the   *
+ *      nodes at the given indices (i, j) then performs a swap of the   *
  *      value and suit of the card, essentially swapping cards          *
  ************************************************************************/
 void swap(card *pt, int i, int j) {
@@ -817,15 +2069,13 @@ void create_player_hands(card **deck_hl, card **deck_hr, card **player1_hl, card
     
     for (int i = 0; i < 7; i++) {
         // Remove 1 card from top of pool (head-left of the deck)
-        card *p1_card = (card*)malloc(sizeof(card));
-        p1_card = remove_member(*deck_hl, deck_hl, deck_hr);
+        card *p1_card = remove_member(*deck_hl, deck_hl, deck_hr);
         
         // Add to player 1's hand
         add_to_end(*player1_hr, player1_hl, player1_hr, p1_card);
         
         // Remove 1 card from top of pool (head-left of the deck)
-        card *p2_card = (card*)malloc(sizeof(card));
-        p2_card = remove_member(*deck_hl, deck_hl, deck_hr);
+        card *p2_card = remove_member(*deck_hl, deck_hl, deck_hr);
         
         // Add to player 2's hand
         add_to_end(*player2_hr, player2_hl, player2_hr, p2_card);
@@ -836,31 +2086,405 @@ void create_player_hands(card **deck_hl, card **deck_hr, card **player1_hl, card
 
 
 /************************************************************************
- * guess_a_card(): Function that is responsible the guessing mechanics  *
- *      and will prompt user for guess, validate the response, and      *
- *      call all necessary functions to correctly process that guess    *
- *      and returns the int value of the Player (1 or 2) that will      *
- *      continue with the next turn.                                    *
+ * free_list(): Function that frees every Card Struct of a LinkedList.  *
+ *                                                                      *
+ * Parameters: hl - head of the list to be freed, may be NULL           *
+ ************************************************************************/
+void free_list(card *hl) {
+    card *next;
+    while (hl != NULL) {
+        next = hl->next;
+        free(hl);
+        hl = next;
+    }
+}
+
+
+/************************************************************************
+ * game_init(): Function that resets a Game Struct to an empty table    *
+ *      with Player 1 to move. The deck still has to be generated or    *
+ *      read in before the game is resumed for the first time.          *
+ *                                                                      *
+ * Parameters: out - stream the game is printed to, NULL for silence    *
+ ************************************************************************/
+void game_init(game *g, FILE *out) {
+    memset(g, 0, sizeof(game));
+    g->players_turn = PLAYER_ONE;
+    g->first_book_turn = -1;
+    g->state = GAME_DEAL;
+    g->out = out;
+}
+
+
+/************************************************************************
+ * game_free(): Function that frees every card still held in the deck   *
+ *      or in either of the players hands.                              *
+ ************************************************************************/
+void game_free(game *g) {
+    detach_bots(g);
+    free_list(g->deck_hl);
+    free_list(g->hand_hl[0]);
+    free_list(g->hand_hl[1]);
+    free_list(g->book_hl);
+    g->deck_hl = g->deck_hr = NULL;
+    g->hand_hl[0] = g->hand_hr[0] = NULL;
+    g->hand_hl[1] = g->hand_hr[1] = NULL;
+    g->book_hl = g->book_hr = NULL;
+}
+
+
+/************************************************************************
+ * game_reset(): Function that gets a game ready to be dealt again      *
+ *      without allocating anything: every card of the last game (deck, *
+ *      hands and books) goes back into the deck. With an order (n card *
+ *      codes from the top) the deck is stacked in that order to deal a *
+ *      game again, otherwise it is put in the order generate_random_   *
+ *      deck() makes, so a shuffle deals exactly what a fresh deck      *
+ *      would. A game without cards gets a new deck. The output, event  *
+ *      log, undo history storage, random streams and seat order are    *
+ *      kept, everything else starts over.                              *
+ ************************************************************************/
+void game_reset(game *g, const uint8_t order[], int n) {
+    
+    card *by_code[NUM_RANKS * 4 + 4] = {NULL}; // Cards stacked up by card_code()
+    card *lists[4] = {g->deck_hl, g->hand_hl[0], g->hand_hl[1], g->book_hl};
+    int found = 0;
+    
+    detach_bots(g); // Strategy plugins start every game with a fresh state
+    game keep = *g;
+    
+    for (int i = 0; i < 4; i++) {
+        card *next;
+        for (card *p = lists[i]; p != NULL; p = next) {
+            next = p->next;
+            int code = card_code(p);
+            p->next = by_code[code];
+            by_code[code] = p;
+            found = 1;
+        }
+    }
+    
+    game_init(g, keep.out);
+    g->log = keep.log;
+    g->history = keep.history;
+    g->seed = keep.seed;
+    g->id = keep.id;
+    g->rng = keep.rng;
+    g->bot_rng[0] = keep.bot_rng[0];
+    g->bot_rng[1] = keep.bot_rng[1];
+    g->swap_seats = keep.swap_seats;
+    g->counters = keep.counters;
+    if (g->history != NULL) {
+        g->history->num_nodes = 0;
+        g->history->num_entries = 0;
+        g->history->current = -1;
+        g->history->recording = -1;
+        g->history->first_move = -1;
+    }
+    
+    if (!found) {
+        generate_random_deck(&g->deck_hl, &g->deck_hr);
+        if (g->counters != NULL) {
+            counter_add(&g->counters->cards_allocated, 52);
+        }
+        return;
+    }
+    for (int i = 0; order != NULL && i < n; i++) {
+        card *p = by_code[order[i]];
+        if (p != NULL) {
+            by_code[order[i]] = p->next;
+            add_to_end(g->deck_hr, &g->deck_hl, &g->deck_hr, p);
+        }
+    }
+    for (int code = 0; code < NUM_RANKS * 4 + 4; code++) {
+        card *next;
+        for (card *p = by_code[code]; p != NULL; p = next) {
+            next = p->next;
+            add_to_end(g->deck_hr, &g->deck_hl, &g->deck_hr, p);
+        }
+    }
+    
+}
+
+
+/************************************************************************
+ * game_resume(): Turn loop of the game written as a stackless          *
+ *      coroutine. Runs the game forward from the resume point saved in *
+ *      g->state until a guess is needed, then returns GAME_AWAIT_GUESS *
+ *      instead of blocking so the caller is free to run other games.   *
+ *      Call again with the guessed rank to continue (0 when there is   *
+ *      no guess yet). Returns GAME_OVER once the winner is declared.   *
+ *                                                                      *
+ * Parameters: guess_rank - rank guessed by the player whose turn it is *
+ ************************************************************************/
+int game_resume(game *g, int guess_rank) {
+    
+    int book_value;
+    
+    while (1) {
+        switch (g->state) {
+                
+            case GAME_DEAL:
+                // Generate player hands before gameplay starts
+                {
+                    int first = (g->swap_seats != 0); // Seat that gets the first card
+                    create_player_hands(&g->deck_hl, &g->deck_hr, &g->hand_hl[first], &g->hand_hr[first], &g->hand_hl[1 - first], &g->hand_hr[1 - first]);
+                }
+                for (int i = 0; i < 2; i++) {
+                    for (card *temp = g->hand_hl[i]; temp != NULL; temp = temp->next) {
+                        g->hand_count[i][temp->value]++;
+                    }
+                }
+                g->deck_count = find_length(g->deck_hl);
+                if (g->log != NULL) {
+                    for (int i = 0; i < 2; i++) {
+                        for (card *temp = g->hand_hl[i]; temp != NULL; temp = temp->next) {
+                            log_event(g, EVENT_DEAL, i + 1, temp->value, 1);
+                        }
+                    }
+                }
+                if (g->out != NULL) {
+                    fprintf(g->out, "\n\n*********************************\n");
+                    fprintf(g->out, "* HANDS DEALT! LET'S BEGIN!     *\n");
+                    fprintf(g->out, "*********************************\n\n");
+                }
+                
+                // First check highly unlikely case where a player is dealt a book at start of game.
+                for (int i = 0; i < 2; i++) {
+                    book_value = check_for_book(g->hand_hl[i]);
+                    if (book_value != 0) {
+                        // Book Detected, remove and increment score
+                        complete_book(g, i + 1, book_value);
+                    }
+                }
+                g->state = GAME_TURN;
+                break;
+                
+            case GAME_TURN:
+                g->state = start_turn(g);
+                if (g->state != GAME_TURN) {
+                    // Suspend until the player makes a guess (or for good), the turn is complete
+                    history_end(g);
+                    return g->state;
+                }
+                break;
+                
+            case GAME_AWAIT_GUESS:
+                if (guess_rank == 0) {
+                    // Nothing to process yet, stay suspended
+                    return g->state;
+                }
+                if (validate_possession(guess_rank, g->hand_hl[g->players_turn - 1]) != 1) {
+                    if (g->out != NULL) {
+                        fprintf(g->out, "Oops! You do not possess that card! Try again!\n");
+                        print_guess_prompt(g->out, g->players_turn);
+                    }
+                    return g->state;
+                }
+                // Execute entire processing of a guess within this function call
+                history_begin(g, guess_rank);
+                history_note(g, HIST_TURN, g->players_turn, 0, 0);
+                g->players_turn = guess_a_card(g, guess_rank);
+                guess_rank = 0; // Guess has been used up
+                g->state = GAME_TURN;
+                break;
+                
+            default:
+                // GAME_OVER, nothing left to run
+                return g->state;
+        }
+    }
+    
+}
+
+
+/************************************************************************
+ * game_submit(): Function that validates a guess typed in by a player  *
+ *      and resumes the game with it. Invalid guesses are reported and  *
+ *      the game stays suspended on the same player.                    *
+ ************************************************************************/
+int game_submit(game *g, char *guess) {
+    
+    if (validate_guess(guess) != 1) {
+        if (g->out != NULL) {
+            fprintf(g->out, "That is not a valid guess. Try Again\n");
+            print_guess_prompt(g->out, g->players_turn);
+        }
+        return g->state;
+    }
+    
+    return game_resume(g, convert_guess(guess));
+    
+}
+
+
+/************************************************************************
+ * start_turn(): Function that runs the checks made at the start of     *
+ *      every turn. A player with an empty hand draws a card from the   *
+ *      pool and the turns are switched. Returns the state the game     *
+ *      moves to: GAME_OVER, GAME_TURN (after a forced swap) or         *
+ *      GAME_AWAIT_GUESS once the hand has been shown to the player.    *
+ ************************************************************************/
+int start_turn(game *g) {
+    
+    int flag = 0;
+    
+    if (check_if_playable(g->hand_hl[0], g->hand_hl[1], g->deck_hl) == 1 || check_for_winner(&g->score[0], &g->score[1]) != 0) {
+        // A winner has been found or the game is dead, declare the winner
+        return end_game(g);
+    }
+    
+    for (int i = 0; i < 2; i++) {
+        // Check the hands to ensure the game is still playable or break out if game is over
+        if (g->hand_hl[i] == NULL) {
+            // Hand is empty, check to see if there are any more cards to draw from the deck
+            if (g->deck_hl == NULL) {
+                // Pool is empty, therefore game is over
+                return end_game(g);
+            }
+            if (g->out != NULL) {
+                fprintf(g->out, "PLAYER %d RAN OUT OF CARDS! DRAW A CARD\n", i + 1);
+            }
+            history_note(g, HIST_MOVE, card_code(g->deck_hl), HIST_DECK << 4 | (HIST_DECK + i + 1), 0);
+            go_fish(&g->hand_hl[i], &g->hand_hr[i], &g->deck_hl, &g->deck_hr);
+            count_card(g, HIST_DECK, HIST_DECK + i + 1, g->hand_hr[i]->value);
+            log_event(g, EVENT_DRAW, i + 1, g->hand_hr[i]->value, 1);
+            flag = FORCE_SWAP;
+        }
+    }
+    
+    if (flag == FORCE_SWAP) {
+        if (g->out != NULL) {
+            fprintf(g->out, "SWITCHING TURNS!\n");
+        }
+        history_note(g, HIST_TURN, g->players_turn, 0, 0);
+        if (g->players_turn == PLAYER_ONE) {
+            g->players_turn = PLAYER_TWO;
+        } else {
+            g->players_turn = PLAYER_ONE;
+        }
+        history_note(g, HIST_COUNTER, 1, g->forced_swaps & 0xFF, g->forced_swaps >> 8);
+        g->forced_swaps++;
+        return GAME_TURN;
+    }
+    
+    print_turn(g);
+    return GAME_AWAIT_GUESS;
+    
+}
+
+
+/************************************************************************
+ * print_turn(): Function that shows the player whose turn it is their  *
+ *      hand and asks them for a guess.                                 *
+ ************************************************************************/
+void print_turn(game *g) {
+    if (g->out != NULL) {
+        fprintf(g->out, "\n*********************************\n");
+        fprintf(g->out, "* PLAYER %d HAND:                *\n", g->players_turn);
+        fprintf(g->out, "*********************************\n");
+        print_hand(g->out, g->hand_hl[g->players_turn - 1]);
+        print_guess_prompt(g->out, g->players_turn);
+    }
+}
+
+
+/************************************************************************
+ * end_game(): Function that declares the winner of a finished game and *
+ *      returns GAME_OVER for the turn loop to stop on.                 *
+ ************************************************************************/
+int end_game(game *g) {
+    
+    int winner = 0; // Tie
+    
+    if (g->score[0] > g->score[1]) {
+        winner = PLAYER_ONE;
+    } else if (g->score[0] < g->score[1]) {
+        winner = PLAYER_TWO;
+    }
+    log_event(g, EVENT_WINNER, winner, g->score[0], g->score[1]);
+    
+    if (g->out != NULL) {
+        declare_winner(g->out, g->score[0], g->score[1]);
+    }
+    return GAME_OVER;
+    
+}
+
+
+/************************************************************************
+ * game_view_fill(): Function that flattens what player can see of the  *
+ *      game into a Game View: their own hand counted per rank and the  *
+ *      public information about the opponent, the pool and the books.  *
  ************************************************************************/
-int guess_a_card(int players_turn, int **p1_score_ptr, card **player1_hl, card **player1_hr, card **player2_hl, card **player2_hr, card **deck_hl, card **deck_hr) {
+void game_view_fill(const game *g, int player, game_view *v) {
+    
+    int opponent = (player == PLAYER_ONE) ? PLAYER_TWO : PLAYER_ONE;
+    
+    memset(v, 0, sizeof(game_view));
+    v->player = player;
+    for (int rank = 1; rank <= NUM_RANKS; rank++) {
+        v->hand[rank] = g->hand_count[player - 1][rank];
+        v->known[rank] = g->known[opponent - 1][rank];
+        v->booked[rank] = g->booked[rank];
+        v->opp_cards += g->hand_count[opponent - 1][rank];
+    }
+    v->deck_cards = g->deck_count;
+    v->score = g->score[player - 1];
+    v->opp_score = g->score[opponent - 1];
+    v->opp_last_ask = g->last_ask[opponent - 1];
     
-    char guess[GUESS_SIZE];
-    int guess_rank;
+}
+
+
+/************************************************************************
+ * complete_book(): Function that takes a completed book of rank out of *
+ *      the players hand and increments their score.                    *
+ ************************************************************************/
+void complete_book(game *g, int player, int rank) {
     
-    printf("Player %d, Make a Guess (please enter A, 2-10, J, Q, or K): \n", players_turn);
-    printf("Guess: ");
-    scanf("%s", guess);
+    history_note_moves(g, g->hand_hl[player - 1], rank, 4, HIST_DECK + player, HIST_BOOK);
+    remove_book(rank, &g->hand_hl[player - 1], &g->hand_hr[player - 1], &g->book_hl, &g->book_hr);
+    g->hand_count[player - 1][rank] = 0;
     
-    while (validate_guess(guess) != 1) {
-        printf("That is not a valid guess. Try Again\n");
-        printf("Player %d, Make a Guess (please enter A, 2-10, J, Q, or K): \n", players_turn);
-        printf("Guess: ");
-        scanf("%s", guess);
+    history_note(g, HIST_SCORE, player - 1, g->score[player - 1], 0);
+    history_note(g, HIST_KNOWN, player - 1, rank, g->known[player - 1][rank]);
+    history_note(g, HIST_BOOKED, rank, g->booked[rank], 0);
+    g->score[player - 1]++;
+    g->known[player - 1][rank] = 0;
+    g->booked[rank] = player;
+    if (g->first_book_turn < 0) {
+        history_note(g, HIST_COUNTER, 2, 0xFF, 0xFF);
+        g->first_book_turn = g->turn_count;
     }
+    log_event(g, EVENT_BOOK, player, rank, g->score[player - 1]);
+    
+}
+
+
+/************************************************************************
+ * guess_a_card(): Function that is responsible the guessing mechanics  *
+ *      and will call all necessary functions to correctly process the  *
+ *      (already validated) guess of the player whose turn it is and    *
+ *      returns the int value of the Player (1 or 2) that will continue *
+ *      with the next turn.                                             *
+ ************************************************************************/
+int guess_a_card(game *g, int guess_rank) {
     
-    guess_rank = convert_guess(guess);
+    int players_turn = g->players_turn;
     
-    if (process_guess(players_turn, guess_rank, p1_score_ptr, player1_hl, player1_hr, player2_hl, player2_hr, deck_hl, deck_hr)) {
+    g->turn_count++;
+    log_event(g, EVENT_ASK, players_turn, guess_rank, 0);
+    
+    // Asking for a rank tells the opponent the player holds at least one
+    history_note(g, HIST_LAST_ASK, players_turn - 1, g->last_ask[players_turn - 1], 0);
+    g->last_ask[players_turn - 1] = guess_rank;
+    if (g->known[players_turn - 1][guess_rank] == 0) {
+        history_note(g, HIST_KNOWN, players_turn - 1, guess_rank, 0);
+        g->known[players_turn - 1][guess_rank] = 1;
+    }
+    
+    if (process_guess(g, players_turn, guess_rank)) {
         // Card was found and moved, maintain turn
         if (players_turn == PLAYER_ONE) {
             return PLAYER_ONE;
@@ -885,20 +2509,15 @@ int guess_a_card(int players_turn, int **p1_score_ptr, card **player1_hl, card *
  ************************************************************************/
 int validate_guess(char *guess) {
     
-    if (strcmp(guess, "A") == 0 || strcmp(guess, "2") == 0 || strcmp(guess, "3") == 0 || strcmp(guess, "4") == 0 || strcmp(guess, "5") == 0 || strcmp(guess, "6") == 0 || strcmp(guess, "7") == 0 || strcmp(guess, "8") == 0 || strcmp(guess, "9") == 0 || strcmp(guess, "10") == 0 || strcmp(guess, "J") == 0 || strcmp(guess, "Q") == 0 || strcmp(guess, "K") == 0) {
-        // If any of the above is true, then a valid guess has been entered, return 1
-        return 1;
-    }
-    return 0; // Invalid guess given, return 0
+    return parse_rank(guess) != 0;
     
 }
 
 int validate_possession(int guess_rank, card *guesser_hl) {
     
-    card *temp = (card*)malloc(sizeof(card));
+    card *temp = guesser_hl;
     
     // Check to see if the user guessed a rank that they posses
-    temp = guesser_hl;
     while (temp != NULL) {
         if (temp->value == guess_rank) {
             // Player possess card, proceed to process guess
@@ -918,19 +2537,24 @@ int validate_possession(int guess_rank, card *guesser_hl) {
  ************************************************************************/
 int convert_guess(char guess[]) {
     
-    // Will convert the A, J, Q, K inputs to their respective rank values
-    // If value 2-10 entered, will return the integer equivalent
-    if (strcmp(guess, "A") == 0) {
-        return 1;
-    } else if (strcmp(guess, "J") == 0) {
-        return 11;
-    } else if (strcmp(guess, "Q") == 0) {
-        return 12;
-    } else if (strcmp(guess, "K") == 0) {
-        return 13;
-    } else {
-        return atoi(guess);
+    return parse_rank(guess);
+    
+}
+
+
+/************************************************************************
+ * parse_rank(): Function that converts a rank typed as A, 2-10, J, Q   *
+ *      or K (lower case letters are fine too) to its integer value     *
+ *      with a single look up in RANK_LOOKUP. Returns 0 if the text is  *
+ *      not a rank.                                                     *
+ ************************************************************************/
+int parse_rank(const char *text) {
+    
+    if (text[0] == '1') {
+        // Only rank written with two characters
+        return (text[1] == '0' && text[2] == '\0') ? 10 : 0;
     }
+    return (text[0] != '\0' && text[1] == '\0') ? RANK_LOOKUP[(unsigned char)text[0]] : 0;
     
 }
 
@@ -1001,8 +2625,7 @@ int check_for_book(card *hl) {
     int occurrence_array[length];
     
     // populate array with values
-    card *temp = (card*)malloc(sizeof(card));
-    temp = hl;
+    card *temp = hl;
     
     for (int i = 0; i < length; i++) {
         occurrence_array[i] = temp->value;
@@ -1035,91 +2658,74 @@ int check_for_book(card *hl) {
  *      rank. If so, keeps a count so that all cards of that rank can   *
  *      be transferred from opponent's hand to the guesser's hand.      *
  ************************************************************************/
-int process_guess(int guesser, int guess_rank, int **player_score, card **guesser_hl, card **guesser_hr, card **opp_hl, card **opp_hr, card **deck_hl, card **deck_hr) {
+int process_guess(game *g, int guesser, int guess_rank) {
    
-    // Iterate through the list and see if rank exists in hand, if so, how many.
-    int num_of_cards = 0;
+    int num_of_cards;
     int book_value;
+    int opponent = (guesser == PLAYER_ONE) ? PLAYER_TWO : PLAYER_ONE;
+    card **guesser_hl = &g->hand_hl[guesser - 1];
+    card **guesser_hr = &g->hand_hr[guesser - 1];
+    card **opp_hl = &g->hand_hl[opponent - 1];
+    card **opp_hr = &g->hand_hr[opponent - 1];
+    FILE *out = g->out;
     
-    card *temp = (card*)malloc(sizeof(card));
-    char guess[GUESS_SIZE];
-    
-    while (validate_possession(guess_rank, *guesser_hl) != 1) {
-        printf("Oops! You do not possess that card! Try again!\n");
-        printf("Player %d, Make a Guess (please enter A, 2-10, J, Q, or K): \n", guesser);
-        printf("Guess: ");
-        scanf("%s", guess);
-        guess_rank = convert_guess(guess);
-    }
-    
-    temp = *opp_hl;
-    while (temp != NULL) {
-        if (temp->value == guess_rank) {
-            num_of_cards++;
-        }
-        temp = temp->next;
-    }
+    // See if rank exists in the opponents hand, if so, how many.
+    num_of_cards = g->hand_count[opponent - 1][guess_rank];
     
     // Now we check to see if any cards exist
     if (num_of_cards > 0) {
         // There is a card that needs to be transfered from opponenets deck to guessers deck
         
-        if (guesser == PLAYER_ONE) {
-            // transfer from Player 2 to Player 1
-            if (guess_rank == 10) {
-                printf("\n*************************************************************\n");
-                printf("*\n");
-                printf("* CARD FOUND! Transferring all 10's from Player 2 to Player 1\n");
-                printf("*\n");
-                printf("*************************************************************\n");
-            } else {
-                printf("\n*************************************************************\n");
-                printf("*\n");
-                printf("* CARD FOUND! Transferring all %c's from Player 2 to Player 1\n", convert_rank(guess_rank));
-                printf("*\n");
-                printf("*************************************************************\n");
-            }
-        } else {
+        if (out != NULL) {
+            fprintf(out, "\n*************************************************************\n");
+            fprintf(out, "*\n");
             if (guess_rank == 10) {
-                printf("\n*************************************************************\n");
-                printf("*\n");
-                printf("* CARD FOUND! Transferring all 10's from Player 1 to Player 2\n");
-                printf("*\n");
-                printf("*************************************************************\n");
+                fprintf(out, "* CARD FOUND! Transferring all 10's from Player %d to Player %d\n", opponent, guesser);
             } else {
-                printf("\n*************************************************************\n");
-                printf("*\n");
-                printf("* CARD FOUND! Transferring all %c's from Player 1 to Player 2\n", convert_rank(guess_rank));
-                printf("*\n");
-                printf("*************************************************************\n");
+                fprintf(out, "* CARD FOUND! Transferring all %c's from Player %d to Player %d\n", convert_rank(guess_rank), opponent, guesser);
             }
+            fprintf(out, "*\n");
+            fprintf(out, "*************************************************************\n");
         }
         
+        history_note_moves(g, *opp_hl, guess_rank, num_of_cards, HIST_DECK + opponent, HIST_DECK + guesser);
         transfer_cards(num_of_cards, guess_rank, guesser_hl, guesser_hr, opp_hl, opp_hr);
+        g->hand_count[guesser - 1][guess_rank] += num_of_cards;
+        g->hand_count[opponent - 1][guess_rank] = 0;
+        log_event(g, EVENT_TRANSFER, guesser, guess_rank, num_of_cards);
+        history_note(g, HIST_KNOWN, guesser - 1, guess_rank, g->known[guesser - 1][guess_rank]);
+        history_note(g, HIST_KNOWN, opponent - 1, guess_rank, g->known[opponent - 1][guess_rank]);
+        g->known[guesser - 1][guess_rank] += num_of_cards;
+        g->known[opponent - 1][guess_rank] = 0;
         book_value = check_for_book(*guesser_hl);
         if (book_value != 0) {
-            remove_book(book_value, guesser_hl, guesser_hr);
-            (**player_score)++;
-            printf("\n*************************************************************\n");
-            printf("*\n");
-            printf("* NICE JOB COMPLETING A BOOK! PLAYER %d's NEW SCORE IS: %d  \n", guesser, **player_score);
-            printf("*\n");
-            printf("*************************************************************\n");
+            complete_book(g, guesser, book_value);
+            if (out != NULL) {
+                print_book(out, guesser, g->score[guesser - 1]);
+            }
         }
         return 1;
     } else {
         // Card was not found, therefore, GOFISH occurs
-        print_go_fish();
-        go_fish(guesser_hl, guesser_hr, deck_hl, deck_hr);
+        history_note(g, HIST_COUNTER, 0, g->fish_count & 0xFF, g->fish_count >> 8);
+        g->fish_count++;
+        if (out != NULL) {
+            print_go_fish(out);
+        }
+        if (g->deck_hl != NULL) {
+            history_note(g, HIST_MOVE, card_code(g->deck_hl), HIST_DECK << 4 | (HIST_DECK + guesser), 0);
+            go_fish(guesser_hl, guesser_hr, &g->deck_hl, &g->deck_hr);
+            count_card(g, HIST_DECK, HIST_DECK + guesser, (*guesser_hr)->value);
+            log_event(g, EVENT_FISH, guesser, (*guesser_hr)->value, 1);
+        } else {
+            log_event(g, EVENT_FISH, guesser, 0, 0);
+        }
         book_value = check_for_book(*guesser_hl);
         if (book_value != 0) {
-            remove_book(book_value, guesser_hl, guesser_hr);
-            (**player_score)++;
-            printf("\n*************************************************************\n");
-            printf("*\n");
-            printf("* NICE JOB COMPLETING A BOOK! PLAYER %d's NEW SCORE IS: %d  \n", guesser, **player_score);
-            printf("*\n");
-            printf("*************************************************************\n");
+            complete_book(g, guesser, book_value);
+            if (out != NULL) {
+                print_book(out, guesser, g->score[guesser - 1]);
+            }
         }
         return 0;
     }
@@ -1140,8 +2746,7 @@ void transfer_cards(int num_of_cards, int guess_rank, card **guesser_hl, card **
     for (int i = 0; i < num_of_cards; i++) {
         
         // Traverse list, finding the cards, removing it, and adding to guessers hand
-        card *temp = (card*)malloc(sizeof(card));
-        temp = *opp_hl;
+        card *temp = *opp_hl;
         
         while (temp != NULL) {
             if (temp->value == guess_rank) {
@@ -1161,8 +2766,11 @@ void transfer_cards(int num_of_cards, int guess_rank, card **guesser_hl, card **
  *      guessers hand.                                                  *
  ************************************************************************/
 void go_fish(card **guesser_hl, card **guesser_hr, card **deck_hl, card **deck_hr) {
-    card *drawn_card = (card*)malloc(sizeof(card));
-    drawn_card = remove_member(*deck_hl, deck_hl, deck_hr);
+    if (*deck_hl == NULL) {
+        // Pool is empty, nothing to draw
+        return;
+    }
+    card *drawn_card = remove_member(*deck_hl, deck_hl, deck_hr);
     add_to_end(*guesser_hr, guesser_hl, guesser_hr, drawn_card);
 }
 
@@ -1170,21 +2778,22 @@ void go_fish(card **guesser_hl, card **guesser_hr, card **deck_hl, card **deck_h
 /************************************************************************
  * remove_book(): Function that accepts a specific rank to remove from  *
  *      the players hand. The rank is the value of the card that        *
- *      completes the book that will be removed.                        *
+ *      completes the book that will be removed. The cards are moved to *
+ *      the end of the book list rather than freed, so they can be put  *
+ *      back by an undo or gathered up for the next game.               *
  ************************************************************************/
-void remove_book(int rank, card **player_hl, card **player_hr) {
+void remove_book(int rank, card **player_hl, card **player_hr, card **book_hl, card **book_hr) {
     
     // Iterate 4 times (4 is the amount of a completed book)
     for (int i = 0; i < 4; i++) {
         
         // Traverse the hand and remove the card with value of rank
-        card *temp = (card*)malloc(sizeof(card));
-        temp = *player_hl;
+        card *temp = *player_hl;
         
         while (temp != NULL) {
             if (temp->value == rank) {
                 // Remove this card
-                free(remove_member(temp, player_hl, player_hr)); // Free memory taken by the card (no longer needed)
+                add_to_end(*book_hr, book_hl, book_hr, remove_member(temp, player_hl, player_hr));
                 break;
             }
             temp = temp->next;
@@ -1194,30 +2803,5903 @@ void remove_book(int rank, card **player_hl, card **player_hr) {
 
 
 /************************************************************************
- * declare_winner(): Function that will analyze the players scores and  *
- *      declare a winner if one exists or a tie of one occurrs.         *
+ * insert_member(): Function that puts a card back into a LinkedList so *
+ *      that it ends up at position index (0 is head-left). Reverses a  *
+ *      remove_member() call made on the same position.                 *
  ************************************************************************/
-void declare_winner(int p1_score, int p2_score) {
+void insert_member(card *p, int index, card **hl, card **hr) {
     
-    printf("\n\nGAME OVER! LETS TALLY UP THE SCORES\n\n");
-    printf("Player 1: %d\n", p1_score);
-    printf("Player 2: %d\n", p2_score);
+    card *next = *hl;
     
-    if (p1_score > p2_score) {
-        // Player 1 wins
-        printf("><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n");
-        printf("><((('>  CONGRATULATIONS TO PLAYER 1, YOU ARE THE WINNER!!!!      ><((('>\n");
-        printf("><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n\n");
-    } else if (p1_score < p2_score) {
-        // Player 2 wins
-        printf("><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n");
-        printf("><((('>  CONGRATULATIONS TO PLAYER 2, YOU ARE THE WINNER!!!!      ><((('>\n");
-        printf("><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n\n");
+    for (int i = 0; i < index && next != NULL; i++) {
+        next = next->next;
+    }
+    
+    if (next == NULL) {
+        // Position is past the last card, same as adding to the end
+        add_to_end(*hr, hl, hr, p);
+        return;
+    }
+    
+    p->next = next;
+    p->prev = next->prev;
+    if (next->prev == NULL) {
+        *hl = p;
     } else {
-        // Tie Occurred
-        printf("><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n");
-        printf("><((('>  A TIE HAS OCCURRED! BETTER LUCK NEXT TIME!               ><((('>\n");
-        printf("><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n\n");
+        next->prev->next = p;
+    }
+    next->prev = p;
+    
+}
+
+
+/************************************************************************
+ * card_code(): Function that packs a card into a single small integer  *
+ *      (rank * 4 + suit) for compact records.                          *
+ ************************************************************************/
+int card_code(card *p) {
+    
+    int suit = 0; // Hearts
+    
+    if (strcmp(p->suit, "diamonds") == 0) {
+        suit = 1;
+    } else if (strcmp(p->suit, "clubs") == 0) {
+        suit = 2;
+    } else if (strcmp(p->suit, "spades") == 0) {
+        suit = 3;
+    }
+    return p->value * 4 + suit;
+    
+}
+
+
+/************************************************************************
+ * card_from_code(): Function that allocates the Card Struct a code     *
+ *      made by card_code() stands for.                                 *
+ ************************************************************************/
+card* card_from_code(int code) {
+    
+    const char *suits[4] = {"hearts", "diamonds", "clubs", "spades"};
+    card *temp_card = (card*)malloc(sizeof(card));
+    
+    temp_card->value = code / 4;
+    strcpy(temp_card->suit, suits[code % 4]);
+    temp_card->prev = NULL;
+    temp_card->next = NULL;
+    return temp_card;
+    
+}
+
+
+/************************************************************************
+ * save_game(): Function that packs a game into a Game Snapshot. The    *
+ *      game should be suspended (waiting for a guess or over), the     *
+ *      undo history and event log are not saved. Returns -1 if the     *
+ *      game holds more cards than a snapshot has room for.             *
+ ************************************************************************/
+int save_game(const game *g, game_snapshot *snap) {
+    
+    card *lists[3] = {g->deck_hl, g->hand_hl[0], g->hand_hl[1]};
+    int n = 0;
+    
+    memset(snap, 0, sizeof(game_snapshot));
+    snap->seed = g->seed;
+    snap->id = g->id;
+    snap->version = SNAPSHOT_VERSION;
+    snap->turn_count = (uint16_t)g->turn_count;
+    snap->fish_count = (uint16_t)g->fish_count;
+    snap->forced_swaps = (uint16_t)g->forced_swaps;
+    snap->first_book_turn = (int16_t)g->first_book_turn;
+    snap->state = (uint8_t)g->state;
+    snap->players_turn = (uint8_t)g->players_turn;
+    for (int i = 0; i < 2; i++) {
+        snap->bot_block[i] = g->bot_rng[i].counter[0];
+        snap->bot_used[i] = (uint8_t)g->bot_rng[i].used;
+        snap->score[i] = (uint8_t)g->score[i];
+        snap->last_ask[i] = (uint8_t)g->last_ask[i];
+    }
+    for (int rank = 1; rank <= NUM_RANKS; rank++) {
+        snap->ranks[rank - 1] = (uint8_t)(g->known[0][rank] | g->known[1][rank] << 2 | g->booked[rank] << 4);
+    }
+    
+    for (int i = 0; i < 3; i++) {
+        int start = n;
+        for (card *p = lists[i]; p != NULL; p = p->next) {
+            if (n == 52) {
+                return -1;
+            }
+            snap->cards[n++] = (uint8_t)card_code(p);
+        }
+        snap->num_cards[i] = (uint8_t)(n - start);
+    }
+    
+    snap->checksum = crc32_update(0, snap, sizeof(game_snapshot));
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * restore_game(): Function that unpacks a Game Snapshot into a game    *
+ *      set up by game_init(), ready to be resumed where it was saved.  *
+ *      Returns -1 (leaving whatever was unpacked for game_free()) if   *
+ *      the snapshot is damaged or of another version.                  *
+ ************************************************************************/
+int restore_game(game *g, const game_snapshot *snap) {
+    
+    game_snapshot copy = *snap;
+    card **lists[3][2] = {{&g->deck_hl, &g->deck_hr}, {&g->hand_hl[0], &g->hand_hr[0]}, {&g->hand_hl[1], &g->hand_hr[1]}};
+    int n = 0;
+    
+    copy.checksum = 0;
+    if (snap->version != SNAPSHOT_VERSION || snap->rules != 0 || crc32_update(0, &copy, sizeof(game_snapshot)) != snap->checksum
+        || snap->num_cards[0] + snap->num_cards[1] + snap->num_cards[2] > 52) {
+        return -1;
+    }
+    
+    game_seed(g, snap->seed, snap->id);
+    g->turn_count = snap->turn_count;
+    g->fish_count = snap->fish_count;
+    g->forced_swaps = snap->forced_swaps;
+    g->first_book_turn = snap->first_book_turn;
+    g->state = snap->state;
+    g->players_turn = snap->players_turn;
+    for (int i = 0; i < 2; i++) {
+        // Put the computer player back where it was in its stream, regenerating the block in use
+        rng_stream *rng = &g->bot_rng[i];
+        rng->counter[0] = snap->bot_block[i];
+        rng->used = snap->bot_used[i];
+        if (rng->used < 4) {
+            uint32_t counter[4] = {rng->counter[0] - 1, rng->counter[1], rng->counter[2], rng->counter[3]};
+            philox4x32(counter, rng->key, rng->buffer);
+        }
+        g->score[i] = snap->score[i];
+        g->last_ask[i] = snap->last_ask[i];
+    }
+    for (int rank = 1; rank <= NUM_RANKS; rank++) {
+        g->known[0][rank] = snap->ranks[rank - 1] & 3;
+        g->known[1][rank] = (snap->ranks[rank - 1] >> 2) & 3;
+        g->booked[rank] = snap->ranks[rank - 1] >> 4;
+    }
+    
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < snap->num_cards[i]; j++, n++) {
+            int rank = snap->cards[n] / 4;
+            if (rank < 1 || rank > NUM_RANKS) {
+                return -1;
+            }
+            add_to_end(*lists[i][1], lists[i][0], lists[i][1], card_from_code(snap->cards[n]));
+            if (i == 0) {
+                g->deck_count++;
+            } else {
+                g->hand_count[i - 1][rank]++;
+            }
+        }
+    }
+    if (g->counters != NULL) {
+        counter_add(&g->counters->cards_allocated, (uint64_t)n);
+    }
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * new_history(): Function that creates an empty undo/redo tree. Attach *
+ *      it to a game before the first guess is made.                    *
+ ************************************************************************/
+history* new_history(void) {
+    
+    history *h = (history*)calloc(1, sizeof(history));
+    
+    h->current = -1;
+    h->recording = -1;
+    h->first_move = -1;
+    return h;
+    
+}
+
+
+/************************************************************************
+ * free_history(): Function that frees an undo/redo tree.               *
+ ************************************************************************/
+void free_history(history *h) {
+    free(h->nodes);
+    free(h->entries);
+    free(h);
+}
+
+
+/************************************************************************
+ * history_note(): Function that records the old value of something the *
+ *      turn being played is about to change (see enum history_op).     *
+ *      Does nothing when the game keeps no history or during a redo.   *
+ ************************************************************************/
+void history_note(game *g, int op, int a, int b, int c) {
+    
+    history *h = g->history;
+    
+    if (h == NULL || h->recording < 0) {
+        return;
+    }
+    
+    if (h->num_entries == h->cap_entries) {
+        h->cap_entries = (h->cap_entries == 0) ? 256 : h->cap_entries * 2;
+        h->entries = (history_entry*)realloc(h->entries, h->cap_entries * sizeof(history_entry));
+    }
+    h->entries[h->num_entries].op = (uint8_t)op;
+    h->entries[h->num_entries].a = (uint8_t)a;
+    h->entries[h->num_entries].b = (uint8_t)b;
+    h->entries[h->num_entries].c = (uint8_t)c;
+    h->num_entries++;
+    h->nodes[h->recording].num_entries++;
+    
+}
+
+
+/************************************************************************
+ * history_note_moves(): Function that records the cards of rank about  *
+ *      to be taken from the list starting at hl, in the order they     *
+ *      will be removed (first limit matches from head-left), each with *
+ *      the index it leaves from once the ones before it are gone.      *
+ ************************************************************************/
+void history_note_moves(game *g, card *hl, int rank, int limit, int from, int to) {
+    
+    int index = 0;
+    int moved = 0;
+    
+    if (g->history == NULL || g->history->recording < 0) {
+        return;
+    }
+    
+    for (card *temp = hl; temp != NULL && moved < limit; temp = temp->next) {
+        if (temp->value == rank) {
+            history_note(g, HIST_MOVE, card_code(temp), from << 4 | to, index - moved);
+            moved++;
+        }
+        index++;
+    }
+    
+}
+
+
+/************************************************************************
+ * history_begin(): Function that starts recording a new turn, made by  *
+ *      guessing guess_rank from the position currently on the table.   *
+ *      When that same guess was already played from this position the  *
+ *      existing branch is followed instead and nothing is recorded.    *
+ ************************************************************************/
+void history_begin(game *g, int guess_rank) {
+    
+    history *h = g->history;
+    history_node *node;
+    int32_t *first, *link;
+    int child;
+    
+    if (h == NULL) {
+        return;
+    }
+    
+    // Guesses already made from this position
+    first = (h->current < 0) ? &h->first_move : &h->nodes[h->current].first_child;
+    for (link = first; *link >= 0; link = &h->nodes[*link].next_sibling) {
+        if (h->nodes[*link].guess == guess_rank) {
+            // Follow it, and make it the most recent branch again
+            child = *link;
+            *link = h->nodes[child].next_sibling;
+            h->nodes[child].next_sibling = *first;
+            *first = child;
+            h->current = child;
+            return;
+        }
+    }
+    
+    if (h->num_nodes == h->cap_nodes) {
+        h->cap_nodes = (h->cap_nodes == 0) ? 64 : h->cap_nodes * 2;
+        h->nodes = (history_node*)realloc(h->nodes, h->cap_nodes * sizeof(history_node));
+    }
+    node = &h->nodes[h->num_nodes];
+    node->parent = h->current;
+    node->first_child = -1;
+    node->first_entry = h->num_entries;
+    node->num_entries = 0;
+    node->guess = (uint8_t)guess_rank;
+    node->unused = 0;
+    
+    // Newest branch goes first so redo follows the line played most recently
+    if (h->current < 0) {
+        node->next_sibling = h->first_move;
+        h->first_move = h->num_nodes;
+    } else {
+        node->next_sibling = h->nodes[h->current].first_child;
+        h->nodes[h->current].first_child = h->num_nodes;
+    }
+    
+    h->recording = h->num_nodes;
+    h->current = h->num_nodes;
+    h->num_nodes++;
+    
+}
+
+
+/************************************************************************
+ * history_end(): Function that stops recording once the turn is over   *
+ *      (the game is waiting on the next guess or has ended).           *
+ ************************************************************************/
+void history_end(game *g) {
+    if (g->history != NULL) {
+        g->history->recording = -1;
+    }
+}
+
+
+/************************************************************************
+ * history_undo(): Function that takes back the last turn by reversing  *
+ *      its entries newest first. The turn stays in the tree so it can  *
+ *      be redone. Returns 1 if a turn was undone, 0 at the start.      *
+ ************************************************************************/
+int history_undo(game *g) {
+    
+    history *h = g->history;
+    history_node *node;
+    history_entry *e;
+    card **from_hl, **from_hr, **to_hl, **to_hr;
+    card *p;
+    
+    if (h == NULL || h->current < 0) {
+        return 0;
+    }
+    
+    node = &h->nodes[h->current];
+    for (int i = node->num_entries - 1; i >= 0; i--) {
+        e = &h->entries[node->first_entry + i];
+        switch (e->op) {
+            case HIST_MOVE:
+                // Card went to the end of its new list
+                to_hl = history_list(g, e->b & 15, &to_hr);
+                p = remove_member(*to_hr, to_hl, to_hr);
+                from_hl = history_list(g, e->b >> 4, &from_hr);
+                insert_member(p, e->c, from_hl, from_hr);
+                count_card(g, e->b & 15, e->b >> 4, p->value);
+                break;
+            case HIST_KNOWN:
+                g->known[e->a][e->b] = e->c;
+                break;
+            case HIST_LAST_ASK:
+                g->last_ask[e->a] = e->b;
+                break;
+            case HIST_SCORE:
+                g->score[e->a] = e->b;
+                break;
+            case HIST_BOOKED:
+                g->booked[e->a] = e->b;
+                break;
+            case HIST_TURN:
+                g->players_turn = e->a;
+                break;
+            case HIST_COUNTER:
+                if (e->a == 0) {
+                    g->fish_count = e->b | e->c << 8;
+                } else if (e->a == 1) {
+                    g->forced_swaps = e->b | e->c << 8;
+                } else {
+                    g->first_book_turn = -1; // Only noted when the first book of the game was completed
+                }
+                break;
+        }
+    }
+    
+    g->turn_count--;
+    g->state = GAME_AWAIT_GUESS;
+    h->current = node->parent;
+    return 1;
+    
+}
+
+
+/************************************************************************
+ * history_redo(): Function that plays a turn that was undone again.    *
+ *      branch picks which of the guesses made from this position to    *
+ *      follow, 0 being the most recent. Returns 1 if a turn was redone.*
+ ************************************************************************/
+int history_redo(game *g, int branch) {
+    
+    history *h = g->history;
+    int child;
+    
+    if (h == NULL || g->state != GAME_AWAIT_GUESS) {
+        return 0;
+    }
+    
+    child = (h->current < 0) ? h->first_move : h->nodes[h->current].first_child;
+    for (int i = 0; i < branch && child >= 0; i++) {
+        child = h->nodes[child].next_sibling;
+    }
+    if (child < 0) {
+        return 0;
+    }
+    
+    // The game is deterministic, so replaying the guess walks straight down the branch
+    game_resume(g, h->nodes[child].guess);
+    return 1;
+    
+}
+
+
+/************************************************************************
+ * history_list(): Function that returns the head-left of the list a    *
+ *      history entry refers to (HIST_DECK or HIST_DECK + player) and   *
+ *      sets hr to the address of its head-right.                       *
+ ************************************************************************/
+card** history_list(game *g, int list, card ***hr) {
+    if (list == HIST_DECK) {
+        *hr = &g->deck_hr;
+        return &g->deck_hl;
+    } else if (list == HIST_BOOK) {
+        *hr = &g->book_hr;
+        return &g->book_hl;
+    }
+    *hr = &g->hand_hr[list - HIST_DECK - 1];
+    return &g->hand_hl[list - HIST_DECK - 1];
+}
+
+
+/************************************************************************
+ * count_card(): Function that updates the per-rank hand counts and the *
+ *      deck count for a card of rank that moved between two lists      *
+ *      (HIST_DECK, HIST_DECK + player or HIST_BOOK).                   *
+ ************************************************************************/
+void count_card(game *g, int from, int to, int rank) {
+    if (from == HIST_DECK) {
+        g->deck_count--;
+    } else if (from != HIST_BOOK) {
+        g->hand_count[from - HIST_DECK - 1][rank]--;
+    }
+    if (to == HIST_DECK) {
+        g->deck_count++;
+    } else if (to != HIST_BOOK) {
+        g->hand_count[to - HIST_DECK - 1][rank]++;
+    }
+}
+
+
+/************************************************************************
+ * declare_winner(): Function that will analyze the players scores and  *
+ *      declare a winner if one exists or a tie of one occurrs.         *
+ ************************************************************************/
+void declare_winner(FILE *out, int p1_score, int p2_score) {
+    
+    fprintf(out, "\n\nGAME OVER! LETS TALLY UP THE SCORES\n\n");
+    fprintf(out, "Player 1: %d\n", p1_score);
+    fprintf(out, "Player 2: %d\n", p2_score);
+    
+    if (p1_score > p2_score) {
+        // Player 1 wins
+        fprintf(out, "><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n");
+        fprintf(out, "><((('>  CONGRATULATIONS TO PLAYER 1, YOU ARE THE WINNER!!!!      ><((('>\n");
+        fprintf(out, "><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n\n");
+    } else if (p1_score < p2_score) {
+        // Player 2 wins
+        fprintf(out, "><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n");
+        fprintf(out, "><((('>  CONGRATULATIONS TO PLAYER 2, YOU ARE THE WINNER!!!!      ><((('>\n");
+        fprintf(out, "><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n\n");
+    } else {
+        // Tie Occurred
+        fprintf(out, "><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n");
+        fprintf(out, "><((('>  A TIE HAS OCCURRED! BETTER LUCK NEXT TIME!               ><((('>\n");
+        fprintf(out, "><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('> ~~~ ><(((('>\n\n");
+    }
+    
+}
+
+
+/************************************************************************
+ * log_event(): Function that records one game event for the event log  *
+ *      by queueing it on the ring of the thread running the game. The  *
+ *      game thread never touches the file, it only does this push.     *
+ *      Does nothing for games that are not being logged. Games with    *
+ *      counters also count the asks, draws, books and winners here,    *
+ *      and strategy plugins playing the game are told of the event.    *
+ ************************************************************************/
+void log_event(game *g, int type, int player, int rank, int count) {
+    
+    game_event event;
+    
+    if (g->plugins[0] != NULL || g->plugins[1] != NULL) {
+        notify_plugins(g, type, player, rank, count);
+    }
+    if (g->counters != NULL) {
+        if (type == EVENT_ASK) {
+            counter_add(&g->counters->turns, 1);
+        } else if (type == EVENT_FISH) {
+            counter_add(&g->counters->fish, (uint64_t)count);
+        } else if (type == EVENT_BOOK) {
+            counter_add(&g->counters->books, 1);
+        } else if (type == EVENT_WINNER) {
+            counter_add(&g->counters->games, 1);
+        }
+    }
+    if (g->log == NULL) {
+        return;
+    }
+    
+    event.game_id = g->id;
+    event.turn = (uint16_t)g->turn_count;
+    event.type = (uint8_t)type;
+    event.player = (uint8_t)player;
+    event.rank = (uint8_t)rank;
+    event.count = (uint8_t)count;
+    event.deck = (uint8_t)g->deck_count;
+    event.unused = 0;
+    push_event(g->log, &event);
+    
+}
+
+
+/************************************************************************
+ * push_event(): Function that adds an event to a ring without taking a *
+ *      lock. Only the owning game thread may push to a ring. When the  *
+ *      ring is full the event is dropped and counted, or under         *
+ *      LOG_BLOCK the thread waits for the log writer to catch up.      *
+ *      Returns 1 if the event was queued, 0 if it was dropped.         *
+ ************************************************************************/
+int push_event(event_ring *ring, const game_event *event) {
+    
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    
+    while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == EVENT_RING_SIZE) {
+        // Ring is full
+        if (ring->policy == LOG_DROP) {
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            return 0;
+        }
+        sched_yield();
+    }
+    
+    ring->slots[head & (EVENT_RING_SIZE - 1)] = *event;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release); // Publish the slot to the writer
+    return 1;
+    
+}
+
+
+/************************************************************************
+ * open_event_log(): Function that creates the event log file, one ring *
+ *      per game thread, and starts the writer thread draining them.    *
+ *      Returns NULL if the file could not be opened.                   *
+ ************************************************************************/
+event_log* open_event_log(const char *path, int num_rings, int policy) {
+    
+    event_log *log = (event_log*)malloc(sizeof(event_log));
+    
+    log->file = fopen(path, "wb");
+    if (log->file == NULL) {
+        free(log);
+        return NULL;
+    }
+    
+    log->rings = (event_ring*)calloc(num_rings, sizeof(event_ring));
+    log->num_rings = num_rings;
+    log->written = 0;
+    for (int i = 0; i < num_rings; i++) {
+        atomic_init(&log->rings[i].head, 0);
+        atomic_init(&log->rings[i].tail, 0);
+        atomic_init(&log->rings[i].dropped, 0);
+        log->rings[i].policy = policy;
+    }
+    
+    atomic_init(&log->running, 1);
+    pthread_create(&log->writer, NULL, event_writer, log);
+    return log;
+    
+}
+
+
+/************************************************************************
+ * close_event_log(): Function that stops the writer once every ring    *
+ *      has been drained, closes the file and frees the rings. Returns  *
+ *      the number of events written to the file.                       *
+ ************************************************************************/
+uint64_t close_event_log(event_log *log) {
+    uint64_t written;
+    atomic_store(&log->running, 0);
+    pthread_join(log->writer, NULL);
+    written = log->written;
+    fclose(log->file);
+    free(log->rings);
+    free(log);
+    return written;
+}
+
+
+/************************************************************************
+ * event_writer(): Log writer thread. Sweeps the rings of every game    *
+ *      thread, gathering their events into one large batch that is     *
+ *      written out with a single sequential fwrite(). Sleeps briefly   *
+ *      when every ring is empty and exits once told to stop and the    *
+ *      rings have been drained.                                        *
+ ************************************************************************/
+void* event_writer(void *arg) {
+    
+    event_log *log = (event_log*)arg;
+    game_event *batch = (game_event*)malloc(EVENT_BATCH_SIZE * sizeof(game_event));
+    size_t batch_len = 0;
+    struct timespec idle = {0, 1000000}; // 1ms
+    
+    while (1) {
+        // Read the flag before draining so nothing pushed before shutdown is missed
+        int running = atomic_load(&log->running);
+        size_t drained = 0;
+        
+        for (int i = 0; i < log->num_rings; i++) {
+            event_ring *ring = &log->rings[i];
+            size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+            
+            while (tail != head) {
+                if (batch_len == EVENT_BATCH_SIZE) {
+                    fwrite(batch, sizeof(game_event), batch_len, log->file);
+                    log->written += batch_len;
+                    batch_len = 0;
+                }
+                batch[batch_len++] = ring->slots[tail & (EVENT_RING_SIZE - 1)];
+                tail++;
+                drained++;
+            }
+            atomic_store_explicit(&ring->tail, tail, memory_order_release); // Hand the slots back
+        }
+        
+        if (drained == 0) {
+            if (!running) {
+                break;
+            }
+            nanosleep(&idle, NULL);
+        }
+    }
+    
+    fwrite(batch, sizeof(game_event), batch_len, log->file);
+    log->written += batch_len;
+    free(batch);
+    return NULL;
+    
+}
+
+
+/************************************************************************
+ * run_batch(): Function that plays GAMES computer-vs-computer games on *
+ *      --threads worker threads without printing them, optionally      *
+ *      recording every game event to the binary file given by --log    *
+ *      (records are game_event structs) and appending the outcome of   *
+ *      every game to the results file given by --results. Game i is    *
+ *      dealt from the streams of (--seed, i). With --shard i/n only    *
+ *      the games whose index is i modulo n are played, so n processes  *
+ *      given the same GAMES and --seed split the run between them.     *
+ *      --deadline gives every decision a time budget, and the summary  *
+ *      then ends with the decision times of each bot.                  *
+ *      Prints a summary at the end.                                    *
+ ************************************************************************/
+int run_batch(int argc, char *argv[]) {
+    
+    int num_games = atoi(argv[2]);
+    int num_threads = 1;
+    int policy = LOG_DROP;
+    const char *log_path = NULL;
+    const char *results_path = NULL;
+    uint64_t seed = (uint64_t)time(NULL);
+    int shard_index = 0, num_shards = 1;
+    bot bots[2];
+    event_log *log = NULL;
+    result_file results;
+    batch_worker *workers;
+    int wins[3] = {0, 0, 0};
+    uint64_t dropped = 0;
+    struct timespec start, end;
+    long deadline_us = -1;
+    move_clock *clocks = NULL;
+    metrics m;
+    int usage = 0;
+    
+    memset(&m, 0, sizeof(metrics));
+    
+    load_bot(&bots[0], "random");
+    load_bot(&bots[1], "random");
+    for (int i = 3; i < argc && !usage; i += 2) {
+        if (i + 1 >= argc) {
+            usage = 1;
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            num_threads = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--log") == 0) {
+            log_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--log-policy") == 0) {
+            policy = (strcmp(argv[i + 1], "block") == 0) ? LOG_BLOCK : LOG_DROP;
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "--results") == 0) {
+            results_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--shard") == 0) {
+            if (sscanf(argv[i + 1], "%d/%d", &shard_index, &num_shards) != 2) {
+                num_shards = 0;
+            }
+        } else if (strcmp(argv[i], "--bot1") == 0 || strcmp(argv[i], "--bot2") == 0) {
+            if (load_bot(&bots[argv[i][5] - '1'], argv[i + 1]) != 0) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--deadline") == 0) {
+            deadline_us = atol(argv[i + 1]);
+            if (deadline_us <= 0) {
+                printf("ERROR: --deadline must be a positive number of microseconds\n");
+                return 1;
+            }
+        } else if (!metrics_option(&m, argv[i], argv[i + 1])) {
+            usage = 1;
+        }
+    }
+    if (usage) {
+        printf("Usage: %s --simulate GAMES [--threads N] [--seed S] [--bot1 BOT] [--bot2 BOT] [--deadline US] [--log FILE [--log-policy drop|block]] [--results FILE] [--shard I/N] [--metrics ADDRESS] [--metrics-dump FILE] [--metrics-interval SECONDS]\n", argv[0]);
+        return 1;
+    }
+    if (num_games <= 0 || num_threads <= 0) {
+        printf("ERROR: GAMES and --threads must be positive\n");
+        return 1;
+    }
+    if (num_shards <= 0 || num_shards > 0xFFFF || shard_index < 0 || shard_index >= num_shards) {
+        printf("ERROR: --shard must be i/n with 0 <= i < n\n");
+        return 1;
+    }
+    
+    if (log_path != NULL) {
+        log = open_event_log(log_path, num_threads, policy);
+        if (log == NULL) {
+            printf("ERROR: Could not open %s for the event log\n", log_path);
+            return 1;
+        }
+    }
+    
+    if (results_path != NULL) {
+        // Appending keeps the file a valid stream of blocks across runs
+        results.file = fopen(results_path, "ab");
+        if (results.file == NULL) {
+            printf("ERROR: Could not open %s for the results\n", results_path);
+            return 1;
+        }
+        pthread_mutex_init(&results.lock, NULL);
+        results.run_seed = seed;
+        results.num_games = (uint32_t)num_games;
+        results.shard_index = (uint16_t)shard_index;
+        results.num_shards = (uint16_t)num_shards;
+    }
+    
+    m.log = log;
+    if (start_metrics(&m, "batch") != 0) {
+        return 1;
+    }
+    
+    // Decisions are timed when they have a deadline, a bot searches or metrics are kept, each thread on its own clock
+    if (deadline_us > 0 || bots[0].search || bots[1].search || m.address != NULL || m.dump_path != NULL) {
+        clocks = (move_clock*)calloc(num_threads, sizeof(move_clock));
+        for (int i = 0; i < num_threads; i++) {
+            clocks[i].budget_ns = (deadline_us > 0) ? deadline_us * 1000 : 0;
+        }
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    workers = (batch_worker*)calloc(num_threads, sizeof(batch_worker));
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].index = i;
+        workers[i].num_threads = num_threads;
+        workers[i].num_games = num_games;
+        workers[i].shard_index = shard_index;
+        workers[i].num_shards = num_shards;
+        workers[i].log = (log != NULL) ? &log->rings[i] : NULL;
+        workers[i].seed = seed;
+        workers[i].results = (results_path != NULL) ? &results : NULL;
+        workers[i].bots = bots;
+        workers[i].clock = (clocks != NULL) ? &clocks[i] : NULL;
+        workers[i].counters = metrics_counters(&m);
+        pthread_create(&workers[i].thread, NULL, batch_worker_main, &workers[i]);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        for (int j = 0; j < 3; j++) {
+            wins[j] += workers[i].wins[j];
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stop_metrics(&m); // Last dump has the final totals
+    
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    int played = wins[0] + wins[PLAYER_ONE] + wins[PLAYER_TWO];
+    printf("Games played:   %d in %.3fs (%.0f games/sec)\n", played, seconds, played / seconds);
+    printf("Player 1 wins:  %d\n", wins[PLAYER_ONE]);
+    printf("Player 2 wins:  %d\n", wins[PLAYER_TWO]);
+    printf("Ties:           %d\n", wins[0]);
+    printf("Seed:           %llu\n", (unsigned long long)seed);
+    printf("Bots:           %s vs %s\n", bots[0].name, bots[1].name);
+    if (num_shards > 1) {
+        printf("Shard:          %d/%d of %d games\n", shard_index, num_shards, num_games);
+    }
+    if (clocks != NULL && (deadline_us > 0 || bots[0].search || bots[1].search)) {
+        for (int i = 1; i < num_threads; i++) {
+            merge_latency(&clocks[0].seat[0], &clocks[i].seat[0]);
+            merge_latency(&clocks[0].seat[1], &clocks[i].seat[1]);
+        }
+        print_latency("Bot 1 moves:", &clocks[0].seat[0], clocks[0].budget_ns);
+        print_latency("Bot 2 moves:", &clocks[0].seat[1], clocks[0].budget_ns);
+    }
+    free(clocks);
+    
+    if (results_path != NULL) {
+        fclose(results.file);
+        pthread_mutex_destroy(&results.lock);
+    }
+    
+    if (log != NULL) {
+        for (int i = 0; i < num_threads; i++) {
+            dropped += atomic_load(&log->rings[i].dropped);
+        }
+        uint64_t written = close_event_log(log);
+        printf("Events logged:  %llu (%llu dropped)\n", (unsigned long long)written, (unsigned long long)dropped);
+    }
+    
+    free(workers);
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * batch_worker_main(): Simulation thread. Plays every num_threads-th   *
+ *      game of its shard starting at its own index and tallies the     *
+ *      winners.                                                        *
+ ************************************************************************/
+void* batch_worker_main(void *arg) {
+    
+    batch_worker *worker = (batch_worker*)arg;
+    game g;
+    int winner;
+    
+    if (worker->results != NULL) {
+        worker->block = (result_block*)malloc(sizeof(result_block));
+        worker->block->num_rows = 0;
+    }
+    
+    // One game is dealt again and again, its cards never go back to the allocator
+    game_init(&g, NULL);
+    g.log = worker->log;
+    g.counters = worker->counters;
+    int stride = worker->num_shards * worker->num_threads;
+    for (int i = worker->shard_index + worker->num_shards * worker->index; i < worker->num_games; i += stride) {
+        game_seed(&g, worker->seed, (uint32_t)i);
+        winner = play_silent_game(&g, worker->bots, worker->clock);
+        worker->wins[winner]++;
+        
+        if (worker->block != NULL) {
+            add_result(worker->block, &g, winner);
+            if (worker->block->num_rows == RESULT_BLOCK_ROWS) {
+                write_result_block(worker->results, worker->block);
+            }
+        }
+    }
+    game_free(&g);
+    
+    if (worker->block != NULL) {
+        write_result_block(worker->results, worker->block);
+        free(worker->block);
+    }
+    return NULL;
+    
+}
+
+
+/************************************************************************
+ * replay_game(): Function that plays a single game of a batch run out  *
+ *      loud, given the seed of the run and the index of the game, as   *
+ *      in ./main --replay SEED GAME_INDEX. The same --bot1 and --bot2  *
+ *      as the batch have to be given for the game to play out the same.*
+ ************************************************************************/
+int replay_game(int argc, char *argv[]) {
+    
+    game g;
+    bot bots[2];
+    char *end_seed, *end_index;
+    uint64_t seed = strtoull(argv[2], &end_seed, 10);
+    unsigned long index = strtoul(argv[3], &end_index, 10);
+    int usage = (*end_seed != '\0' || *end_index != '\0');
+    
+    load_bot(&bots[0], "random");
+    load_bot(&bots[1], "random");
+    for (int i = 4; i < argc && !usage; i += 2) {
+        if (i + 1 < argc && strcmp(argv[i], "--bot1") == 0) {
+            usage = load_bot(&bots[0], argv[i + 1]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--bot2") == 0) {
+            usage = load_bot(&bots[1], argv[i + 1]);
+        } else {
+            usage = 1;
+        }
+    }
+    if (usage) {
+        printf("Usage: %s --replay SEED GAME_INDEX [--bot1 BOT] [--bot2 BOT]\n", argv[0]);
+        return 1;
+    }
+    
+    game_init(&g, stdout);
+    game_seed(&g, seed, (uint32_t)index);
+    generate_random_deck(&g.deck_hl, &g.deck_hr);
+    shuffle_deck(g.deck_hl, &g.rng);
+    attach_bots(&g, bots);
+    
+    int state = game_resume(&g, 0);
+    while (state == GAME_AWAIT_GUESS) {
+        state = game_resume(&g, choose_bot_ask(&g, &bots[g.players_turn - 1], 0));
+    }
+    
+    game_free(&g);
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * run_script(): Function that plays a game from a move script instead  *
+ *      of the keyboard, as in ./main --script FILE --seed S, so games  *
+ *      can be replayed and checked without anyone at the prompt. Each  *
+ *      line of the script is one ask, a rank optionally tagged with    *
+ *      the player making it (P1 7, P2: K), or undo / redo. Anything    *
+ *      after a # is a comment. The first line that cannot be played    *
+ *      ends the run with its line number and EXIT_BAD_INPUT, a script  *
+ *      that ends before the game does exits with EXIT_EARLY_EOF.       *
+ ************************************************************************/
+int run_script(int argc, char *argv[]) {
+    
+    game g;
+    char line[SCRIPT_LINE_SIZE];
+    const char *path = argv[2];
+    const char *deck_path = NULL;
+    char *end = "";
+    uint64_t seed = 0;
+    unsigned long index = 0;
+    int have_seed = 0;
+    int quiet = 0;
+    int usage = 0;
+    
+    for (int i = 3; i < argc && !usage; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], &end, 10);
+            have_seed = 1;
+        } else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc) {
+            index = strtoul(argv[++i], &end, 10);
+        } else if (strcmp(argv[i], "--deck") == 0 && i + 1 < argc) {
+            deck_path = argv[++i];
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            quiet = 1;
+        } else {
+            usage = 1;
+        }
+        usage |= (*end != '\0');
+    }
+    if (usage || have_seed == (deck_path != NULL)) {
+        printf("Usage: %s --script FILE (--seed S [--index GAME_INDEX] | --deck FILE) [--quiet]\n", argv[0]);
+        printf("FILE is - to read the script from standard input\n");
+        return 1;
+    }
+    
+    FILE *in = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "ERROR: Could not open script %s\n", path);
+        return 1;
+    }
+    
+    // Same deal as ./main --seed S or ./main --replay S GAME_INDEX, or the deck file
+    game_init(&g, quiet ? NULL : stdout);
+    game_seed(&g, seed, (uint32_t)index);
+    g.history = new_history();
+    if (deck_path == NULL) {
+        generate_random_deck(&g.deck_hl, &g.deck_hr);
+        shuffle_deck(g.deck_hl, &g.rng);
+    } else {
+        const char *problem = NULL;
+        int bad_line = load_deck(deck_path, &g.deck_hl, &g.deck_hr, &problem);
+        if (bad_line != 0) {
+            if (bad_line < 0) {
+                fprintf(stderr, "ERROR: Could not open deck %s\n", deck_path);
+            } else {
+                fprintf(stderr, "%s:%d: %s\n", deck_path, bad_line, problem);
+            }
+            if (in != stdin) {
+                fclose(in);
+            }
+            free_history(g.history);
+            game_free(&g);
+            return (bad_line < 0) ? 1 : EXIT_BAD_INPUT;
+        }
+    }
+    
+    int state = game_resume(&g, 0);
+    int line_number = 0;
+    int asks = 0;
+    int exit_code = 0;
+    int length;
+    
+    while (exit_code == 0 && (length = read_line(in, line, SCRIPT_LINE_SIZE)) != -1) {
+        line_number++;
+        
+        // Drop the comment, then any space left in front of it
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            while (comment > line && isspace((unsigned char)comment[-1])) {
+                comment--;
+            }
+            *comment = '\0';
+        } else if (length < -1) {
+            fprintf(stderr, "%s:%d: line is too long\n", path, line_number);
+            exit_code = EXIT_BAD_INPUT;
+            break;
+        }
+        if (line[0] == '\0') {
+            continue;
+        }
+        
+        // Optional player tag, P1 or P2 with or without a colon
+        char *move = line;
+        int player = 0;
+        if ((line[0] == 'P' || line[0] == 'p') && (line[1] == '1' || line[1] == '2') && (line[2] == ':' || isspace((unsigned char)line[2]))) {
+            player = line[1] - '0';
+            move = line + 3;
+            while (isspace((unsigned char)*move)) {
+                move++;
+            }
+        }
+        
+        if (strcmp(move, "undo") == 0 || strcmp(move, "redo") == 0) {
+            int done = (move[0] == 'u') ? history_undo(&g) : history_redo(&g, 0);
+            if (!done) {
+                fprintf(stderr, "%s:%d: nothing to %s\n", path, line_number, move);
+                exit_code = EXIT_BAD_INPUT;
+            } else if (move[0] == 'u') {
+                if (g.out != NULL) {
+                    fprintf(g.out, "\nLAST GUESS TAKEN BACK!\n");
+                    print_turn(&g);
+                }
+            }
+            state = g.state;
+            continue;
+        }
+        
+        int rank = parse_rank(move);
+        if (state != GAME_AWAIT_GUESS) {
+            fprintf(stderr, "%s:%d: the game is already over\n", path, line_number);
+            exit_code = EXIT_BAD_INPUT;
+        } else if (rank == 0) {
+            fprintf(stderr, "%s:%d: \"%s\" is not a rank\n", path, line_number, move);
+            exit_code = EXIT_BAD_INPUT;
+        } else if (player != 0 && player != g.players_turn) {
+            fprintf(stderr, "%s:%d: it is Player %d's turn, not Player %d's\n", path, line_number, g.players_turn, player);
+            exit_code = EXIT_BAD_INPUT;
+        } else if (g.hand_count[g.players_turn - 1][rank] == 0) {
+            fprintf(stderr, "%s:%d: Player %d does not possess a %s\n", path, line_number, g.players_turn, move);
+            exit_code = EXIT_BAD_INPUT;
+        } else {
+            if (g.out != NULL) {
+                fprintf(g.out, "%s\n", move); // Echo the ask after the prompt like a terminal would
+            }
+            state = game_resume(&g, rank);
+            asks++;
+        }
+    }
+    
+    if (exit_code == 0 && ferror(in)) {
+        fprintf(stderr, "ERROR: Could not read script %s\n", path);
+        exit_code = 1;
+    } else if (exit_code == 0 && state != GAME_OVER) {
+        fprintf(stderr, "%s: script ended before the game was over, Player %d to ask\n", path, g.players_turn);
+        exit_code = EXIT_EARLY_EOF;
+    }
+    if (exit_code == 0) {
+        printf("SCRIPT COMPLETE: %d asks, PLAYER 1 SCORE: %d, PLAYER 2 SCORE: %d\n", asks, g.score[0], g.score[1]);
+    }
+    
+    if (in != stdin) {
+        fclose(in);
+    }
+    free_history(g.history);
+    game_free(&g);
+    return exit_code;
+    
+}
+
+
+/************************************************************************
+ * play_silent_game(): Function that deals a shuffled deck and lets the *
+ *      bot in each seat make every guess until the game is over, each  *
+ *      within the budget of clock and timed when clock is not NULL.    *
+ *      Returns the winning player, or 0 for a tie.                     *
+ ************************************************************************/
+int play_silent_game(game *g, const bot *bots, move_clock *clock) {
+    
+    game_reset(g, NULL, 0); // Reuses the cards of the game played before, if any
+    shuffle_deck(g->deck_hl, &g->rng);
+    attach_bots(g, bots);
+    
+    int state = game_resume(g, 0);
+    while (state == GAME_AWAIT_GUESS) {
+        const bot *b = &bots[g->players_turn - 1];
+        state = game_resume(g, (clock != NULL) ? bot_decide(g, b, clock) : choose_bot_ask(g, b, 0));
+    }
+    
+    if (g->score[0] > g->score[1]) {
+        return PLAYER_ONE;
+    } else if (g->score[0] < g->score[1]) {
+        return PLAYER_TWO;
+    }
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * choose_random_ask(): Computer player that asks for the rank of a     *
+ *      randomly picked card from its own hand, so the guess is always  *
+ *      one the player possesses.                                       *
+ ************************************************************************/
+int choose_random_ask(game *g) {
+    
+    card *temp = g->hand_hl[g->players_turn - 1];
+    int idx = rand_gen(find_length(temp), &g->bot_rng[g->players_turn - 1]);
+    
+    for (int i = 0; i < idx; i++) {
+        temp = temp->next;
+    }
+    return temp->value;
+    
+}
+
+
+/************************************************************************
+ * choose_bot_ask(): Computer player that asks for the rank it holds    *
+ *      with the highest score in its strategy table, picking one of    *
+ *      the best at random on a tie. Only reads the hand counts, one    *
+ *      table lookup per rank held. Every strategy is reached through   *
+ *      here and handed deadline_ns (on the monotonic_ns() clock, 0 for *
+ *      none): search and plugin bots work to it, a table lookup or a   *
+ *      random ask is always quick enough to ignore it.                 *
+ ************************************************************************/
+int choose_bot_ask(game *g, const bot *b, uint64_t deadline_ns) {
+    
+    int player = g->players_turn;
+    const int *count = g->hand_count[player - 1];
+    int best_rank = 0, best_score = -1, ties = 0;
+    
+    if (b->search) {
+        return choose_search_ask(g, b, deadline_ns);
+    } else if (b->plugin != NULL) {
+        return choose_plugin_ask(g, b, deadline_ns);
+    }
+    if (b->table == NULL) {
+        return choose_random_ask(g);
+    }
+    
+    const uint16_t *context = b->table + strategy_context(g, player);
+    for (int rank = 1; rank <= NUM_RANKS; rank++) {
+        if (count[rank] > 0) {
+            int score = context[strategy_row(g, player, rank)];
+            if (score > best_score) {
+                best_score = score;
+                best_rank = rank;
+                ties = 1;
+            } else if (score == best_score && rand_gen(++ties, &g->bot_rng[player - 1]) == 0) {
+                best_rank = rank;
+            }
+        }
+    }
+    return best_rank;
+    
+}
+
+
+/************************************************************************
+ * strategy_context(): Function that buckets the public state of a game *
+ *      for player into the first of the 24 strategy table rows of that *
+ *      context, see strategy_row() for the row of each rank.           *
+ *                                                                      *
+ * Contexts: cards left in the deck (0, 1-9, 10-19, 20+) times cards in *
+ *      the opponents hand (1-3, 4-6, 7+)                               *
+ ************************************************************************/
+int strategy_context(const game *g, int player) {
+    
+    int opponent = (player == PLAYER_ONE) ? PLAYER_TWO : PLAYER_ONE;
+    int opp_cards = 0;
+    int deck_bucket, opp_bucket;
+    
+    for (int rank = 1; rank <= NUM_RANKS; rank++) {
+        opp_cards += g->hand_count[opponent - 1][rank];
+    }
+    
+    if (g->deck_count == 0) {
+        deck_bucket = 0;
+    } else if (g->deck_count < 10) {
+        deck_bucket = 1;
+    } else if (g->deck_count < 20) {
+        deck_bucket = 2;
+    } else {
+        deck_bucket = 3;
+    }
+    if (opp_cards <= 3) {
+        opp_bucket = 0;
+    } else if (opp_cards <= 6) {
+        opp_bucket = 1;
+    } else {
+        opp_bucket = 2;
+    }
+    return (deck_bucket * 3 + opp_bucket) * 24;
+    
+}
+
+
+/************************************************************************
+ * strategy_row(): Function that returns which of the rows of a context *
+ *      describes player asking for rank: (copies held - 1) << 3 |      *
+ *      opponent known to hold it << 2 | opponent asked for it last     *
+ *      << 1 | player asked for it last.                                *
+ ************************************************************************/
+int strategy_row(const game *g, int player, int rank) {
+    int opponent = (player == PLAYER_ONE) ? PLAYER_TWO : PLAYER_ONE;
+    return (g->hand_count[player - 1][rank] - 1) << 3 | (g->known[opponent - 1][rank] > 0) << 2
+        | (g->last_ask[opponent - 1] == rank) << 1 | (g->last_ask[player - 1] == rank);
+}
+
+
+/************************************************************************
+ * choose_search_ask(): Computer player that plays every rank it holds  *
+ *      out on up to SEARCH_DEALS hidden deals, with its table playing  *
+ *      both sides after the ask, and asks for the rank that won most.  *
+ *      Anytime: until the first deal is played out with every ask it   *
+ *      answers what its table would, and once deadline_ns (on the      *
+ *      monotonic_ns() clock, 0 for none) is too close for another      *
+ *      playout it stops and answers the best ask over the deals it     *
+ *      finished. Without a deadline the answer only depends on the     *
+ *      game and the bot's stream.                                      *
+ ************************************************************************/
+int choose_search_ask(game *g, const bot *b, uint64_t deadline_ns) {
+    
+    int player = g->players_turn;
+    uint64_t start_ns = (deadline_ns != 0) ? monotonic_ns() : 0;
+    hidden_deal deal;
+    int wins[NUM_RANKS] = {0};
+    bot playout[2];
+    analysis a;
+    uint64_t step_start_ns = start_ns, longest_step_ns = 0; // Slowest step so far, a deal sampled or played out
+    
+    playout[0] = *b;
+    playout[0].search = 0;
+    playout[1] = playout[0];
+    int best_rank = choose_bot_ask(g, &playout[0], deadline_ns);
+    
+    memset(&a, 0, sizeof(a));
+    a.position = g;
+    a.bots = playout;
+    uint64_t seed_hi = rng_next(&g->bot_rng[player - 1]); // Two statements, so the order of the draws is defined
+    uint64_t seed_lo = rng_next(&g->bot_rng[player - 1]);
+    a.seed = seed_hi << 32 | seed_lo;
+    for (int rank = 1; rank <= NUM_RANKS; rank++) {
+        if (g->hand_count[player - 1][rank] > 0) {
+            a.asks[a.num_asks++] = rank;
+        }
+    }
+    if (a.num_asks < 2) {
+        return best_rank;
+    }
+    
+    for (int d = 0; d < SEARCH_DEALS; d++) {
+        // Step -1 samples the deal, which can take a while when the opponent is known to hold a lot
+        for (int i = -1; i < a.num_asks; i++) {
+            if (deadline_ns != 0) {
+                // Stop if one more step as slow as the slowest so far would run past the deadline
+                uint64_t now_ns = monotonic_ns();
+                if (now_ns - step_start_ns > longest_step_ns) {
+                    longest_step_ns = now_ns - step_start_ns;
+                }
+                if (now_ns + longest_step_ns >= deadline_ns) {
+                    return best_rank;
+                }
+                step_start_ns = now_ns;
+            }
+            if (i < 0 && sample_hidden_deals(g, player, a.seed + (uint64_t)d, &deal, 1) == 0) {
+                return best_rank;
+            } else if (i >= 0) {
+                wins[i] += play_out_deal(&a, &deal, d, a.asks[i]);
+            }
+        }
+        
+        // Only whole deals are compared, so every ask has been played out on the same cards
+        int best_wins = -1;
+        for (int i = 0; i < a.num_asks; i++) {
+            if (a.asks[i] == best_rank) {
+                best_wins = wins[i];
+            }
+        }
+        for (int i = 0; i < a.num_asks; i++) {
+            if (wins[i] > best_wins) {
+                best_wins = wins[i];
+                best_rank = a.asks[i];
+            }
+        }
+    }
+    return best_rank;
+    
+}
+
+
+/************************************************************************
+ * bot_decide(): Function that has bot b choose the ask of the player   *
+ *      to move within the budget of clock, and records how long it     *
+ *      took against that player's seat. An ask the player does not     *
+ *      possess is never passed on: it is replaced by the rank of the   *
+ *      first card in hand, which validate_possession() always accepts, *
+ *      and counted as a fallback. With metrics kept the decision is    *
+ *      counted for the seat as well, see count_decision().             *
+ ************************************************************************/
+int bot_decide(game *g, const bot *b, move_clock *clock) {
+    
+    int player = g->players_turn;
+    latency_histogram *h = &clock->seat[player - 1];
+    uint64_t start_ns = monotonic_ns();
+    int rank;
+    
+    int chosen = choose_bot_ask(g, b, (clock->budget_ns > 0) ? start_ns + (uint64_t)clock->budget_ns : 0);
+    rank = chosen;
+    if (validate_possession(rank, g->hand_hl[player - 1]) != 1) {
+        rank = g->hand_hl[player - 1]->value;
+        h->fallbacks++;
+    }
+    
+    uint64_t ns = monotonic_ns() - start_ns;
+    int overrun = (clock->budget_ns > 0 && ns > (uint64_t)clock->budget_ns);
+    record_latency(h, ns);
+    h->overruns += overrun;
+    if (g->counters != NULL) {
+        count_move(g->counters, ns);
+        count_decision(g->counters, player, ns, overrun, rank != chosen);
+    }
+    return rank;
+    
+}
+
+
+/************************************************************************
+ * monotonic_ns(): Function that returns the monotonic clock in         *
+ *      nanoseconds, the clock move deadlines are set on.               *
+ ************************************************************************/
+uint64_t monotonic_ns(void) {
+    
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+    
+}
+
+
+/************************************************************************
+ * latency_bucket(): Function that returns the histogram bucket of a    *
+ *      decision that took ns nanoseconds. Below 8ns every nanosecond   *
+ *      has its own bucket, above that each power of two is split into  *
+ *      8, so a bucket is at most 12.5% wide.                           *
+ ************************************************************************/
+int latency_bucket(uint64_t ns) {
+    
+    if (ns < 8) {
+        return (int)ns;
+    }
+    int exponent = 63 - __builtin_clzll(ns);
+    int bucket = (exponent - 2) * 8 + (int)((ns >> (exponent - 3)) & 7);
+    return (bucket < LATENCY_BUCKETS) ? bucket : LATENCY_BUCKETS - 1;
+    
+}
+
+
+/************************************************************************
+ * latency_percentile(): Function that returns the time within which    *
+ *      fraction p of the decisions in h were made, rounded up to the   *
+ *      end of its bucket (never past the slowest decision).            *
+ ************************************************************************/
+uint64_t latency_percentile(const latency_histogram *h, double p) {
+    
+    uint64_t wanted = (uint64_t)ceil(p * h->decisions);
+    uint64_t seen = 0;
+    
+    if (h->decisions == 0) {
+        return 0;
+    }
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += h->buckets[bucket];
+        if (seen >= wanted && seen > 0) {
+            // First value of the next bucket, less one
+            int next = bucket + 1;
+            uint64_t end = (next < 8) ? (uint64_t)next : (uint64_t)(8 + next % 8) << (next / 8 - 1);
+            return (end - 1 < h->max_ns) ? end - 1 : h->max_ns;
+        }
+    }
+    return h->max_ns;
+    
+}
+
+
+/************************************************************************
+ * record_latency(): Function that adds one move time to a histogram.   *
+ ************************************************************************/
+void record_latency(latency_histogram *h, uint64_t ns) {
+    h->buckets[latency_bucket(ns)]++;
+    h->decisions++;
+    if (ns > h->max_ns) {
+        h->max_ns = ns;
+    }
+}
+
+
+/************************************************************************
+ * merge_latency(): Function that adds the decisions of one histogram   *
+ *      into another, as when folding per-thread histograms together.   *
+ ************************************************************************/
+void merge_latency(latency_histogram *into, const latency_histogram *from) {
+    
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        into->buckets[bucket] += from->buckets[bucket];
+    }
+    into->decisions += from->decisions;
+    into->overruns += from->overruns;
+    into->fallbacks += from->fallbacks;
+    if (from->max_ns > into->max_ns) {
+        into->max_ns = from->max_ns;
+    }
+    
+}
+
+
+/************************************************************************
+ * print_latency(): Function that prints one line of decision times:    *
+ *      count, p50, p99 and max in microseconds, and how many went over *
+ *      budget_ns (when there was one) or fell back.                    *
+ ************************************************************************/
+void print_latency(const char *label, const latency_histogram *h, long budget_ns) {
+    
+    printf("%-16s%llu decisions, p50 %.1fus, p99 %.1fus, max %.1fus", label, (unsigned long long)h->decisions,
+           latency_percentile(h, 0.5) / 1e3, latency_percentile(h, 0.99) / 1e3, h->max_ns / 1e3);
+    if (budget_ns > 0) {
+        printf(", %llu over %.0fus", (unsigned long long)h->overruns, budget_ns / 1e3);
+    }
+    printf(", %llu fallbacks\n", (unsigned long long)h->fallbacks);
+    
+}
+
+
+/************************************************************************
+ * load_bot(): Function that sets up the bot named by spec: random,     *
+ *      most (most copies held), last (the rank the opponent asked for  *
+ *      last, then most copies) or the path of a strategy table written *
+ *      by --train, which is mapped into memory for the rest of the run.*
+ *      search:BOT is BOT searching ahead, see choose_search_ask(), and *
+ *      a path ending in .so is a strategy plugin, see load_plugin().   *
+ *      Returns 0, or 1 if spec names no bot.                           *
+ ************************************************************************/
+int load_bot(bot *b, const char *spec) {
+    
+    b->name = spec;
+    b->table = NULL;
+    b->search = 0;
+    
+    b->plugin = NULL;
+    
+    size_t len = strlen(spec);
+    if (strncmp(spec, "search:", 7) == 0) {
+        int error = load_bot(b, spec + 7);
+        b->name = spec;
+        b->search = 1;
+        return error;
+    } else if (len > 3 && strcmp(spec + len - 3, ".so") == 0) {
+        return load_plugin(b, spec);
+    } else if (strcmp(spec, "random") == 0) {
+        return 0;
+    } else if (strcmp(spec, "most") == 0 || strcmp(spec, "last") == 0) {
+        for (int i = 0; i < STRATEGY_SITUATIONS; i++) {
+            int copies = (i >> 3) % 3 + 1;
+            int last = (i >> 1) & 1;
+            b->builtin[i] = (uint16_t)((spec[0] == 'l') ? last * 4 + copies : copies);
+        }
+        b->table = b->builtin;
+        return 0;
+    }
+    
+    int fd = open(spec, O_RDONLY);
+    struct stat info;
+    const strategy_header *header;
+    
+    if (fd < 0 || fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(strategy_header)) {
+        printf("ERROR: %s is not a bot or a strategy table file\n", spec);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+    header = (const strategy_header*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        printf("ERROR: Could not map %s\n", spec);
+        return 1;
+    }
+    if (header->magic != STRATEGY_MAGIC || header->version != STRATEGY_VERSION || header->num_situations != STRATEGY_SITUATIONS
+        || header->header_size + STRATEGY_SITUATIONS * sizeof(uint16_t) > (size_t)info.st_size) {
+        printf("ERROR: %s is not a strategy table file\n", spec);
+        munmap((void*)header, info.st_size);
+        return 1;
+    }
+    b->table = (const uint16_t*)((const uint8_t*)header + header->header_size);
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * load_plugin(): Function that loads the strategy plugin at path, a    *
+ *      shared object built against gofish_plugin.h, for bot b. The     *
+ *      plugin stays loaded for the rest of the run. Returns 0, or 1 if *
+ *      it is not a plugin of this version of the ABI.                  *
+ ************************************************************************/
+int load_plugin(bot *b, const char *path) {
+    
+    char local[4096];
+    
+    // dlopen() only looks in the current directory for paths that say so
+    snprintf(local, sizeof(local), (strchr(path, '/') == NULL) ? "./%s" : "%s", path);
+    void *handle = dlopen(local, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        printf("ERROR: Could not load %s: %s\n", path, dlerror());
+        return 1;
+    }
+    
+    const gofish_strategy* (*entry)(void);
+    *(void**)&entry = dlsym(handle, GOFISH_PLUGIN_ENTRY); // Object to function pointer, as POSIX allows
+    const gofish_strategy *plugin = (entry != NULL) ? entry() : NULL;
+    if (plugin == NULL || plugin->abi_version != GOFISH_PLUGIN_ABI || plugin->size < sizeof(gofish_strategy)
+        || plugin->init == NULL || plugin->choose_ask == NULL) {
+        printf("ERROR: %s is not a strategy plugin for ABI version %d\n", path, GOFISH_PLUGIN_ABI);
+        dlclose(handle);
+        return 1;
+    }
+    b->plugin = plugin;
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * choose_plugin_ask(): Computer player that asks a strategy plugin,    *
+ *      making the plugin's state for the seat first if the game does   *
+ *      not have it yet. The plugin is handed deadline_ns as it is (0   *
+ *      for none). An answer the player does not hold is replaced by    *
+ *      the rank of the first card in hand.                             *
+ ************************************************************************/
+int choose_plugin_ask(game *g, const bot *b, uint64_t deadline_ns) {
+    
+    int player = g->players_turn;
+    game_view v;
+    gofish_view view;
+    
+    if (g->plugins[player - 1] != b->plugin) {
+        attach_plugin(g, player, b->plugin);
+    }
+    
+    game_view_fill(g, player, &v);
+    view.player = v.player;
+    for (int rank = 0; rank <= NUM_RANKS; rank++) {
+        view.hand[rank] = v.hand[rank];
+        view.known[rank] = v.known[rank];
+        view.booked[rank] = v.booked[rank];
+    }
+    view.opp_cards = v.opp_cards;
+    view.deck_cards = v.deck_cards;
+    view.score = v.score;
+    view.opp_score = v.opp_score;
+    view.opp_last_ask = v.opp_last_ask;
+    view.last_ask = g->last_ask[player - 1];
+    view.turn = g->turn_count;
+    view.game_id = g->id;
+    
+    int rank = b->plugin->choose_ask(g->plugin_state[player - 1], &view, deadline_ns);
+    if (rank < 1 || rank > NUM_RANKS || g->hand_count[player - 1][rank] == 0) {
+        rank = g->hand_hl[player - 1]->value;
+    }
+    return rank;
+    
+}
+
+
+/************************************************************************
+ * attach_bots(): Function that gives every strategy plugin among the   *
+ *      bots of a game its state before the deal, so the plugin sees    *
+ *      every event of the game. Other bots need nothing.               *
+ ************************************************************************/
+void attach_bots(game *g, const bot *bots) {
+    
+    for (int player = PLAYER_ONE; player <= PLAYER_TWO; player++) {
+        if (bots[player - 1].plugin != NULL) {
+            attach_plugin(g, player, bots[player - 1].plugin);
+        }
+    }
+    
+}
+
+
+/************************************************************************
+ * attach_plugin(): Function that makes the state of plugin for the     *
+ *      seat of player, freeing the state of any plugin seated there    *
+ *      before. The seed comes from the seat's stream of the game.      *
+ ************************************************************************/
+void attach_plugin(game *g, int player, const gofish_strategy *plugin) {
+    
+    const gofish_strategy *old = g->plugins[player - 1];
+    
+    if (old != NULL && old->free != NULL) {
+        old->free(g->plugin_state[player - 1]);
+    }
+    uint64_t seed_hi = rng_next(&g->bot_rng[player - 1]); // Two statements, so the order of the draws is defined
+    uint64_t seed_lo = rng_next(&g->bot_rng[player - 1]);
+    uint64_t seed = seed_hi << 32 | seed_lo;
+    g->plugins[player - 1] = plugin;
+    g->plugin_state[player - 1] = plugin->init(player, seed);
+    
+}
+
+
+/************************************************************************
+ * detach_bots(): Function that frees the state of every strategy       *
+ *      plugin playing a game.                                          *
+ ************************************************************************/
+void detach_bots(game *g) {
+    
+    for (int i = 0; i < 2; i++) {
+        if (g->plugins[i] != NULL && g->plugins[i]->free != NULL) {
+            g->plugins[i]->free(g->plugin_state[i]);
+        }
+        g->plugins[i] = NULL;
+        g->plugin_state[i] = NULL;
+    }
+    
+}
+
+
+/************************************************************************
+ * notify_plugins(): Function that tells the strategy plugins playing a *
+ *      game about an event. A seat is not shown the rank of a card     *
+ *      only the other player saw: the opponent's deal, draws and fish. *
+ ************************************************************************/
+void notify_plugins(game *g, int type, int player, int rank, int count) {
+    
+    for (int seat = PLAYER_ONE; seat <= PLAYER_TWO; seat++) {
+        const gofish_strategy *plugin = g->plugins[seat - 1];
+        if (plugin == NULL || plugin->observe_event == NULL) {
+            continue;
+        }
+        gofish_event event = {type, player, rank, count};
+        if ((type == EVENT_DEAL || type == EVENT_DRAW || type == EVENT_FISH) && player != seat) {
+            event.rank = 0;
+        }
+        plugin->observe_event(g->plugin_state[seat - 1], &event);
+    }
+    
+}
+
+
+/************************************************************************
+ * train_strategy(): Function that builds a strategy table by playing   *
+ *      random bots against each other, as in                           *
+ *      ./main --train TABLE_FILE GAMES [--seed S]. The score of each   *
+ *      situation is the average number of cards an ask in it won,      *
+ *      scaled by 16384.                                                *
+ ************************************************************************/
+int train_strategy(int argc, char *argv[]) {
+    
+    const char *path = argv[2];
+    int num_games = atoi(argv[3]);
+    uint64_t seed = (uint64_t)time(NULL);
+    uint64_t asks[STRATEGY_SITUATIONS] = {0};
+    uint64_t gained[STRATEGY_SITUATIONS] = {0};
+    uint16_t table[STRATEGY_SITUATIONS];
+    strategy_header header;
+    int covered = 0;
+    game g;
+    
+    for (int i = 4; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        }
+    }
+    if (num_games <= 0) {
+        printf("ERROR: GAMES must be positive\n");
+        return 1;
+    }
+    
+    for (int i = 0; i < num_games; i++) {
+        game_init(&g, NULL);
+        game_seed(&g, seed, (uint32_t)i);
+        generate_random_deck(&g.deck_hl, &g.deck_hr);
+        shuffle_deck(g.deck_hl, &g.rng);
+        
+        int state = game_resume(&g, 0);
+        while (state == GAME_AWAIT_GUESS) {
+            int player = g.players_turn;
+            int opponent = (player == PLAYER_ONE) ? PLAYER_TWO : PLAYER_ONE;
+            int rank = choose_random_ask(&g);
+            int situation = strategy_context(&g, player) + strategy_row(&g, player, rank);
+            
+            asks[situation]++;
+            gained[situation] += g.hand_count[opponent - 1][rank];
+            state = game_resume(&g, rank);
+        }
+        game_free(&g);
+    }
+    
+    for (int i = 0; i < STRATEGY_SITUATIONS; i++) {
+        table[i] = (asks[i] > 0) ? (uint16_t)((gained[i] * 16384 + asks[i] / 2) / asks[i]) : 0;
+        covered += (asks[i] > 0);
+    }
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = STRATEGY_MAGIC;
+    header.version = STRATEGY_VERSION;
+    header.header_size = sizeof(strategy_header);
+    header.num_situations = STRATEGY_SITUATIONS;
+    header.games = (uint64_t)num_games;
+    header.seed = seed;
+    
+    FILE *file = fopen(path, "wb");
+    if (file == NULL || fwrite(&header, sizeof(header), 1, file) != 1 || fwrite(table, sizeof(uint16_t), STRATEGY_SITUATIONS, file) != STRATEGY_SITUATIONS) {
+        printf("ERROR: Could not write %s\n", path);
+        if (file != NULL) {
+            fclose(file);
+        }
+        return 1;
+    }
+    fclose(file);
+    
+    printf("Trained on:     %d games\n", num_games);
+    printf("Situations:     %d of %d seen\n", covered, STRATEGY_SITUATIONS);
+    printf("Seed:           %llu\n", (unsigned long long)seed);
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * analyze_position(): Function that works out the exact chances of     *
+ *      every ask open to the player to move, as in                     *
+ *      ./main --analyze SEED GAME_INDEX TURN. The game is replayed     *
+ *      with the given bots up to TURN guesses, then every way the      *
+ *      cards the player cannot see may lie (consistent with what the   *
+ *      opponent revealed by asking) is played out for each ask, with   *
+ *      the bots making every later guess. Above --limit hidden deals   *
+ *      only --samples of them are drawn at random. Deals are spread    *
+ *      over --threads in chunks and the chunks are added up in order,  *
+ *      so the report does not depend on the number of threads.         *
+ ************************************************************************/
+int analyze_position(int argc, char *argv[]) {
+    
+    game g;
+    bot bots[2];
+    analysis a;
+    uint64_t seed = strtoull(argv[2], NULL, 10);
+    uint32_t index = (uint32_t)strtoul(argv[3], NULL, 10);
+    int turn = atoi(argv[4]);
+    int num_threads = 1, limit = 200000, num_samples = 20000;
+    double total;
+    int usage = 0;
+    
+    load_bot(&bots[0], "random");
+    load_bot(&bots[1], "random");
+    for (int i = 5; i < argc && !usage; i += 2) {
+        if (i + 1 >= argc) {
+            usage = 1;
+        } else if (strcmp(argv[i], "--bot1") == 0) {
+            usage = load_bot(&bots[0], argv[i + 1]);
+        } else if (strcmp(argv[i], "--bot2") == 0) {
+            usage = load_bot(&bots[1], argv[i + 1]);
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            num_threads = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--limit") == 0) {
+            limit = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--samples") == 0) {
+            num_samples = atoi(argv[i + 1]);
+        } else {
+            usage = 1;
+        }
+    }
+    if (usage || num_threads <= 0 || limit < 0 || num_samples <= 0) {
+        printf("Usage: %s --analyze SEED GAME_INDEX TURN [--bot1 BOT] [--bot2 BOT] [--threads N] [--limit DEALS] [--samples DEALS]\n", argv[0]);
+        return 1;
+    }
+    
+    // Replay the game up to the position
+    game_init(&g, NULL);
+    game_seed(&g, seed, index);
+    generate_random_deck(&g.deck_hl, &g.deck_hr);
+    shuffle_deck(g.deck_hl, &g.rng);
+    attach_bots(&g, bots);
+    int state = game_resume(&g, 0);
+    while (state == GAME_AWAIT_GUESS && g.turn_count < turn) {
+        state = game_resume(&g, choose_bot_ask(&g, &bots[g.players_turn - 1], 0));
+    }
+    if (state != GAME_AWAIT_GUESS) {
+        printf("ERROR: Game %u of seed %llu is over after %d guesses\n", index, (unsigned long long)seed, g.turn_count);
+        game_free(&g);
+        return 1;
+    }
+    
+    int player = g.players_turn;
+    int opponent = (player == PLAYER_ONE) ? PLAYER_TWO : PLAYER_ONE;
+    
+    memset(&a, 0, sizeof(a));
+    a.position = &g;
+    a.bots = bots;
+    a.seed = seed;
+    for (int rank = 1; rank <= NUM_RANKS; rank++) {
+        if (g.hand_count[player - 1][rank] > 0) {
+            a.asks[a.num_asks++] = rank;
+        }
+    }
+    
+    a.deals = (hidden_deal*)malloc((size_t)((limit > num_samples) ? limit : num_samples) * sizeof(hidden_deal));
+    a.num_deals = enumerate_hidden_deals(&g, player, a.deals, limit, &total);
+    int sampled = (a.num_deals < 0);
+    if (sampled) {
+        a.num_deals = sample_hidden_deals(&g, player, seed, a.deals, num_samples);
+    }
+    
+    int num_chunks = (a.num_deals + ANALYSIS_CHUNK - 1) / ANALYSIS_CHUNK;
+    a.tally = calloc((size_t)num_chunks, sizeof(*a.tally));
+    atomic_init(&a.next_chunk, 0);
+    
+    pthread_t *threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+    for (int i = 0; i < num_threads; i++) {
+        pthread_create(&threads[i], NULL, analysis_worker, &a);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    
+    // Reduce in chunk order so the sums come out the same for any number of threads
+    double outcome[NUM_RANKS][3] = {{0}};
+    for (int c = 0; c < num_chunks; c++) {
+        for (int i = 0; i < a.num_asks; i++) {
+            for (int k = 0; k < 3; k++) {
+                outcome[i][k] += a.tally[c][i][k];
+            }
+        }
+    }
+    
+    printf("Position:       game %u of seed %llu after %d guesses, Player %d to ask\n", index, (unsigned long long)seed, g.turn_count, player);
+    printf("Hand:          ");
+    for (int rank = 1; rank <= NUM_RANKS; rank++) {
+        for (int i = 0; i < g.hand_count[player - 1][rank]; i++) {
+            printf((rank == 10) ? " 10" : " %c", convert_rank(rank));
+        }
+    }
+    printf("\nScore:          %d - %d\n", g.score[player - 1], g.score[opponent - 1]);
+    printf("Opponent:       %d cards, pool: %d cards\n", find_length(g.hand_hl[opponent - 1]), g.deck_count);
+    if (sampled) {
+        printf("Hidden deals:   %d sampled of %.4g\n", a.num_deals, total);
+    } else {
+        printf("Hidden deals:   %d, all played out\n", a.num_deals);
+    }
+    printf("Bots:           %s vs %s\n\n", bots[0].name, bots[1].name);
+    printf("Ask      Win      Tie     Loss\n");
+    for (int i = 0; i < a.num_asks; i++) {
+        double sum = outcome[i][0] + outcome[i][1] + outcome[i][2];
+        printf((a.asks[i] == 10) ? "10  " : "%c   ", convert_rank(a.asks[i]));
+        printf("%7.2f%% %7.2f%% %7.2f%%\n", 100.0 * outcome[i][2] / sum, 100.0 * outcome[i][1] / sum, 100.0 * outcome[i][0] / sum);
+    }
+    
+    free(threads);
+    free(a.tally);
+    free(a.deals);
+    game_free(&g);
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * enumerate_hidden_deals(): Function that lists every distinct way the *
+ *      cards player cannot see may be split between the opponent's     *
+ *      hand and the pool (in order), keeping only splits that give the *
+ *      opponent the cards they are known to hold. Suits are left out.  *
+ *      Each deal is weighted by how many card-level deals it stands    *
+ *      for (proportional to 1 / prod(opponent copies of each rank!)).  *
+ *      Sets total to the number of deals and returns it, or -1 if      *
+ *      there are more than limit.                                      *
+ ************************************************************************/
+int enumerate_hidden_deals(const game *g, int player, hidden_deal *deals, int limit, double *total) {
+    
+    int opponent = (player == PLAYER_ONE) ? PLAYER_TWO : PLAYER_ONE;
+    int unseen[NUM_RANKS + 1], opp[NUM_RANKS + 1];
+    int opp_cards = 0, deck_cards = g->deck_count;
+    double factorial[53];
+    int num_deals = 0;
+    
+    factorial[0] = 1;
+    for (int i = 1; i <= 52; i++) {
+        factorial[i] = factorial[i - 1] * i;
+    }
+    for (int rank = 1; rank <= NUM_RANKS; rank++) {
+        unseen[rank] = (g->booked[rank] != 0) ? 0 : 4 - g->hand_count[player - 1][rank];
+        opp_cards += g->hand_count[opponent - 1][rank];
+        opp[rank] = g->known[opponent - 1][rank]; // Least the opponent can hold
+    }
+    
+    // Count first, walking the opponent hands like an odometer over ranks 1..13
+    *total = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        int hand[NUM_RANKS + 1];
+        int rank = 1, held = 0;
+        
+        for (int r = 1; r <= NUM_RANKS; r++) {
+            hand[r] = opp[r];
+            held += opp[r];
+        }
+        while (1) {
+            if (held == opp_cards) {
+                double ways = factorial[deck_cards], weight = 1;
+                for (int r = 1; r <= NUM_RANKS; r++) {
+                    ways /= factorial[unseen[r] - hand[r]];
+                    weight /= factorial[hand[r]];
+                }
+                if (pass == 0) {
+                    *total += ways;
+                } else {
+                    // Every order of the pool, starting from its sorted order
+                    hidden_deal deal;
+                    int n = 0;
+                    for (int r = 1; r <= NUM_RANKS; r++) {
+                        deal.opp[r] = (uint8_t)hand[r];
+                        for (int i = hand[r]; i < unseen[r]; i++) {
+                            deal.deck[n++] = (uint8_t)r;
+                        }
+                    }
+                    deal.opp[0] = 0;
+                    deal.weight = weight;
+                    do {
+                        deals[num_deals++] = deal;
+                    } while (next_rank_permutation(deal.deck, n));
+                }
+            }
+            
+            // Next opponent hand: bump the lowest rank that can take another card
+            for (rank = 1; rank <= NUM_RANKS; rank++) {
+                if (held < opp_cards && hand[rank] < unseen[rank]) {
+                    hand[rank]++;
+                    held++;
+                    break;
+                }
+                held -= hand[rank] - opp[rank];
+                hand[rank] = opp[rank];
+            }
+            if (rank > NUM_RANKS) {
+                break;
+            }
+        }
+        if (pass == 0 && *total > limit) {
+            return -1;
+        }
+    }
+    return num_deals;
+    
+}
+
+
+/************************************************************************
+ * sample_hidden_deals(): Function that deals the cards player cannot   *
+ *      see at random count times, redealing whenever the opponent      *
+ *      would not hold the cards they are known to hold. Deal i always  *
+ *      comes from the same stream of seed. Returns the deals kept.     *
+ ************************************************************************/
+int sample_hidden_deals(const game *g, int player, uint64_t seed, hidden_deal *deals, int count) {
+    
+    int opponent = (player == PLAYER_ONE) ? PLAYER_TWO : PLAYER_ONE;
+    int unseen[52], num_unseen = 0, opp_cards = 0;
+    rng_stream rng;
+    
+    for (int rank = 1; rank <= NUM_RANKS; rank++) {
+        for (int i = (g->booked[rank] != 0) ? 4 : g->hand_count[player - 1][rank]; i < 4; i++) {
+            unseen[num_unseen++] = rank;
+        }
+        opp_cards += g->hand_count[opponent - 1][rank];
+    }
+    
+    for (int d = 0; d < count; d++) {
+        hidden_deal *deal = &deals[d];
+        int consistent = 0;
+        
+        rng_init(&rng, seed, (uint32_t)d, STREAM_ANALYSIS);
+        for (int attempt = 0; attempt < 1000 && !consistent; attempt++) {
+            for (int i = 0; i < num_unseen - 1; i++) {
+                int j = i + rand_gen(num_unseen - i, &rng);
+                int temp = unseen[i];
+                unseen[i] = unseen[j];
+                unseen[j] = temp;
+            }
+            memset(deal->opp, 0, sizeof(deal->opp));
+            for (int i = 0; i < opp_cards; i++) {
+                deal->opp[unseen[i]]++;
+            }
+            consistent = 1;
+            for (int rank = 1; rank <= NUM_RANKS; rank++) {
+                if (deal->opp[rank] < g->known[opponent - 1][rank]) {
+                    consistent = 0;
+                }
+            }
+        }
+        if (!consistent) {
+            return d;
+        }
+        for (int i = opp_cards; i < num_unseen; i++) {
+            deal->deck[i - opp_cards] = (uint8_t)unseen[i];
+        }
+        deal->weight = 1;
+    }
+    return count;
+    
+}
+
+
+/************************************************************************
+ * next_rank_permutation(): Function that rearranges ranks into the     *
+ *      next order in lexicographic order, returning 0 once it wraps    *
+ *      back around to sorted. Repeated ranks give each order once.     *
+ ************************************************************************/
+int next_rank_permutation(uint8_t *ranks, int n) {
+    
+    int i = n - 2;
+    while (i >= 0 && ranks[i] >= ranks[i + 1]) {
+        i--;
+    }
+    if (i < 0) {
+        return 0;
+    }
+    int j = n - 1;
+    while (ranks[j] <= ranks[i]) {
+        j--;
+    }
+    uint8_t temp = ranks[i];
+    ranks[i] = ranks[j];
+    ranks[j] = temp;
+    for (int lo = i + 1, hi = n - 1; lo < hi; lo++, hi--) {
+        temp = ranks[lo];
+        ranks[lo] = ranks[hi];
+        ranks[hi] = temp;
+    }
+    return 1;
+    
+}
+
+
+/************************************************************************
+ * analysis_worker(): Analysis thread. Takes the next chunk of hidden   *
+ *      deals until none are left and plays each of them out for every  *
+ *      candidate ask, tallying into the chunk's own slot.              *
+ ************************************************************************/
+void* analysis_worker(void *arg) {
+    
+    analysis *a = (analysis*)arg;
+    int chunk;
+    
+    while ((chunk = atomic_fetch_add(&a->next_chunk, 1)) * ANALYSIS_CHUNK < a->num_deals) {
+        int end = (chunk + 1) * ANALYSIS_CHUNK;
+        if (end > a->num_deals) {
+            end = a->num_deals;
+        }
+        for (int d = chunk * ANALYSIS_CHUNK; d < end; d++) {
+            for (int i = 0; i < a->num_asks; i++) {
+                int result = play_out_deal(a, &a->deals[d], d, a->asks[i]);
+                a->tally[chunk][i][result] += a->deals[d].weight;
+            }
+        }
+    }
+    return NULL;
+    
+}
+
+
+/************************************************************************
+ * play_out_deal(): Function that sets the analysed position up with    *
+ *      the hidden cards lying as in deal, has the player to move ask   *
+ *      for rank and lets the bots finish the game. Every ask of a deal *
+ *      is played out with the same bot streams. Returns 2 if the       *
+ *      player wins, 1 for a tie and 0 if they lose.                    *
+ ************************************************************************/
+int play_out_deal(const analysis *a, const hidden_deal *deal, int deal_index, int rank) {
+    
+    const game *position = a->position;
+    int player = position->players_turn;
+    int opponent = (player == PLAYER_ONE) ? PLAYER_TWO : PLAYER_ONE;
+    game g = *position;
+    
+    g.out = NULL;
+    g.log = NULL;
+    g.history = NULL;
+    g.deck_hl = g.deck_hr = NULL;
+    g.hand_hl[0] = g.hand_hr[0] = NULL;
+    g.hand_hl[1] = g.hand_hr[1] = NULL;
+    g.book_hl = g.book_hr = NULL; // Books of the playout are its own, the position's are shared between threads
+    g.counters = NULL; // Only real games are counted
+    g.plugins[0] = g.plugins[1] = NULL; // Plugins make their own state for the playout when asked to move
+    g.plugin_state[0] = g.plugin_state[1] = NULL;
+    for (card *temp = position->hand_hl[player - 1]; temp != NULL; temp = temp->next) {
+        add_to_end(g.hand_hr[player - 1], &g.hand_hl[player - 1], &g.hand_hr[player - 1], card_from_code(card_code(temp)));
+    }
+    for (int r = 1; r <= NUM_RANKS; r++) {
+        g.hand_count[opponent - 1][r] = deal->opp[r];
+        for (int i = 0; i < deal->opp[r]; i++) {
+            add_to_end(g.hand_hr[opponent - 1], &g.hand_hl[opponent - 1], &g.hand_hr[opponent - 1], card_from_code(r * 4));
+        }
+    }
+    for (int i = 0; i < position->deck_count; i++) {
+        add_to_end(g.deck_hr, &g.deck_hl, &g.deck_hr, card_from_code(deal->deck[i] * 4));
+    }
+    rng_init(&g.bot_rng[0], a->seed, (uint32_t)deal_index, STREAM_PLAYER);
+    rng_init(&g.bot_rng[1], a->seed, (uint32_t)deal_index, STREAM_PLAYER + 1);
+    
+    int state = game_resume(&g, rank);
+    while (state == GAME_AWAIT_GUESS) {
+        state = game_resume(&g, choose_bot_ask(&g, &a->bots[g.players_turn - 1], 0));
+    }
+    
+    int result = (g.score[player - 1] > g.score[opponent - 1]) ? 2 : (g.score[player - 1] == g.score[opponent - 1]) ? 1 : 0;
+    game_free(&g);
+    return result;
+    
+}
+
+
+/************************************************************************
+ * run_ladder(): Function that rates any number of bots against each    *
+ *      other, as in ./main --ladder BOT BOT... Ratings are TrueSkill   *
+ *      (mean and uncertainty), updated after every game. Each match is *
+ *      LADDER_MATCH_DEALS deals between the pair with the most to      *
+ *      learn from playing (see ladder_information()), every deal       *
+ *      played twice with the seats swapped so neither the first move   *
+ *      nor the cards favour either bot. Stops once every bot's sigma   *
+ *      is under --target or after --max-games.                         *
+ ************************************************************************/
+int run_ladder(int argc, char *argv[]) {
+    
+    ladder_entry *entries = (ladder_entry*)calloc(argc, sizeof(ladder_entry));
+    ladder_match *match = (ladder_match*)malloc(sizeof(ladder_match));
+    int num_bots = 0, num_threads = 1;
+    uint64_t seed = (uint64_t)time(NULL);
+    double target = 0.5;
+    long max_games = 1000000, games = 0;
+    long deadline_us = 0;
+    int num_matches = 0;
+    int usage = 0;
+    
+    for (int i = 2; i < argc && !usage; i++) {
+        if (argv[i][0] != '-') {
+            entries[num_bots].mu = LADDER_MU;
+            entries[num_bots].sigma = LADDER_SIGMA;
+            usage = load_bot(&entries[num_bots++].b, argv[i]);
+        } else if (i + 1 >= argc) {
+            usage = 1;
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--target") == 0) {
+            target = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-games") == 0) {
+            max_games = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--deadline") == 0) {
+            deadline_us = atol(argv[++i]);
+            usage = (deadline_us <= 0);
+        } else {
+            usage = 1;
+        }
+    }
+    if (usage || num_bots < 2 || num_threads <= 0 || target <= 0) {
+        printf("Usage: %s --ladder BOT BOT... [--threads N] [--seed S] [--target SIGMA] [--max-games GAMES] [--deadline MICROSECONDS]\n", argv[0]);
+        free(entries);
+        free(match);
+        return 1;
+    }
+    
+    ladder_thread *threads = (ladder_thread*)calloc(num_threads, sizeof(ladder_thread));
+    match->seed = seed;
+    match->num_threads = num_threads;
+    
+    while (games < max_games) {
+        
+        // Schedule the pair whose match is worth the most
+        int a = -1, b = -1;
+        double best = -1, max_sigma = 0;
+        for (int i = 0; i < num_bots; i++) {
+            if (entries[i].sigma > max_sigma) {
+                max_sigma = entries[i].sigma;
+            }
+            for (int j = i + 1; j < num_bots; j++) {
+                double information = ladder_information(&entries[i], &entries[j]);
+                if (information > best) {
+                    best = information;
+                    a = i;
+                    b = j;
+                }
+            }
+        }
+        if (max_sigma < target) {
+            break;
+        }
+        
+        match->seats[0][0] = entries[a].b;
+        match->seats[0][1] = entries[b].b;
+        match->seats[1][0] = entries[b].b;
+        match->seats[1][1] = entries[a].b;
+        match->first_deal = (uint32_t)num_matches * LADDER_MATCH_DEALS;
+        for (int i = 0; i < num_threads; i++) {
+            threads[i].index = i;
+            threads[i].match = match;
+            memset(threads[i].clock, 0, sizeof(threads[i].clock));
+            threads[i].clock[0].budget_ns = threads[i].clock[1].budget_ns = deadline_us * 1000;
+            pthread_create(&threads[i].thread, NULL, ladder_worker, &threads[i]);
+        }
+        for (int i = 0; i < num_threads; i++) {
+            pthread_join(threads[i].thread, NULL);
+            // Bot a sits in seat 1 of even games and seat 2 of odd ones
+            merge_latency(&entries[a].latency, &threads[i].clock[0].seat[0]);
+            merge_latency(&entries[b].latency, &threads[i].clock[0].seat[1]);
+            merge_latency(&entries[b].latency, &threads[i].clock[1].seat[0]);
+            merge_latency(&entries[a].latency, &threads[i].clock[1].seat[1]);
+        }
+        
+        // Rate the games in order, so the ladder does not depend on the number of threads
+        for (int k = 0; k < 2 * LADDER_MATCH_DEALS; k++) {
+            int seat = match->winner[k];
+            entries[a].games++;
+            entries[b].games++;
+            if (seat == 0) {
+                continue; // Ties carry almost no information in a game of 13 books
+            }
+            // Bot a sits in seat 1 of even games and seat 2 of odd ones
+            if ((seat == PLAYER_ONE) == (k % 2 == 0)) {
+                entries[a].wins++;
+                ladder_update(&entries[a], &entries[b]);
+            } else {
+                entries[b].wins++;
+                ladder_update(&entries[b], &entries[a]);
+            }
+        }
+        games += 2 * LADDER_MATCH_DEALS;
+        num_matches++;
+    }
+    
+    // Leaderboard by conservative rating, mu - 3 sigma
+    for (int i = 1; i < num_bots; i++) {
+        ladder_entry temp = entries[i];
+        int j = i;
+        while (j > 0 && entries[j - 1].mu - 3 * entries[j - 1].sigma < temp.mu - 3 * temp.sigma) {
+            entries[j] = entries[j - 1];
+            j--;
+        }
+        entries[j] = temp;
+    }
+    printf("Rank  Rating    Mu  Sigma   Games   Win%%  Bot\n");
+    for (int i = 0; i < num_bots; i++) {
+        printf("%4d %7.2f %5.2f %6.3f %7d %6.2f  %s\n", i + 1, entries[i].mu - 3 * entries[i].sigma, entries[i].mu, entries[i].sigma,
+               entries[i].games, (entries[i].games > 0) ? 100.0 * entries[i].wins / entries[i].games : 0.0, entries[i].b.name);
+    }
+    printf("Games played:   %ld in %d matches\n", games, num_matches);
+    printf("Seed:           %llu\n", (unsigned long long)seed);
+    if (deadline_us > 0) {
+        printf("\nMove times with a deadline of %ldus:\n", deadline_us);
+        for (int i = 0; i < num_bots; i++) {
+            char label[24];
+            snprintf(label, sizeof(label), "%d %s", i + 1, entries[i].b.name);
+            print_latency(label, &entries[i].latency, deadline_us * 1000);
+        }
+    }
+    
+    free(threads);
+    free(match);
+    free(entries);
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * ladder_worker(): Ladder match thread. Plays every num_threads-th     *
+ *      game of the match starting at its own index and records the     *
+ *      winning seat of each.                                           *
+ ************************************************************************/
+void* ladder_worker(void *arg) {
+    
+    ladder_thread *t = (ladder_thread*)arg;
+    ladder_match *match = t->match;
+    game g;
+    
+    game_init(&g, NULL);
+    for (int k = t->index; k < 2 * LADDER_MATCH_DEALS; k += match->num_threads) {
+        game_seed(&g, match->seed, match->first_deal + (uint32_t)(k / 2));
+        match->winner[k] = play_silent_game(&g, match->seats[k % 2], (t->clock[0].budget_ns > 0) ? &t->clock[k % 2] : NULL);
+    }
+    game_free(&g);
+    return NULL;
+    
+}
+
+
+/************************************************************************
+ * ladder_update(): Function that applies the TrueSkill update for one  *
+ *      game between two bots, moving both means towards the result and *
+ *      shrinking both uncertainties.                                   *
+ ************************************************************************/
+void ladder_update(ladder_entry *winner, ladder_entry *loser) {
+    
+    double winner_var = winner->sigma * winner->sigma;
+    double loser_var = loser->sigma * loser->sigma;
+    double c2 = 2 * LADDER_BETA * LADDER_BETA + winner_var + loser_var;
+    double c = sqrt(c2);
+    double t = (winner->mu - loser->mu) / c;
+    double cdf = 0.5 * erfc(-t / sqrt(2));
+    double pdf = exp(-t * t / 2) / 2.5066282746310002; // sqrt(2 pi)
+    double v = (cdf > 1e-300) ? pdf / cdf : -t; // Mean shift, -t is its limit for a huge upset
+    double w = v * (v + t); // Variance shrink
+    
+    winner->mu += winner_var / c * v;
+    loser->mu -= loser_var / c * v;
+    winner->sigma = sqrt(winner_var * (1 - winner_var / c2 * w));
+    loser->sigma = sqrt(loser_var * (1 - loser_var / c2 * w));
+    
+}
+
+
+/************************************************************************
+ * ladder_information(): Function that scores how much a match between  *
+ *      two bots is expected to teach: their combined uncertainty,      *
+ *      times how close the outcome is expected to be. Settled or       *
+ *      lopsided pairs score low.                                       *
+ ************************************************************************/
+double ladder_information(const ladder_entry *a, const ladder_entry *b) {
+    
+    double var = a->sigma * a->sigma + b->sigma * b->sigma;
+    double p = 0.5 * erfc(-(a->mu - b->mu) / sqrt(2 * (2 * LADDER_BETA * LADDER_BETA + var)));
+    return var * p * (1 - p);
+    
+}
+
+
+/************************************************************************
+ * run_compare(): Function that decides which of two bots is stronger,  *
+ *      as in ./main --compare BOT_A BOT_B. Every deal is played twice, *
+ *      once with A in seat 1 and once with B there, from the same deck *
+ *      and with the same random stream for each seat, so both games    *
+ *      of a deal share their luck and the difference between them is   *
+ *      down to the bots. The statistics are taken over these paired    *
+ *      differences, which vary far less than single games do.          *
+ *                                                                      *
+ *      The result is looked at after --min-deals deals and then every  *
+ *      time the deals played double, up to --max-deals. Each look      *
+ *      tests at alpha / number of looks, so stopping at the first      *
+ *      significant one keeps the chance of a false verdict under alpha *
+ *      (Bonferroni). The intervals printed use the same level.         *
+ ************************************************************************/
+int run_compare(int argc, char *argv[]) {
+    
+    bot bots[2];
+    int num_threads = 1;
+    uint64_t seed = (uint64_t)time(NULL);
+    double alpha = 0.05;
+    long min_deals = 100, max_deals = 1000000;
+    int usage = (load_bot(&bots[0], argv[2]) != 0 || load_bot(&bots[1], argv[3]) != 0);
+    
+    for (int i = 4; i < argc && !usage; i += 2) {
+        if (i + 1 >= argc) {
+            usage = 1;
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            num_threads = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "--alpha") == 0) {
+            alpha = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "--min-deals") == 0) {
+            min_deals = atol(argv[i + 1]);
+        } else if (strcmp(argv[i], "--max-deals") == 0) {
+            max_deals = atol(argv[i + 1]);
+        } else {
+            usage = 1;
+        }
+    }
+    if (usage || num_threads <= 0 || alpha <= 0 || alpha >= 1 || min_deals <= 0 || max_deals < min_deals || max_deals > UINT32_MAX) {
+        printf("Usage: %s --compare BOT_A BOT_B [--threads N] [--seed S] [--alpha A] [--min-deals DEALS] [--max-deals DEALS]\n", argv[0]);
+        return 1;
+    }
+    
+    int num_looks = 1;
+    for (long n = min_deals; n < max_deals; n *= 2) {
+        num_looks++;
+    }
+    double z = normal_quantile(1 - alpha / (2 * num_looks));
+    
+    comparison c;
+    c.seats[0][0] = c.seats[1][1] = bots[0];
+    c.seats[0][1] = c.seats[1][0] = bots[1];
+    c.seed = seed;
+    c.num_threads = num_threads;
+    c.outcome = (int8_t*)malloc(2 * (size_t)max_deals);
+    c.margin = (int8_t*)malloc(2 * (size_t)max_deals);
+    compare_thread *threads = (compare_thread*)calloc(num_threads, sizeof(compare_thread));
+    
+    // Sums over deals of the paired differences, and over single games for the unpaired comparison
+    double pair_sum = 0, pair_sq = 0, pair_margin = 0, pair_margin_sq = 0;
+    double game_sq = 0, game_margin = 0, game_margin_sq = 0;
+    long wins[3] = {0, 0, 0}; // Ties, A's wins, B's wins
+    long deals = 0, next_look = min_deals;
+    double mean = 0, se = 0;
+    int decided = 0;
+    
+    printf("  Deals   Win diff  Interval            z\n");
+    while (deals < max_deals && !decided) {
+        
+        c.first_deal = (uint32_t)deals;
+        c.num_deals = (uint32_t)(((next_look < max_deals) ? next_look : max_deals) - deals);
+        for (int i = 0; i < num_threads; i++) {
+            threads[i].index = i;
+            threads[i].c = &c;
+            pthread_create(&threads[i].thread, NULL, compare_worker, &threads[i]);
+        }
+        for (int i = 0; i < num_threads; i++) {
+            pthread_join(threads[i].thread, NULL);
+        }
+        
+        for (uint32_t d = 0; d < c.num_deals; d++) {
+            double diff = (c.outcome[2 * d] + c.outcome[2 * d + 1]) / 2.0;
+            double margin = (c.margin[2 * d] + c.margin[2 * d + 1]) / 2.0;
+            pair_sum += diff;
+            pair_sq += diff * diff;
+            pair_margin += margin;
+            pair_margin_sq += margin * margin;
+            for (int k = 2 * d; k < 2 * (int)d + 2; k++) {
+                wins[(c.outcome[k] > 0) ? 1 : (c.outcome[k] < 0) ? 2 : 0]++;
+                game_sq += c.outcome[k] * c.outcome[k];
+                game_margin += c.margin[k];
+                game_margin_sq += c.margin[k] * c.margin[k];
+            }
+        }
+        deals += c.num_deals;
+        
+        mean = pair_sum / deals;
+        se = sqrt((pair_sq / deals - mean * mean) / (deals - 1 > 0 ? deals - 1 : 1));
+        printf("%7ld %+10.4f  %+.4f to %+.4f %6.2f\n", deals, mean, mean - z * se, mean + z * se, (se > 0) ? fabs(mean) / se : 0.0);
+        decided = (se > 0 && fabs(mean) > z * se);
+        next_look *= 2;
+    }
+    
+    long games = 2 * deals;
+    double margin_mean = pair_margin / deals;
+    double margin_se = sqrt((pair_margin_sq / deals - margin_mean * margin_mean) / (deals - 1 > 0 ? deals - 1 : 1));
+    double game_var = game_sq / games - mean * mean; // Spread of a single game, what unpaired games would be up against
+    double game_margin_var = game_margin_sq / games - (game_margin / games) * (game_margin / games);
+    double pair_var = se * se * deals;
+    double margin_var = margin_se * margin_se * deals;
+    
+    printf("\nBot A:           %s\n", bots[0].name);
+    printf("Bot B:           %s\n", bots[1].name);
+    printf("Deals played:    %ld (%ld games, every deal with both seat orders)\n", deals, games);
+    printf("A wins:          %.2f%% (B %.2f%%, ties %.2f%%)\n", 100.0 * wins[1] / games, 100.0 * wins[2] / games, 100.0 * wins[0] / games);
+    printf("Win diff:        %+.4f per game, %.1f%% interval %+.4f to %+.4f\n", mean, 100 * (1 - alpha), mean - z * se, mean + z * se);
+    printf("Book margin:     %+.3f per game, %.1f%% interval %+.3f to %+.3f\n", margin_mean, 100 * (1 - alpha),
+           margin_mean - z * margin_se, margin_mean + z * margin_se);
+    if (pair_var > 0) {
+        printf("Pairing gain:    %.1fx fewer games than unpaired ones for the same win diff interval (%.1fx for the book margin)\n",
+               game_var / (2 * pair_var), (margin_var > 0) ? game_margin_var / (2 * margin_var) : 0.0);
+    }
+    if (decided) {
+        printf("Verdict:         %s is stronger (alpha %g over %d looks)\n", bots[(mean > 0) ? 0 : 1].name, alpha, num_looks);
+    } else {
+        printf("Verdict:         no significant difference after %ld deals (alpha %g)\n", deals, alpha);
+    }
+    printf("Seed:            %llu\n", (unsigned long long)seed);
+    
+    free(threads);
+    free(c.outcome);
+    free(c.margin);
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * compare_worker(): Comparison thread. Plays every num_threads-th game *
+ *      of the deals of a look starting at its own index, and records   *
+ *      A's result and book margin in each.                             *
+ ************************************************************************/
+void* compare_worker(void *arg) {
+    
+    compare_thread *t = (compare_thread*)arg;
+    comparison *c = t->c;
+    game g;
+    
+    game_init(&g, NULL);
+    for (uint32_t k = (uint32_t)t->index; k < 2 * c->num_deals; k += (uint32_t)c->num_threads) {
+        int seat_a = (k % 2 == 0) ? PLAYER_ONE : PLAYER_TWO; // A sits in seat 1 of the first game of a deal
+        game_seed(&g, c->seed, c->first_deal + k / 2);
+        int winner = play_silent_game(&g, c->seats[k % 2], NULL);
+        c->outcome[k] = (int8_t)((winner == 0) ? 0 : (winner == seat_a) ? 1 : -1);
+        c->margin[k] = (int8_t)(g.score[seat_a - 1] - g.score[2 - seat_a]);
+    }
+    game_free(&g);
+    return NULL;
+    
+}
+
+
+/************************************************************************
+ * normal_quantile(): Function that returns the x with P(Z < x) = p for *
+ *      a standard normal Z, by bisection on erfc().                    *
+ ************************************************************************/
+double normal_quantile(double p) {
+    
+    double lo = -40, hi = 40;
+    
+    for (int i = 0; i < 100; i++) {
+        double mid = (lo + hi) / 2;
+        if (0.5 * erfc(-mid / sqrt(2)) < p) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo + hi) / 2;
+    
+}
+
+
+/************************************************************************
+ * add_result(): Function that appends the outcome of a finished game   *
+ *      as the next row of a Result Block.                              *
+ ************************************************************************/
+void add_result(result_block *block, const game *g, int winner) {
+    
+    int row = block->num_rows++;
+    
+    block->seed[row] = g->seed;
+    block->game_index[row] = g->id;
+    block->turns[row] = (uint16_t)g->turn_count;
+    block->fish[row] = (uint16_t)g->fish_count;
+    block->forced_swaps[row] = (uint16_t)g->forced_swaps;
+    block->first_book[row] = (g->first_book_turn < 0) ? NO_BOOK : (uint16_t)g->first_book_turn;
+    block->winner[row] = (uint8_t)winner;
+    block->score1[row] = (uint8_t)g->score[0];
+    block->score2[row] = (uint8_t)g->score[1];
+    
+}
+
+
+/************************************************************************
+ * write_result_block(): Function that writes the rows collected in a   *
+ *      Result Block to the results file as one block, column by column *
+ *      and empties it. The lock keeps blocks of different workers from *
+ *      interleaving.                                                   *
+ ************************************************************************/
+void write_result_block(result_file *results, result_block *block) {
+    
+    size_t n = (size_t)block->num_rows;
+    size_t data_size = n * RESULT_ROW_BYTES;
+    size_t padding = (8 - data_size % 8) % 8;
+    const uint64_t zero = 0;
+    result_header header;
+    uint32_t crc = 0;
+    
+    if (n == 0) {
+        return;
+    }
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = RESULT_MAGIC;
+    header.version = RESULT_VERSION;
+    header.header_size = sizeof(result_header);
+    header.num_rows = (uint32_t)n;
+    header.block_size = (uint32_t)(sizeof(result_header) + data_size + padding);
+    header.run_seed = results->run_seed;
+    header.num_games = results->num_games;
+    header.shard_index = results->shard_index;
+    header.num_shards = results->num_shards;
+    
+    crc = crc32_update(crc, &header, sizeof(header));
+    crc = crc32_update(crc, block->seed, n * sizeof(uint64_t));
+    crc = crc32_update(crc, block->game_index, n * sizeof(uint32_t));
+    crc = crc32_update(crc, block->turns, n * sizeof(uint16_t));
+    crc = crc32_update(crc, block->fish, n * sizeof(uint16_t));
+    crc = crc32_update(crc, block->forced_swaps, n * sizeof(uint16_t));
+    crc = crc32_update(crc, block->first_book, n * sizeof(uint16_t));
+    crc = crc32_update(crc, block->winner, n);
+    crc = crc32_update(crc, block->score1, n);
+    crc = crc32_update(crc, block->score2, n);
+    crc = crc32_update(crc, &zero, padding);
+    header.checksum = crc;
+    
+    pthread_mutex_lock(&results->lock);
+    fwrite(&header, sizeof(header), 1, results->file);
+    fwrite(block->seed, sizeof(uint64_t), n, results->file);
+    fwrite(block->game_index, sizeof(uint32_t), n, results->file);
+    fwrite(block->turns, sizeof(uint16_t), n, results->file);
+    fwrite(block->fish, sizeof(uint16_t), n, results->file);
+    fwrite(block->forced_swaps, sizeof(uint16_t), n, results->file);
+    fwrite(block->first_book, sizeof(uint16_t), n, results->file);
+    fwrite(block->winner, sizeof(uint8_t), n, results->file);
+    fwrite(block->score1, sizeof(uint8_t), n, results->file);
+    fwrite(block->score2, sizeof(uint8_t), n, results->file);
+    fwrite(&zero, 1, padding, results->file);
+    pthread_mutex_unlock(&results->lock);
+    
+    block->num_rows = 0;
+    
+}
+
+
+/************************************************************************
+ * summarize_results(): Function that maps every results file named on  *
+ *      the command line into memory, walks its blocks reading the      *
+ *      columns in place, and prints a summary of all the games. This   *
+ *      is also how the shards of a run are merged: every block is      *
+ *      checked against its checksum, and each run is reported missing  *
+ *      or duplicated games so a merge can be trusted to match the      *
+ *      single process run. Returns 1 if anything did not check out.    *
+ ************************************************************************/
+int summarize_results(int argc, char *argv[]) {
+    
+    uint64_t games = 0, wins[3] = {0, 0, 0};
+    uint64_t turns = 0, fish = 0, forced_swaps = 0, score1 = 0, score2 = 0;
+    uint64_t first_book = 0, games_with_book = 0;
+    int min_turns = -1, max_turns = 0;
+    result_run *runs = NULL;
+    int num_runs = 0;
+    int status = 0;
+    
+    for (int f = 2; f < argc; f++) {
+        
+        int fd = open(argv[f], O_RDONLY);
+        struct stat info;
+        const uint8_t *data;
+        size_t offset = 0;
+        
+        if (fd < 0 || fstat(fd, &info) < 0) {
+            printf("ERROR: Could not open %s\n", argv[f]);
+            return 1;
+        }
+        if (info.st_size == 0) {
+            close(fd);
+            continue;
+        }
+        data = (const uint8_t*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            printf("ERROR: Could not map %s\n", argv[f]);
+            return 1;
+        }
+        
+        while (offset + sizeof(result_header) <= (size_t)info.st_size) {
+            const result_header *header = (const result_header*)(data + offset);
+            
+            // Nothing in the header is used until the sizes are known to fit the block and the file
+            if (header->magic != RESULT_MAGIC || header->version != RESULT_VERSION
+                || header->header_size < sizeof(result_header) || header->header_size % 8 != 0
+                || header->block_size < header->header_size || header->block_size % 8 != 0
+                || header->block_size > (size_t)info.st_size - offset
+                || (uint64_t)header->num_rows * RESULT_ROW_BYTES > header->block_size - header->header_size
+                || header->num_shards == 0 || header->shard_index >= header->num_shards
+                || header->num_rows > header->num_games) {
+                printf("ERROR: %s is damaged at byte %zu\n", argv[f], offset);
+                munmap((void*)data, info.st_size);
+                return 1;
+            }
+            
+            result_header unsigned_header = *header;
+            unsigned_header.checksum = 0;
+            uint32_t crc = crc32_update(0, &unsigned_header, sizeof(result_header));
+            crc = crc32_update(crc, data + offset + sizeof(result_header), header->block_size - sizeof(result_header));
+            if (crc != header->checksum) {
+                printf("ERROR: %s fails its checksum at byte %zu, block skipped\n", argv[f], offset);
+                status = 1;
+                offset += header->block_size;
+                continue;
+            }
+            
+            // Columns follow the header in the order documented at result_block
+            size_t n = header->num_rows;
+            const uint8_t *column = data + offset + header->header_size;
+            const uint32_t *index_col = (const uint32_t*)(column + n * sizeof(uint64_t));
+            column += n * (sizeof(uint64_t) + sizeof(uint32_t)); // seed, game_index
+            const uint16_t *turns_col = (const uint16_t*)column;
+            const uint16_t *fish_col = turns_col + n;
+            const uint16_t *swaps_col = fish_col + n;
+            const uint16_t *book_col = swaps_col + n;
+            const uint8_t *winner_col = (const uint8_t*)(book_col + n);
+            const uint8_t *score1_col = winner_col + n;
+            const uint8_t *score2_col = score1_col + n;
+            
+            size_t bad = 0;
+            while (bad < n && winner_col[bad] <= PLAYER_TWO) {
+                bad++;
+            }
+            if (bad < n) {
+                printf("ERROR: %s has a game with no valid winner at byte %zu, block skipped\n", argv[f], offset);
+                status = 1;
+                offset += header->block_size;
+                continue;
+            }
+            
+            result_run *run = find_result_run(&runs, &num_runs, header);
+            size_t out_of_range = 0;
+            for (size_t i = 0; i < n; i++) {
+                uint32_t idx = index_col[i];
+                if (idx >= run->num_games) {
+                    out_of_range++; // Left out of every total, it cannot be told missing or duplicated
+                    continue;
+                }
+                if (run->seen[idx / 8] & (1 << (idx % 8))) {
+                    run->duplicates++;
+                }
+                run->seen[idx / 8] |= (uint8_t)(1 << (idx % 8));
+                run->found++;
+                
+                games++;
+                wins[winner_col[i]]++;
+                turns += turns_col[i];
+                fish += fish_col[i];
+                forced_swaps += swaps_col[i];
+                score1 += score1_col[i];
+                score2 += score2_col[i];
+                if (book_col[i] != NO_BOOK) {
+                    first_book += book_col[i];
+                    games_with_book++;
+                }
+                if (min_turns < 0 || turns_col[i] < min_turns) {
+                    min_turns = turns_col[i];
+                }
+                if (turns_col[i] > max_turns) {
+                    max_turns = turns_col[i];
+                }
+            }
+            if (out_of_range > 0) {
+                printf("ERROR: %s has %zu games past the %u of their run at byte %zu, left out\n", argv[f], out_of_range, run->num_games, offset);
+                status = 1;
+            }
+            offset += header->block_size;
+        }
+        munmap((void*)data, info.st_size);
+    }
+    
+    if (games == 0) {
+        printf("No games found\n");
+        for (int r = 0; r < num_runs; r++) {
+            free(runs[r].seen);
+        }
+        free(runs);
+        return status;
+    }
+    printf("Games:              %llu\n", (unsigned long long)games);
+    printf("Player 1 wins:      %llu (%.2f%%)\n", (unsigned long long)wins[PLAYER_ONE], 100.0 * wins[PLAYER_ONE] / games);
+    printf("Player 2 wins:      %llu (%.2f%%)\n", (unsigned long long)wins[PLAYER_TWO], 100.0 * wins[PLAYER_TWO] / games);
+    printf("Ties:               %llu (%.2f%%)\n", (unsigned long long)wins[0], 100.0 * wins[0] / games);
+    printf("Average score:      %.3f - %.3f\n", (double)score1 / games, (double)score2 / games);
+    printf("Turns per game:     %.2f (min %d, max %d)\n", (double)turns / games, min_turns, max_turns);
+    printf("Go fish per game:   %.2f\n", (double)fish / games);
+    printf("Forced swaps/game:  %.3f\n", (double)forced_swaps / games);
+    if (games_with_book > 0) {
+        printf("First book on turn: %.2f\n", (double)first_book / games_with_book);
+    }
+    
+    for (int r = 0; r < num_runs; r++) {
+        result_run *run = &runs[r];
+        uint64_t missing = (uint64_t)run->num_games - (run->found - run->duplicates);
+        
+        printf("Run seed %llu:      %llu of %u games", (unsigned long long)run->seed, (unsigned long long)(run->found - run->duplicates), run->num_games);
+        if (missing > 0 || run->duplicates > 0) {
+            printf(" (%llu missing, %llu duplicated)", (unsigned long long)missing, (unsigned long long)run->duplicates);
+            status = 1;
+        }
+        printf("\n");
+        free(run->seen);
+    }
+    free(runs);
+    return status;
+    
+}
+
+
+/************************************************************************
+ * find_result_run(): Function that returns the Result Run a block      *
+ *      belongs to, adding it to runs the first time it is seen.        *
+ ************************************************************************/
+result_run* find_result_run(result_run **runs, int *num_runs, const result_header *header) {
+    
+    for (int r = 0; r < *num_runs; r++) {
+        if ((*runs)[r].seed == header->run_seed && (*runs)[r].num_games == header->num_games) {
+            return &(*runs)[r];
+        }
+    }
+    
+    *runs = (result_run*)realloc(*runs, (*num_runs + 1) * sizeof(result_run));
+    result_run *run = &(*runs)[(*num_runs)++];
+    run->seed = header->run_seed;
+    run->num_games = header->num_games;
+    run->seen = (uint8_t*)calloc(header->num_games / 8 + 1, 1);
+    run->found = 0;
+    run->duplicates = 0;
+    return run;
+    
+}
+
+
+/************************************************************************
+ * crc32_update(): Function that extends a CRC-32 (the zlib polynomial) *
+ *      over len more bytes. Start from 0.                              *
+ ************************************************************************/
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+    
+    static pthread_once_t once = PTHREAD_ONCE_INIT; // Batch workers checksum their blocks concurrently
+    const uint8_t *p = (const uint8_t*)data;
+    
+    pthread_once(&once, crc32_init);
+    
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc32_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+    
+}
+
+
+/************************************************************************
+ * crc32_init(): Function that fills in the byte-at-a-time CRC-32 table.*
+ ************************************************************************/
+void crc32_init(void) {
+    
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crc32_table[i] = c;
+    }
+    
+}
+
+
+/************************************************************************
+ * extract_features(): Function that turns the event logs of batch runs *
+ *      into training tensors, as in ./main --features OUT LOG... Every *
+ *      ask in the logs is a decision point: the asking player's view   *
+ *      of the game just before it (see feature_row()) becomes a row of *
+ *      the feature tensor and the rank asked for, with the result of   *
+ *      the game, a row of the label tensor. The logs are mapped and    *
+ *      replayed a game at a time (events of different games may be     *
+ *      interleaved), and the rows of each game are written together    *
+ *      into the mapped output once its winner is logged. Games missing *
+ *      their winner (cut short or with dropped events) are skipped.    *
+ ************************************************************************/
+int extract_features(int argc, char *argv[]) {
+    
+    const char *out_path = argv[2];
+    int use_float = 0;
+    int num_logs = 0;
+    uint64_t max_rows = 0;
+    struct stat info;
+    
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--float") == 0) {
+            use_float = 1;
+        } else if (stat(argv[i], &info) == 0) {
+            max_rows += (uint64_t)info.st_size / sizeof(game_event); // Every event could be an ask
+            num_logs++;
+        } else {
+            printf("ERROR: Could not open %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (num_logs == 0) {
+        printf("Usage: %s --features OUT_FILE LOG_FILE... [--float]\n", argv[0]);
+        return 1;
+    }
+    
+    // Room for every event to be a decision point, cut down to the real size at the end
+    size_t row_size = use_float ? FEATURE_COLUMNS * sizeof(float) : FEATURE_COLUMNS;
+    size_t size = sizeof(feature_header) + max_rows * (row_size + sizeof(feature_label));
+    int fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)size) < 0) {
+        printf("ERROR: Could not create %s\n", out_path);
+        return 1;
+    }
+    uint8_t *map = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        printf("ERROR: Could not map %s\n", out_path);
+        close(fd);
+        return 1;
+    }
+    uint8_t *features = map + sizeof(feature_header);
+    feature_label *labels = (feature_label*)(features + max_rows * row_size);
+    
+    uint32_t mask = 1023; // Open addressing table of the games being replayed, doubled as needed
+    uint32_t live = 0;
+    feature_game *games = (feature_game*)calloc(mask + 1, sizeof(feature_game));
+    uint64_t num_rows = 0, num_games = 0, skipped = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--float") == 0) {
+            continue;
+        }
+        int log_fd = open(argv[i], O_RDONLY);
+        if (log_fd < 0 || fstat(log_fd, &info) < 0) {
+            printf("ERROR: Could not open %s\n", argv[i]);
+            return 1;
+        }
+        size_t num_events = (size_t)info.st_size / sizeof(game_event);
+        const game_event *events = NULL;
+        if (num_events > 0) {
+            events = (const game_event*)mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, log_fd, 0);
+        }
+        close(log_fd);
+        if (events == MAP_FAILED) {
+            printf("ERROR: Could not map %s\n", argv[i]);
+            return 1;
+        }
+        
+        for (size_t j = 0; j < num_events; j++) {
+            const game_event *e = &events[j];
+            int p = e->player - 1;
+            int r = e->rank - 1;
+            
+            if (e->type == EVENT_DEAL && live * 2 > mask) {
+                // Grow before inserting so probes stay short
+                feature_game *old = games;
+                uint32_t old_mask = mask;
+                mask = mask * 2 + 1;
+                games = (feature_game*)calloc(mask + 1, sizeof(feature_game));
+                for (uint32_t k = 0; k <= old_mask; k++) {
+                    if (old[k].in_use) {
+                        *find_feature_game(games, mask, old[k].id, 1) = old[k];
+                    }
+                }
+                free(old);
+            }
+            feature_game *f = find_feature_game(games, mask, e->game_id, e->type == EVENT_DEAL);
+            if (f == NULL || (e->type != EVENT_WINNER && (p < 0 || p > 1 || r >= NUM_RANKS))) {
+                continue; // Its deal was not logged, nothing to replay it from
+            }
+            if (f->in_use == 0) {
+                f->in_use = 1;
+                f->id = e->game_id;
+                live++;
+            }
+            
+            switch (e->type) {
+                case EVENT_DEAL:
+                    f->hand[p][r]++;
+                    break;
+                case EVENT_ASK:
+                    // Decision point: what the player could see, then what they chose
+                    if (f->num_rows == f->cap_rows) {
+                        f->cap_rows = (f->cap_rows == 0) ? 64 : f->cap_rows * 2;
+                        f->rows = (uint8_t*)realloc(f->rows, (size_t)f->cap_rows * FEATURE_COLUMNS);
+                        f->labels = (feature_label*)realloc(f->labels, f->cap_rows * sizeof(feature_label));
+                    }
+                    feature_row(f, p + 1, e->deck, e->turn, &f->rows[(size_t)f->num_rows * FEATURE_COLUMNS]);
+                    f->labels[f->num_rows].game_id = e->game_id;
+                    f->labels[f->num_rows].turn = e->turn;
+                    f->labels[f->num_rows].ask = e->rank;
+                    f->labels[f->num_rows].outcome = (uint8_t)p; // Asking player until the winner is known
+                    f->num_rows++;
+                    f->last_ask[p] = e->rank;
+                    if (f->known[p][r] == 0) {
+                        f->known[p][r] = 1;
+                    }
+                    break;
+                case EVENT_TRANSFER:
+                    f->hand[p][r] += e->count;
+                    f->hand[1 - p][r] = 0;
+                    f->known[p][r] += e->count;
+                    f->known[1 - p][r] = 0;
+                    break;
+                case EVENT_FISH:
+                case EVENT_DRAW:
+                    if (e->rank != 0) {
+                        f->hand[p][r]++;
+                    }
+                    break;
+                case EVENT_BOOK:
+                    f->hand[p][r] = 0;
+                    f->known[p][r] = 0;
+                    f->booked[r] = e->player;
+                    f->score[p] = e->count;
+                    break;
+                case EVENT_WINNER:
+                    // Label every decision with how the game went for the player who made it
+                    for (int k = 0; k < f->num_rows; k++) {
+                        int player = f->labels[k].outcome + 1;
+                        f->labels[k].outcome = (e->player == 0) ? 1 : (e->player == player) ? 2 : 0;
+                        if (use_float) {
+                            feature_floats(&f->rows[(size_t)k * FEATURE_COLUMNS], (float*)(features + (num_rows + k) * row_size));
+                        }
+                    }
+                    if (!use_float) {
+                        memcpy(features + num_rows * row_size, f->rows, (size_t)f->num_rows * FEATURE_COLUMNS);
+                    }
+                    memcpy(&labels[num_rows], f->labels, f->num_rows * sizeof(feature_label));
+                    num_rows += f->num_rows;
+                    num_games++;
+                    drop_feature_game(games, mask, f);
+                    live--;
+                    break;
+            }
+        }
+        
+        // Games of this log that never finished, ids start over in the next log
+        for (uint32_t k = 0; k <= mask; k++) {
+            if (games[k].in_use) {
+                free(games[k].rows);
+                free(games[k].labels);
+                skipped++;
+            }
+        }
+        memset(games, 0, (mask + 1) * sizeof(feature_game));
+        live = 0;
+        if (events != NULL) {
+            munmap((void*)events, num_events * sizeof(game_event));
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(games);
+    
+    // Close the gap left between the two tensors and trim the file to what was written
+    feature_header *header = (feature_header*)map;
+    memset(header, 0, sizeof(feature_header));
+    header->magic = FEATURE_MAGIC;
+    header->version = FEATURE_VERSION;
+    header->header_size = sizeof(feature_header);
+    header->num_rows = num_rows;
+    header->num_features = FEATURE_COLUMNS;
+    header->dtype = use_float ? FEATURE_F32 : FEATURE_U8;
+    header->label_size = sizeof(feature_label);
+    header->label_offset = sizeof(feature_header) + num_rows * row_size;
+    memmove(map + header->label_offset, labels, num_rows * sizeof(feature_label));
+    munmap(map, size);
+    size = sizeof(feature_header) + num_rows * (row_size + sizeof(feature_label));
+    int ok = ftruncate(fd, (off_t)size) == 0;
+    close(fd);
+    if (!ok) {
+        printf("ERROR: Could not write %s\n", out_path);
+        return 1;
+    }
+    
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%llu decision points from %llu games in %.3f sec (%.1f million per second)\n", (unsigned long long)num_rows,
+           (unsigned long long)num_games, seconds, (seconds > 0) ? num_rows / seconds / 1e6 : 0.0);
+    if (skipped > 0) {
+        printf("%llu games skipped, their winner was never logged (use --log-policy block)\n", (unsigned long long)skipped);
+    }
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * find_feature_game(): Function that looks game id up in the open      *
+ *      addressing table of games being replayed (mask + 1 slots, a     *
+ *      power of two). Returns the empty slot it belongs in when create *
+ *      is set and it is not there yet, otherwise NULL.                 *
+ ************************************************************************/
+feature_game* find_feature_game(feature_game *games, uint32_t mask, uint32_t id, int create) {
+    
+    for (uint32_t k = (id * 0x9E3779B1u) & mask; ; k = (k + 1) & mask) {
+        if (!games[k].in_use) {
+            return create ? &games[k] : NULL;
+        } else if (games[k].id == id) {
+            return &games[k];
+        }
+    }
+    
+}
+
+
+/************************************************************************
+ * drop_feature_game(): Function that frees a finished game and removes *
+ *      it from the table, shifting back any game further along its     *
+ *      probe sequence so lookups never stop short at the hole.         *
+ ************************************************************************/
+void drop_feature_game(feature_game *games, uint32_t mask, feature_game *f) {
+    
+    uint32_t hole = (uint32_t)(f - games);
+    
+    free(f->rows);
+    free(f->labels);
+    memset(f, 0, sizeof(feature_game));
+    for (uint32_t k = (hole + 1) & mask; games[k].in_use; k = (k + 1) & mask) {
+        uint32_t home = (games[k].id * 0x9E3779B1u) & mask;
+        // Move it into the hole unless its home lies cyclically between the hole and where it is
+        if (((k - home) & mask) >= ((k - hole) & mask)) {
+            games[hole] = games[k];
+            memset(&games[k], 0, sizeof(feature_game));
+            hole = k;
+        }
+    }
+    
+}
+
+
+/************************************************************************
+ * feature_row(): Function that writes what player sees of a game being *
+ *      replayed into a row of FEATURE_COLUMNS bytes, in five groups of *
+ *      16 (slot rank - 1 in the first four, 13 ranks used):            *
+ *        0  cards of each rank in the player's hand                    *
+ *        16 cards of each rank the opponent is known to hold           *
+ *        32 rank the opponent asked for last, one-hot                  *
+ *        48 books, 1 where the player completed it, 2 the opponent     *
+ *        64 deck size, own score, opponent score, own hand size,       *
+ *           opponent hand size, own last ask, turn (capped at 255),    *
+ *           then zeros                                                 *
+ ************************************************************************/
+void feature_row(const feature_game *f, int player, int deck, int turn, uint8_t row[]) {
+    
+    int p = player - 1;
+    int opp = 1 - p;
+    uint8_t *scalars = &row[64];
+    
+#ifdef __SSE2__
+    const __m128i slots = _mm_setr_epi8(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16);
+    const __m128i ones = _mm_set1_epi8(1);
+    __m128i own = _mm_loadu_si128((const __m128i*)f->hand[p]);
+    __m128i theirs = _mm_loadu_si128((const __m128i*)f->hand[opp]);
+    __m128i booked = _mm_loadu_si128((const __m128i*)f->booked);
+    _mm_storeu_si128((__m128i*)&row[0], own);
+    _mm_storeu_si128((__m128i*)&row[16], _mm_loadu_si128((const __m128i*)f->known[opp]));
+    _mm_storeu_si128((__m128i*)&row[32], _mm_and_si128(_mm_cmpeq_epi8(_mm_set1_epi8((char)f->last_ask[opp]), slots), ones));
+    _mm_storeu_si128((__m128i*)&row[48], _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi8(booked, _mm_set1_epi8((char)player)), ones),
+                                                     _mm_and_si128(_mm_cmpeq_epi8(booked, _mm_set1_epi8((char)(opp + 1))), _mm_set1_epi8(2))));
+    __m128i own_sums = _mm_sad_epu8(own, _mm_setzero_si128()); // Sum of slots 0-7 and of slots 8-15
+    __m128i opp_sums = _mm_sad_epu8(theirs, _mm_setzero_si128());
+    _mm_storeu_si128((__m128i*)scalars, _mm_setzero_si128());
+    scalars[3] = (uint8_t)(_mm_extract_epi16(own_sums, 0) + _mm_extract_epi16(own_sums, 4));
+    scalars[4] = (uint8_t)(_mm_extract_epi16(opp_sums, 0) + _mm_extract_epi16(opp_sums, 4));
+#else
+    memset(&row[0], 0, FEATURE_COLUMNS);
+    for (int k = 0; k < 16; k++) {
+        row[k] = f->hand[p][k];
+        row[16 + k] = f->known[opp][k];
+        row[32 + k] = (f->last_ask[opp] == k + 1);
+        row[48 + k] = (f->booked[k] == player) ? 1 : (f->booked[k] == opp + 1) ? 2 : 0;
+        scalars[3] += f->hand[p][k];
+        scalars[4] += f->hand[opp][k];
+    }
+#endif
+    scalars[0] = (uint8_t)deck;
+    scalars[1] = f->score[p];
+    scalars[2] = f->score[opp];
+    scalars[5] = f->last_ask[p];
+    scalars[6] = (uint8_t)((turn > 255) ? 255 : turn);
+    
+}
+
+
+/************************************************************************
+ * feature_floats(): Function that widens a row of byte features to the *
+ *      float32 row written by --features --float.                      *
+ ************************************************************************/
+void feature_floats(const uint8_t row[], float out[]) {
+    
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (int k = 0; k < FEATURE_COLUMNS; k += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)&row[k]);
+        __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+        _mm_storeu_ps(&out[k], _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_ps(&out[k + 4], _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_ps(&out[k + 8], _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_ps(&out[k + 12], _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+    }
+#else
+    for (int k = 0; k < FEATURE_COLUMNS; k++) {
+        out[k] = row[k];
+    }
+#endif
+    
+}
+
+
+/************************************************************************
+ * start_hint_engine(): Function that starts the hint worker thread.    *
+ *      It sits idle until update_hint() hands it a position.           *
+ ************************************************************************/
+hint_engine* start_hint_engine(uint64_t seed, eval_cache *cache) {
+    
+    hint_engine *h = (hint_engine*)calloc(1, sizeof(hint_engine));
+    
+    rng_init(&h->rng, seed, 0, STREAM_HINT);
+    h->cache = cache;
+    pthread_mutex_init(&h->lock, NULL);
+    pthread_cond_init(&h->wake, NULL);
+    pthread_create(&h->thread, NULL, hint_worker, h);
+    return h;
+    
+}
+
+
+/************************************************************************
+ * stop_hint_engine(): Function that tells the hint worker to quit,     *
+ *      waits for it and frees the engine. The cache is left open.      *
+ ************************************************************************/
+void stop_hint_engine(hint_engine *h) {
+    
+    pthread_mutex_lock(&h->lock);
+    save_hint(h);
+    h->quit = 1;
+    pthread_cond_signal(&h->wake);
+    pthread_mutex_unlock(&h->lock);
+    
+    pthread_join(h->thread, NULL);
+    pthread_mutex_destroy(&h->lock);
+    pthread_cond_destroy(&h->wake);
+    free(h);
+    
+}
+
+
+/************************************************************************
+ * update_hint(): Function that hands the hint worker the position the  *
+ *      player whose turn it is is looking at. The estimates start over *
+ *      only when the position actually changed (not after a typo), and *
+ *      pick up from the cached estimate of an equivalent position.     *
+ ************************************************************************/
+void update_hint(hint_engine *h, const game *g) {
+    
+    game_view view;
+    int canon[NUM_RANKS];
+    
+    game_view_fill(g, g->players_turn, &view);
+    
+    pthread_mutex_lock(&h->lock);
+    if (memcmp(&view, &h->view, sizeof(game_view)) != 0) {
+        save_hint(h);
+        h->view = view;
+        h->generation++;
+        h->samples = 0;
+        memset(h->hits, 0, sizeof(h->hits));
+        
+        eval_entry *e = (h->cache != NULL) ? eval_cache_lookup(h->cache, position_key(&view, 0, canon)) : NULL;
+        if (e != NULL) {
+            h->samples = e->samples;
+            for (int i = 0; i < NUM_RANKS; i++) {
+                h->hits[canon[i]] = lroundf(e->value[i] * e->samples);
+            }
+        }
+        pthread_cond_signal(&h->wake);
+    }
+    pthread_mutex_unlock(&h->lock);
+    
+}
+
+
+/************************************************************************
+ * show_hint(): Function that prints the best ask found so far and how  *
+ *      likely it is that the opponent holds that rank. Only reads the  *
+ *      worker's tallies, so the answer is immediate.                   *
+ ************************************************************************/
+void show_hint(hint_engine *h, FILE *out) {
+    
+    int best_rank = 0;
+    long best_hits = -1;
+    long samples;
+    char name[3];
+    
+    pthread_mutex_lock(&h->lock);
+    samples = h->samples;
+    for (int rank = 1; rank <= NUM_RANKS; rank++) {
+        // Only ranks the player possesses can be asked for, ties go to the rank held more often
+        if (h->view.hand[rank] > 0 && (h->hits[rank] > best_hits || (h->hits[rank] == best_hits && h->view.hand[rank] > h->view.hand[best_rank]))) {
+            best_rank = rank;
+            best_hits = h->hits[rank];
+        }
+    }
+    pthread_mutex_unlock(&h->lock);
+    
+    if (best_rank == 0) {
+        fprintf(out, "No hint available yet.\n");
+        return;
+    }
+    
+    if (samples == 0) {
+        fprintf(out, "Hint: ask for %s (still thinking)\n", rank_name(best_rank, name));
+    } else {
+        fprintf(out, "Hint: ask for %s, the opponent holds one in %.1f%% of %ld sampled deals\n", rank_name(best_rank, name), 100.0 * best_hits / samples, samples);
+    }
+    
+}
+
+
+/************************************************************************
+ * hint_worker(): Hint engine thread. Repeatedly deals the cards the    *
+ *      player cannot see (opponent's hand plus the pool) at random,    *
+ *      keeping only deals that agree with what the opponent is known   *
+ *      to hold, and tallies how often the opponent ends up with each   *
+ *      rank. Works in chunks so a new position or quit is noticed      *
+ *      quickly, and goes idle after HINT_MAX_SAMPLES.                  *
+ ************************************************************************/
+void* hint_worker(void *arg) {
+    
+    hint_engine *h = (hint_engine*)arg;
+    game_view view;
+    int generation = 0;
+    int unseen[52]; // Ranks of the cards the player cannot see
+    int num_unseen, held[NUM_RANKS + 1];
+    long hits[NUM_RANKS + 1], samples;
+    
+    pthread_mutex_lock(&h->lock);
+    while (!h->quit) {
+        
+        if (h->generation == generation && (h->samples >= HINT_MAX_SAMPLES || h->view.player == 0)) {
+            // Nothing new to work on
+            pthread_cond_wait(&h->wake, &h->lock);
+            continue;
+        }
+        view = h->view;
+        generation = h->generation;
+        pthread_mutex_unlock(&h->lock);
+        
+        // Every card that is not in the player's hand or in a completed book
+        num_unseen = 0;
+        for (int rank = 1; rank <= NUM_RANKS; rank++) {
+            for (int i = (view.booked[rank] != 0) ? 4 : view.hand[rank]; i < 4; i++) {
+                unseen[num_unseen++] = rank;
+            }
+        }
+        
+        memset(hits, 0, sizeof(hits));
+        samples = 0;
+        for (int n = 0; n < HINT_CHUNK; n++) {
+            // Partial Fisher-Yates: the first opp_cards slots become the opponent's hand
+            memset(held, 0, sizeof(held));
+            for (int i = 0; i < view.opp_cards && i < num_unseen; i++) {
+                int j = i + rand_gen(num_unseen - i, &h->rng);
+                int temp = unseen[i];
+                unseen[i] = unseen[j];
+                unseen[j] = temp;
+                held[unseen[i]]++;
+            }
+            
+            int consistent = 1;
+            for (int rank = 1; rank <= NUM_RANKS; rank++) {
+                if (held[rank] < view.known[rank]) {
+                    consistent = 0;
+                }
+            }
+            if (!consistent) {
+                continue;
+            }
+            
+            samples++;
+            for (int rank = 1; rank <= NUM_RANKS; rank++) {
+                if (held[rank] > 0) {
+                    hits[rank]++;
+                }
+            }
+        }
+        
+        pthread_mutex_lock(&h->lock);
+        if (h->generation == generation) {
+            // Position is still current, fold this chunk into the estimate
+            h->samples += samples;
+            for (int rank = 1; rank <= NUM_RANKS; rank++) {
+                h->hits[rank] += hits[rank];
+            }
+            if (h->samples >= HINT_MAX_SAMPLES) {
+                save_hint(h);
+            }
+        }
+    }
+    pthread_mutex_unlock(&h->lock);
+    return NULL;
+    
+}
+
+
+/************************************************************************
+ * save_hint(): Function that stores the estimate of the current hint   *
+ *      position in the evaluation cache. Caller holds h->lock.         *
+ ************************************************************************/
+void save_hint(hint_engine *h) {
+    
+    int canon[NUM_RANKS];
+    float value[NUM_RANKS];
+    
+    if (h->cache == NULL || h->samples == 0 || h->view.player == 0) {
+        return;
+    }
+    
+    uint64_t key = position_key(&h->view, 0, canon);
+    for (int i = 0; i < NUM_RANKS; i++) {
+        value[i] = (float)h->hits[canon[i]] / h->samples;
+    }
+    eval_cache_store(h->cache, key, (uint32_t)h->samples, value);
+    
+}
+
+
+/************************************************************************
+ * position_key(): Function that hashes a position as seen by one       *
+ *      player so that equivalent positions share a key. Suits are      *
+ *      already gone from a Game View, and ranks only matter through    *
+ *      their counts, so the ranks are sorted by (out of play, cards    *
+ *      held, cards the opponent is known to hold) and the sorted list  *
+ *      is hashed with the hand sizes. canon[i] is set to the rank that *
+ *      ended up in slot i, the order cached values are stored in. The  *
+ *      salt lets callers keep different kinds of evaluation apart and  *
+ *      mix in any other state their evaluation depends on.             *
+ ************************************************************************/
+uint64_t position_key(const game_view *v, uint64_t salt, int canon[]) {
+    
+    int signature[NUM_RANKS + 1];
+    uint64_t key = 0xcbf29ce484222325 ^ salt; // FNV-1a offset basis
+    
+    for (int rank = 1; rank <= NUM_RANKS; rank++) {
+        signature[rank] = (v->booked[rank] != 0) ? 0xFF : v->hand[rank] << 4 | v->known[rank];
+    }
+    
+    // Insertion sort, ties keep rank order so canon is the same for equal positions
+    for (int i = 0; i < NUM_RANKS; i++) {
+        int rank = i + 1;
+        int j = i;
+        while (j > 0 && signature[canon[j - 1]] > signature[rank]) {
+            canon[j] = canon[j - 1];
+            j--;
+        }
+        canon[j] = rank;
+    }
+    
+    for (int i = 0; i < NUM_RANKS; i++) {
+        key = (key ^ (uint64_t)signature[canon[i]]) * 0x100000001b3;
+    }
+    key = (key ^ (uint64_t)v->opp_cards) * 0x100000001b3;
+    key = (key ^ (uint64_t)v->deck_cards) * 0x100000001b3;
+    return (key == 0) ? 1 : key; // 0 marks an empty entry
+    
+}
+
+
+/************************************************************************
+ * open_eval_cache(): Function that opens the evaluation cache saved in *
+ *      the file at path, creating it (or starting it over if it was    *
+ *      written with another layout) when needed. The file is mapped    *
+ *      shared, so every store lands in it. Returns NULL on failure.    *
+ ************************************************************************/
+eval_cache* open_eval_cache(const char *path) {
+    
+    size_t size = sizeof(eval_header) + (size_t)EVAL_CACHE_SETS * sizeof(eval_set);
+    struct stat info;
+    eval_cache *cache;
+    void *map;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    
+    if (fd < 0 || fstat(fd, &info) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    
+    if ((size_t)info.st_size >= sizeof(eval_header)) {
+        eval_header header;
+        if (pread(fd, &header, sizeof(header), 0) == sizeof(header) && header.magic == EVAL_CACHE_MAGIC
+            && header.version == EVAL_CACHE_VERSION && header.set_size == sizeof(eval_set)
+            && (size_t)info.st_size == header.header_size + (size_t)header.num_sets * sizeof(eval_set)) {
+            size = (size_t)info.st_size; // Warm start, keep its geometry
+        } else {
+            info.st_size = 0; // Not ours, start over
+        }
+    }
+    if ((size_t)info.st_size != size && (ftruncate(fd, 0) < 0 || ftruncate(fd, (off_t)size) < 0)) {
+        close(fd);
+        return NULL;
+    }
+    
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    
+    cache = (eval_cache*)calloc(1, sizeof(eval_cache));
+    cache->header = (eval_header*)map;
+    cache->size = size;
+    if (cache->header->magic != EVAL_CACHE_MAGIC) {
+        // Fresh file, all zero: every entry is already empty
+        cache->header->magic = EVAL_CACHE_MAGIC;
+        cache->header->version = EVAL_CACHE_VERSION;
+        cache->header->header_size = sizeof(eval_header);
+        cache->header->num_sets = EVAL_CACHE_SETS;
+        cache->header->set_size = sizeof(eval_set);
+    }
+    cache->sets = (eval_set*)((uint8_t*)map + cache->header->header_size);
+    return cache;
+    
+}
+
+
+/************************************************************************
+ * close_eval_cache(): Function that writes the cache back to its file  *
+ *      and unmaps it.                                                  *
+ ************************************************************************/
+void close_eval_cache(eval_cache *cache) {
+    msync(cache->header, cache->size, MS_SYNC);
+    munmap(cache->header, cache->size);
+    free(cache);
+}
+
+
+/************************************************************************
+ * eval_cache_lookup(): Function that returns the cached evaluation of  *
+ *      key and marks it recently used, or NULL on a miss.              *
+ ************************************************************************/
+eval_entry* eval_cache_lookup(eval_cache *cache, uint64_t key) {
+    
+    eval_set *set = &cache->sets[(key >> 32) % cache->header->num_sets];
+    
+    for (int i = 0; i < EVAL_WAYS; i++) {
+        if (set->entries[i].key == key) {
+            set->entries[i].referenced = 1;
+            cache->hits++;
+            return &set->entries[i];
+        }
+    }
+    cache->misses++;
+    return NULL;
+    
+}
+
+
+/************************************************************************
+ * eval_cache_store(): Function that caches the evaluation of key,      *
+ *      unless an evaluation backed by more samples is cached already.  *
+ *      A new key takes an empty entry of its set if there is one,      *
+ *      otherwise the CLOCK hand evicts the first entry not used since  *
+ *      the hand last passed it.                                        *
+ ************************************************************************/
+void eval_cache_store(eval_cache *cache, uint64_t key, uint32_t samples, const float value[]) {
+    
+    eval_set *set = &cache->sets[(key >> 32) % cache->header->num_sets];
+    eval_entry *e = NULL;
+    
+    for (int i = 0; i < EVAL_WAYS && e == NULL; i++) {
+        if (set->entries[i].key == key) {
+            if (set->entries[i].samples >= samples) {
+                return;
+            }
+            e = &set->entries[i];
+        }
+    }
+    for (int i = 0; i < EVAL_WAYS && e == NULL; i++) {
+        if (set->entries[i].key == 0) {
+            e = &set->entries[i];
+        }
+    }
+    while (e == NULL) {
+        eval_entry *candidate = &set->entries[set->hand];
+        set->hand = (set->hand + 1) % EVAL_WAYS;
+        if (candidate->referenced) {
+            candidate->referenced = 0; // Second chance
+        } else {
+            e = candidate;
+        }
+    }
+    
+    e->key = key;
+    e->samples = samples;
+    e->referenced = 1;
+    memcpy(e->value, value, sizeof(e->value));
+    
+}
+
+
+/************************************************************************
+ * tui_render(): Function that draws the game on an ANSI terminal. The  *
+ *      frame is laid out in a fresh grid and compared with the model   *
+ *      of what the terminal already shows, and only the runs of cells  *
+ *      that changed are written, each after a cursor move, in a single *
+ *      write. The prompt row is always redrawn since the player types  *
+ *      over it.                                                        *
+ ************************************************************************/
+void tui_render(tui *t, const game *g) {
+    
+    char next[TUI_ROWS][TUI_COLS];
+    char frame[TUI_ROWS * (TUI_COLS + 16) + 32];
+    char text[TUI_COLS + 1];
+    char name[3];
+    int len = 0;
+    int player = g->players_turn;
+    
+    memset(next, ' ', sizeof(next));
+    tui_text(next[0], 0, "><(((('>  GO FISH  <')))><");
+    snprintf(text, sizeof(text), "POOL: %2d CARDS     PLAYER 1: %2d BOOKS     PLAYER 2: %2d BOOKS", g->deck_count, g->score[0], g->score[1]);
+    tui_text(next[1], 0, text);
+    if (g->state == GAME_OVER) {
+        tui_text(next[3], 0, "GAME OVER!");
+    } else {
+        snprintf(text, sizeof(text), "PLAYER %d'S HAND:", player);
+        tui_text(next[3], 0, text);
+        
+        // 13 cards to a row, in the order they were picked up so new cards only add cells
+        int n = 0;
+        for (card *temp = g->hand_hl[player - 1]; temp != NULL && n < 26; temp = temp->next, n++) {
+            snprintf(text, sizeof(text), "[%s%c]", rank_name(temp->value, name), toupper((unsigned char)temp->suit[0]));
+            tui_text(next[4 + n / 13], (n % 13) * 6, text);
+        }
+    }
+    tui_text(next[7], 0, t->action);
+    tui_text(next[8], 0, t->message);
+    
+    if (!t->drawn) {
+        len += sprintf(frame + len, "\033[H\033[2J"); // Start from a blank terminal
+        memset(t->screen, ' ', sizeof(t->screen));
+        t->drawn = 1;
+    }
+    for (int row = 0; row < TUI_ROWS; row++) {
+        int col = 0;
+        while (col < TUI_COLS) {
+            if (next[row][col] == t->screen[row][col]) {
+                col++;
+                continue;
+            }
+            // Extend the run over gaps too short to be worth another cursor move
+            int end = col + 1, last = col;
+            while (end < TUI_COLS && end - last <= 6) {
+                if (next[row][end] != t->screen[row][end]) {
+                    last = end;
+                }
+                end++;
+            }
+            len += sprintf(frame + len, "\033[%d;%dH", row + 1, col + 1);
+            memcpy(frame + len, &next[row][col], last + 1 - col);
+            len += last + 1 - col;
+            col = last + 1;
+        }
+    }
+    memcpy(t->screen, next, sizeof(next));
+    
+    text[0] = '\0';
+    if (g->state != GAME_OVER) {
+        snprintf(text, sizeof(text), "PLAYER %d GUESS: ", player);
+    }
+    len += sprintf(frame + len, "\033[%d;1H\033[2K%s", TUI_ROWS - 1, text);
+    fwrite(frame, 1, len, stdout);
+    fflush(stdout);
+    
+}
+
+
+/************************************************************************
+ * tui_guess(): Function that submits a guess typed in the terminal UI  *
+ *      and describes what it did (or why it was refused) for the next  *
+ *      frame, since the game itself prints nothing in this mode.       *
+ ************************************************************************/
+int tui_guess(tui *t, game *g, char *guess) {
+    
+    int player = g->players_turn;
+    int opponent = (player == PLAYER_ONE) ? PLAYER_TWO : PLAYER_ONE;
+    int turn = g->turn_count, fish = g->fish_count, score = g->score[player - 1], swaps = g->forced_swaps;
+    int rank = (validate_guess(guess) == 1) ? convert_guess(guess) : 0;
+    int taken = (rank != 0) ? g->hand_count[opponent - 1][rank] : 0;
+    char name[3];
+    
+    int state = game_submit(g, guess);
+    
+    if (g->turn_count == turn) {
+        strcpy(t->message, (rank == 0) ? "That is not a valid guess. Try again!" : "Oops! You do not possess that card! Try again!");
+        return state;
+    }
+    t->message[0] = '\0';
+    if (g->fish_count != fish) {
+        snprintf(t->action, TUI_COLS, "PLAYER %d ASKED FOR %s'S - GO FISH!", player, rank_name(rank, name));
+    } else {
+        snprintf(t->action, TUI_COLS, "PLAYER %d ASKED FOR %s'S - TOOK %d FROM PLAYER %d", player, rank_name(rank, name), taken, opponent);
+    }
+    if (g->score[player - 1] != score) {
+        strcat(t->action, " - BOOK!");
+    }
+    if (g->forced_swaps != swaps) {
+        strcat(t->action, " - SWITCHING TURNS");
+    }
+    return state;
+    
+}
+
+
+/************************************************************************
+ * tui_text(): Function that writes text into a row of a frame at col,  *
+ *      cut off at the edge of the screen.                              *
+ ************************************************************************/
+void tui_text(char row[], int col, const char *text) {
+    for (int i = 0; text[i] != '\0' && col + i < TUI_COLS; i++) {
+        row[col + i] = text[i];
+    }
+}
+
+
+/************************************************************************
+ * rank_name(): Function that writes the name of a rank (A, 2-10, J, Q, *
+ *      K) into name and returns it.                                    *
+ ************************************************************************/
+const char* rank_name(int rank, char name[3]) {
+    // 10 is the special case since it takes up two spaces
+    if (rank == 10) {
+        strcpy(name, "10");
+    } else {
+        name[0] = convert_rank(rank);
+        name[1] = '\0';
+    }
+    return name;
+}
+
+
+/************************************************************************
+ * write_checkpoint(): Function that saves games (sorted here by id)    *
+ *      into a checkpoint file at path. The file is written under a     *
+ *      temporary name, synced and renamed over path, so path always    *
+ *      holds either the old checkpoint or the complete new one. Returns*
+ *      0 on success, -1 if the file could not be written.              *
+ ************************************************************************/
+int write_checkpoint(const char *path, game_snapshot *games, uint32_t num_games, uint32_t next_index) {
+    
+    checkpoint_header header = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, sizeof(game_snapshot), num_games, next_index};
+    size_t length = strlen(path) + 5;
+    char *temp_path = (char*)malloc(length);
+    FILE *file;
+    int ok;
+    
+    qsort(games, num_games, sizeof(game_snapshot), compare_snapshots);
+    snprintf(temp_path, length, "%s.tmp", path);
+    file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        free(temp_path);
+        return -1;
+    }
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(games, sizeof(game_snapshot), num_games, file) == num_games;
+    ok = (fflush(file) == 0) && ok && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok && rename(temp_path, path) == 0;
+    if (!ok) {
+        unlink(temp_path);
+    }
+    free(temp_path);
+    return ok ? 0 : -1;
+    
+}
+
+
+/************************************************************************
+ * open_checkpoint(): Function that maps the checkpoint file at path.   *
+ *      Only the header is checked here, every snapshot is checked when *
+ *      it is restored. Returns NULL if the file cannot be read or is   *
+ *      not a checkpoint of this layout.                                *
+ ************************************************************************/
+checkpoint* open_checkpoint(const char *path) {
+    
+    struct stat info;
+    checkpoint *c;
+    void *map;
+    int fd = open(path, O_RDONLY);
+    
+    if (fd < 0 || fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(checkpoint_header)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    
+    const checkpoint_header *header = (const checkpoint_header*)map;
+    if (header->magic != CHECKPOINT_MAGIC || header->version != CHECKPOINT_VERSION || header->record_size != sizeof(game_snapshot)
+        || (size_t)info.st_size != sizeof(checkpoint_header) + (size_t)header->num_games * sizeof(game_snapshot)) {
+        munmap(map, (size_t)info.st_size);
+        return NULL;
+    }
+    
+    c = (checkpoint*)malloc(sizeof(checkpoint));
+    c->header = header;
+    c->games = (const game_snapshot*)(header + 1);
+    c->taken = (uint8_t*)calloc(header->num_games + 1, 1);
+    c->size = (size_t)info.st_size;
+    return c;
+    
+}
+
+
+/************************************************************************
+ * close_checkpoint(): Function that unmaps a checkpoint file.          *
+ ************************************************************************/
+void close_checkpoint(checkpoint *c) {
+    munmap((void*)c->header, c->size);
+    free(c->taken);
+    free(c);
+}
+
+
+/************************************************************************
+ * find_snapshot(): Function that binary searches a checkpoint for the  *
+ *      game with the given id. Returns its index or -1.                *
+ ************************************************************************/
+int find_snapshot(const checkpoint *c, uint32_t id) {
+    
+    int lo = 0;
+    int hi = (int)c->header->num_games - 1;
+    
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (c->games[mid].id == id) {
+            return mid;
+        } else if (c->games[mid].id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+    
+}
+
+
+/************************************************************************
+ * compare_snapshots(): qsort() comparison ordering Game Snapshots by   *
+ *      id.                                                             *
+ ************************************************************************/
+int compare_snapshots(const void *a, const void *b) {
+    uint32_t x = ((const game_snapshot*)a)->id;
+    uint32_t y = ((const game_snapshot*)b)->id;
+    return (x > y) - (x < y);
+}
+
+
+/************************************************************************
+ * stop_server(): Signal handler for SIGINT and SIGTERM that wakes the  *
+ *      server up to save its games and exit.                           *
+ ************************************************************************/
+void stop_server(int signum) {
+    char c = (char)signum;
+    ssize_t written = write(server_stop_pipe[1], &c, 1);
+    (void)written; // Pipe already full means the server has been told
+}
+
+
+/************************************************************************
+ * run_server(): Function that hosts any number of games on a single    *
+ *      thread. Every client connecting to the Unix socket at path gets *
+ *      its own game with a shuffled deck. Games never block: the loop  *
+ *      polls every connection and resumes a game only when a complete  *
+ *      guess has arrived for it, so an idle session costs nothing more *
+ *      than its Session Struct.                                        *
+ *                                                                      *
+ *      With a checkpoint file the server survives restarts: SIGINT or  *
+ *      SIGTERM saves every game in progress to it before exiting, and  *
+ *      the next run maps it back in. Each client is told the id of its *
+ *      game and can pick it up again by sending resume ID as its first *
+ *      line after reconnecting.                                        *
+ *                                                                      *
+ *      With a session store (--store) the games in memory are bounded  *
+ *      instead: a session idle for --idle seconds, or the least        *
+ *      recently active ones while the games in memory take more than   *
+ *      --memory-budget, is parked in the store and its client kept as  *
+ *      an Idle Session of 8 bytes. The game comes back the moment the  *
+ *      client sends its next move. Games of clients that hang up, and  *
+ *      every game still in memory when the server stops, are parked as *
+ *      well and can be resumed by id, in this run or the next.         *
+ *                                                                      *
+ * Parameters: path - filesystem path of the Unix socket to listen on   *
+ *             checkpoint_path - checkpoint file, NULL to keep no games *
+ *             st - session store, its path is NULL to keep every game  *
+ *                  in memory                                           *
+ *             opponent - bot playing Player 2, NULL for none           *
+ *             clock - budget of the opponent's decisions (--deadline)  *
+ *                     and their times, printed when the server stops   *
+ ************************************************************************/
+int run_server(const char *path, const char *checkpoint_path, metrics *m, session_store *st, const bot *opponent, move_clock *clock) {
+    
+    int listen_fd = open_server_socket(path);
+    int capacity = 64;
+    session **sessions = (session**)malloc(capacity * sizeof(session*)); // Every client with its game in memory
+    int num_sessions = 0;
+    idle_session *idle = NULL; // Clients whose game is parked in the store
+    int num_idle = 0, cap_idle = 0;
+    int cap_fds = capacity + 2;
+    struct pollfd *fds = (struct pollfd*)malloc(cap_fds * sizeof(struct pollfd));
+    checkpoint *parked = NULL; // Games saved by the last run that nobody has resumed yet
+    
+    // All games print into one shared buffer that is handed off to the client after each resume
+    char *out_buf = NULL;
+    size_t out_len = 0;
+    FILE *out = open_memstream(&out_buf, &out_len);
+    uint64_t seed = (uint64_t)time(NULL); // Every session deals from its own stream of this seed
+    uint32_t num_opened = 0;
+    uint64_t next_sweep = 0; // When to look for sessions to park next
+    int stopped = 0; // Told to stop by a signal rather than failing
+    
+    if (listen_fd < 0 || out == NULL || pipe(server_stop_pipe) < 0) {
+        printf("ERROR: Could not start the server on %s\n", path);
+        return -1;
+    }
+    if (open_store(st) != 0) {
+        printf("ERROR: %s is not a session store file\n", st->path);
+        return -1;
+    }
+    if (start_metrics(m, "server") != 0) {
+        return -1;
+    }
+    engine_counters *counters = metrics_counters(m); // Every game is played on this one thread
+    if (checkpoint_path != NULL && access(checkpoint_path, F_OK) == 0) {
+        parked = open_checkpoint(checkpoint_path);
+        if (parked == NULL) {
+            // Refuse to start rather than overwrite games that could not be read
+            printf("ERROR: %s is not a checkpoint file\n", checkpoint_path);
+            return -1;
+        }
+        num_opened = parked->header->next_index;
+        printf("Restored %u games from %s\n", parked->header->num_games, checkpoint_path);
+    }
+    if (st->header != NULL) {
+        if (st->header->next_index > num_opened) {
+            num_opened = st->header->next_index;
+        }
+        printf("Session store %s holds %u parked games\n", st->path, st->header->parked);
+    }
+    fcntl(server_stop_pipe[1], F_SETFL, O_NONBLOCK);
+    signal(SIGPIPE, SIG_IGN); // A client hanging up is handled where write() fails
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+    printf("Serving Go Fish on %s\n", path);
+    
+    while (1) {
+        
+        if (num_sessions + num_idle + 2 > cap_fds) {
+            cap_fds = (num_sessions + num_idle + 2) * 2;
+            fds = (struct pollfd*)realloc(fds, cap_fds * sizeof(struct pollfd));
+        }
+        
+        // Listening socket is always slot 0, sessions follow in the same order, then the idle ones
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < num_sessions; i++) {
+            fds[i + 1].fd = sessions[i]->fd;
+            fds[i + 1].events = (sessions[i]->pending_len > 0) ? POLLOUT : POLLIN;
+            fds[i + 1].revents = 0;
+        }
+        struct pollfd *idle_fds = fds + num_sessions + 1;
+        for (int i = 0; i < num_idle; i++) {
+            idle_fds[i].fd = idle[i].fd;
+            idle_fds[i].events = POLLIN;
+            idle_fds[i].revents = 0;
+        }
+        int stop_slot = num_sessions + num_idle + 1; // Stop requests come last
+        fds[stop_slot].fd = server_stop_pipe[0];
+        fds[stop_slot].events = POLLIN;
+        
+        // Wake up now and then to park sessions that went idle, when there is a store to park them in
+        if (poll(fds, stop_slot + 1, (st->header != NULL) ? (int)(STORE_SWEEP_NS / 1000000) : -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[stop_slot].revents & POLLIN) {
+            stopped = 1;
+            break;
+        }
+        
+        // Service the sessions first so a new connection cannot shift the slots
+        for (int i = num_sessions - 1; i >= 0; i--) {
+            session *s = sessions[i];
+            
+            if (fds[i + 1].revents & POLLOUT) {
+                flush_session(s, NULL, NULL, NULL);
+            } else if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                s->g.out = out;
+                read_session(s, parked, st);
+                flush_session(s, out, &out_buf, &out_len);
+            }
+            
+            // Drop clients that hung up and finished games whose output has been delivered
+            if (s->fd < 0 || (s->g.state == GAME_OVER && s->pending_len == 0)) {
+                if (s->fd < 0 && st->header != NULL && s->g.state == GAME_AWAIT_GUESS) {
+                    store_park(st, &s->g); // Kept for a resume, hanging up is how most games end up parked
+                }
+                close_session(s);
+                sessions[i] = sessions[num_sessions - 1];
+                num_sessions--;
+            }
+        }
+        
+        // An idle client that sent something gets its game back, one that hung up leaves it parked
+        int num_woken = 0;
+        for (int i = num_idle - 1; i >= 0; i--) {
+            if (!(idle_fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            char c;
+            ssize_t peeked = recv(idle[i].fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+            session *s = NULL;
+            if (peeked > 0 || (peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))) {
+                s = wake_session(&idle[i], st, out, counters, opponent, clock);
+            }
+            if (s == NULL) {
+                close(idle[i].fd);
+            } else {
+                if (num_sessions == capacity) {
+                    capacity = capacity * 2;
+                    sessions = (session**)realloc(sessions, capacity * sizeof(session*));
+                }
+                sessions[num_sessions++] = s;
+                num_woken++;
+            }
+            idle[i] = idle[--num_idle];
+        }
+        for (int i = num_sessions - num_woken; i < num_sessions; i++) {
+            session *s = sessions[i];
+            read_session(s, parked, st);
+            flush_session(s, out, &out_buf, &out_len);
+            if (s->fd < 0 || (s->g.state == GAME_OVER && s->pending_len == 0)) {
+                if (s->fd < 0 && s->g.state == GAME_AWAIT_GUESS) {
+                    store_park(st, &s->g);
+                }
+                close_session(s);
+                sessions[i--] = sessions[--num_sessions];
+            }
+        }
+        
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            int num_accepted = 0;
+            // At most a backlog's worth per wake, or clients connecting as fast as they are accepted
+            // would keep the loop from ever noticing the ones that hung up
+            while (num_accepted++ < SESSION_BACKLOG && (fd = accept(listen_fd, NULL, NULL)) >= 0) {
+                if (num_sessions == capacity) {
+                    capacity = capacity * 2;
+                    sessions = (session**)realloc(sessions, capacity * sizeof(session*));
+                }
+                session *s = open_session(fd, out, seed, num_opened++, counters, opponent, clock);
+                flush_session(s, out, &out_buf, &out_len);
+                sessions[num_sessions++] = s;
+            }
+            if (st->header != NULL) {
+                st->header->next_index = num_opened;
+            }
+        }
+        
+        if (st->header != NULL && monotonic_ns() >= next_sweep) {
+            num_sessions = evict_sessions(sessions, num_sessions, st, &idle, &num_idle, &cap_idle);
+            next_sweep = monotonic_ns() + STORE_SWEEP_NS;
+        }
+        
+        if (counters != NULL) {
+            int64_t queued = 0;
+            for (int i = 0; i < num_sessions; i++) {
+                queued += (int64_t)sessions[i]->pending_len;
+            }
+            int64_t num_parked = (parked != NULL) ? parked->header->num_games - parked->num_taken : 0;
+            num_parked += (st->header != NULL) ? st->header->parked : 0;
+            atomic_store(&m->sessions, num_sessions);
+            atomic_store(&m->parked, num_parked);
+            atomic_store(&m->idle, num_idle);
+            atomic_store(&m->queued_bytes, queued);
+        }
+    }
+    
+    if (opponent != NULL) {
+        print_latency("Opponent moves:", &clock->seat[PLAYER_TWO - 1], clock->budget_ns);
+    }
+    
+    // Stopped: save the games still being played along with the saved ones nobody came back for
+    int exit_code = -1;
+    if (stopped) {
+        exit_code = 0;
+        if (st->header != NULL) {
+            // The store outlives the run on its own, so the games in memory go there and not into the checkpoint
+            uint32_t num_games = 0;
+            for (int i = 0; i < num_sessions; i++) {
+                if (sessions[i]->g.state == GAME_AWAIT_GUESS && store_park(st, &sessions[i]->g) == 0) {
+                    num_games++;
+                }
+            }
+            printf("Parked %u games in %s, %u in all\n", num_games, st->path, st->header->parked);
+        }
+        if (checkpoint_path != NULL) {
+            uint32_t num_games = 0;
+            uint32_t num_parked = (parked != NULL) ? parked->header->num_games : 0;
+            game_snapshot *games = (game_snapshot*)malloc(((size_t)num_sessions + num_parked + 1) * sizeof(game_snapshot));
+            for (int i = 0; i < num_sessions && st->header == NULL; i++) {
+                if (sessions[i]->g.state == GAME_AWAIT_GUESS && save_game(&sessions[i]->g, &games[num_games]) == 0) {
+                    num_games++;
+                }
+            }
+            for (uint32_t i = 0; i < num_parked; i++) {
+                if (!parked->taken[i]) {
+                    games[num_games++] = parked->games[i];
+                }
+            }
+            if (write_checkpoint(checkpoint_path, games, num_games, num_opened) != 0) {
+                printf("ERROR: Could not write the checkpoint %s\n", checkpoint_path);
+                exit_code = -1;
+            } else {
+                printf("Saved %u games to %s\n", num_games, checkpoint_path);
+            }
+            free(games);
+        }
+    }
+    
+    for (int i = 0; i < num_sessions; i++) {
+        close_session(sessions[i]);
+    }
+    for (int i = 0; i < num_idle; i++) {
+        close(idle[i].fd);
+    }
+    if (parked != NULL) {
+        close_checkpoint(parked);
+    }
+    close_store(st);
+    free(sessions);
+    free(idle);
+    free(fds);
+    close(listen_fd);
+    unlink(path);
+    fclose(out);
+    free(out_buf);
+    stop_metrics(m);
+    return exit_code;
+    
+}
+
+
+/************************************************************************
+ * open_server_socket(): Function that creates the non-blocking Unix    *
+ *      socket the server accepts clients on. Returns the descriptor or *
+ *      -1 if the socket could not be created.                          *
+ ************************************************************************/
+int open_server_socket(const char *path) {
+    
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    
+    if (fd < 0 || strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path); // Remove the socket left behind by a previous run
+    
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SESSION_BACKLOG) < 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+    
+}
+
+
+/************************************************************************
+ * open_session(): Function that creates the Session Struct of a new    *
+ *      client, deals a shuffled deck and runs the game up to the first *
+ *      guess. Output is left in the shared stream for flush_session(). *
+ ************************************************************************/
+session* open_session(int fd, FILE *out, uint64_t seed, uint32_t index, engine_counters *counters, const bot *opponent, move_clock *clock) {
+    
+    session *s = (session*)malloc(sizeof(session));
+    
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    s->fd = fd;
+    s->line_len = 0;
+    s->pending = NULL;
+    s->pending_len = 0;
+    s->opponent = opponent;
+    s->clock = clock;
+    s->last_active = monotonic_ns();
+    
+    game_init(&s->g, out);
+    game_seed(&s->g, seed, index);
+    s->g.counters = counters;
+    fprintf(out, "GAME %u (if you are cut off, reconnect and send resume %u to carry on)\n", index, index);
+    generate_random_deck(&s->g.deck_hl, &s->g.deck_hr);
+    if (counters != NULL) {
+        counter_add(&counters->cards_allocated, 52);
+    }
+    shuffle_deck(s->g.deck_hl, &s->g.rng);
+    if (opponent != NULL && opponent->plugin != NULL) {
+        attach_plugin(&s->g, PLAYER_TWO, opponent->plugin);
+    }
+    game_resume(&s->g, 0);
+    play_opponent(s);
+    
+    return s;
+    
+}
+
+
+/************************************************************************
+ * close_session(): Function that hangs up on a client and frees its    *
+ *      game along with any output it never received.                   *
+ ************************************************************************/
+void close_session(session *s) {
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+    game_free(&s->g);
+    free(s->pending);
+    free(s);
+}
+
+
+/************************************************************************
+ * flush_session(): Function that sends a session its output without    *
+ *      blocking. Whatever sits in the shared stream (when out is not   *
+ *      NULL) is queued after the pending output, the stream is reset,  *
+ *      and anything the socket does not accept stays pending until the *
+ *      next POLLOUT. Returns 0 on success, -1 if the client is gone.   *
+ ************************************************************************/
+int flush_session(session *s, FILE *out, char **out_buf, size_t *out_len) {
+    
+    const char *data;
+    size_t len;
+    ssize_t written;
+    
+    if (out != NULL) {
+        fflush(out);
+        if (*out_len > 0) {
+            // Queue behind anything still pending so the client sees the output in order
+            s->pending = (char*)realloc(s->pending, s->pending_len + *out_len);
+            memcpy(s->pending + s->pending_len, *out_buf, *out_len);
+            s->pending_len += *out_len;
+        }
+        fseeko(out, 0, SEEK_SET);
+    }
+    
+    if (s->fd < 0 || s->pending_len == 0) {
+        return (s->fd < 0) ? -1 : 0;
+    }
+    
+    data = s->pending;
+    len = s->pending_len;
+    written = write(s->fd, data, len);
+    if (written < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        close(s->fd);
+        s->fd = -1;
+        return -1;
+    }
+    
+    // Keep only what the socket did not take
+    memmove(s->pending, data + written, len - written);
+    s->pending_len = len - written;
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * read_session(): Function that reads whatever the client has sent and *
+ *      resumes its game once for every complete line (one guess per    *
+ *      line). Marks the session closed when the client hangs up. A     *
+ *      first line of resume ID swaps the new game for game ID of the   *
+ *      session store or of the parked games (NULL if there are none).  *
+ ************************************************************************/
+void read_session(session *s, checkpoint *parked, session_store *st) {
+    
+    char buffer[512];
+    ssize_t received = read(s->fd, buffer, sizeof(buffer));
+    
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        // Client hung up
+        close(s->fd);
+        s->fd = -1;
+        return;
+    }
+    
+    for (ssize_t i = 0; i < received; i++) {
+        char c = buffer[i];
+        if (c == '\n') {
+            // Strip the carriage return telnet style clients send and resume the game
+            while (s->line_len > 0 && (s->line[s->line_len - 1] == '\r' || s->line[s->line_len - 1] == ' ')) {
+                s->line_len--;
+            }
+            s->line[s->line_len] = '\0';
+            s->line_len = 0;
+            s->last_active = monotonic_ns();
+            if (strncmp(s->line, "resume ", 7) == 0 && s->g.turn_count == 0) {
+                char *end;
+                unsigned long id = strtoul(s->line + 7, &end, 10);
+                game g;
+                game_init(&g, s->g.out);
+                g.counters = s->g.counters;
+                // Parked in the store is the latest state of a game, look there before the checkpoint
+                int restored = (*end == '\0') ? store_take(st, (uint32_t)id, &g) : -1;
+                if (restored != 0) {
+                    int found = (parked != NULL && *end == '\0') ? find_snapshot(parked, (uint32_t)id) : -1;
+                    restored = (found < 0 || parked->taken[found]) ? -1 : restore_game(&g, &parked->games[found]);
+                    if (restored == 0) {
+                        parked->taken[found] = 1;
+                        parked->num_taken++;
+                    }
+                }
+                if (restored != 0) {
+                    game_free(&g);
+                    fprintf(s->g.out, "There is no saved game %s to resume\n", s->line + 7);
+                    print_guess_prompt(s->g.out, s->g.players_turn);
+                } else {
+                    game_free(&s->g);
+                    s->g = g;
+                    fprintf(s->g.out, "RESUMING GAME %lu\n", id);
+                    print_turn(&s->g);
+                    play_opponent(s);
+                }
+            } else if (s->g.state == GAME_AWAIT_GUESS && s->g.counters != NULL) {
+                uint64_t start_ns = monotonic_ns();
+                game_submit(&s->g, s->line);
+                count_move(s->g.counters, monotonic_ns() - start_ns);
+                play_opponent(s);
+            } else if (s->g.state == GAME_AWAIT_GUESS) {
+                game_submit(&s->g, s->line);
+                play_opponent(s);
+            }
+        } else if (s->line_len < SESSION_LINE_SIZE - 1) {
+            s->line[s->line_len++] = c;
+        }
+    }
+    
+}
+
+
+/************************************************************************
+ * store_option(): Function that takes one of the session store options *
+ *      of the server: --store FILE, --idle SECONDS or --memory-budget  *
+ *      MB. Returns 1 if name was one of them, 0 if not.                *
+ ************************************************************************/
+int store_option(session_store *st, const char *name, const char *value) {
+    
+    if (strcmp(name, "--store") == 0) {
+        st->path = value;
+    } else if (strcmp(name, "--idle") == 0) {
+        st->idle_ns = (uint64_t)(atof(value) * 1e9);
+    } else if (strcmp(name, "--memory-budget") == 0) {
+        st->budget = (size_t)(atof(value) * 1048576);
+    } else {
+        return 0;
+    }
+    return 1;
+    
+}
+
+
+/************************************************************************
+ * open_store(): Function that opens the session store file (and its    *
+ *      index, the same path with .index appended), creating both if    *
+ *      they do not exist yet, and maps them in. Games parked by an     *
+ *      earlier run can be resumed straight away. Returns 0 (doing      *
+ *      nothing without --store), or -1 if the files cannot be used.    *
+ ************************************************************************/
+int open_store(session_store *st) {
+    
+    struct stat info, index_info;
+    char index_path[4096];
+    
+    st->fd = st->index_fd = -1;
+    st->header = NULL;
+    st->index = NULL;
+    if (st->path == NULL) {
+        return 0;
+    }
+    
+    snprintf(index_path, sizeof(index_path), "%s.index", st->path);
+    st->fd = open(st->path, O_RDWR | O_CREAT, 0644);
+    st->index_fd = open(index_path, O_RDWR | O_CREAT, 0644);
+    if (st->fd < 0 || st->index_fd < 0 || fstat(st->fd, &info) < 0 || fstat(st->index_fd, &index_info) < 0) {
+        close_store(st);
+        return -1;
+    }
+    st->num_slots = (size_t)info.st_size / sizeof(game_snapshot);
+    st->index_slots = (size_t)index_info.st_size / sizeof(uint32_t);
+    int created = (info.st_size == 0);
+    if ((created && grow_store_file(st->fd, &st->num_slots, 1, sizeof(game_snapshot)) != 0)
+        || grow_store_file(st->index_fd, &st->index_slots, 1, sizeof(uint32_t)) != 0) {
+        close_store(st);
+        return -1;
+    }
+    
+    // Reserve room for the files to grow into, so a record once handed out never moves
+    void *map = mmap(NULL, STORE_RESERVE, PROT_READ | PROT_WRITE, MAP_SHARED, st->fd, 0);
+    void *index_map = mmap(NULL, STORE_RESERVE, PROT_READ | PROT_WRITE, MAP_SHARED, st->index_fd, 0);
+    st->header = (map == MAP_FAILED) ? NULL : (store_header*)map;
+    st->index = (index_map == MAP_FAILED) ? NULL : (uint32_t*)index_map;
+    if (st->header == NULL || st->index == NULL) {
+        close_store(st);
+        return -1;
+    }
+    
+    if (created) {
+        st->header->magic = STORE_MAGIC;
+        st->header->version = STORE_VERSION;
+        st->header->record_size = sizeof(game_snapshot);
+    } else if (st->header->magic != STORE_MAGIC || st->header->version != STORE_VERSION
+               || st->header->record_size != sizeof(game_snapshot) || (size_t)st->header->num_records >= st->num_slots) {
+        close_store(st);
+        return -1;
+    }
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * close_store(): Function that unmaps the session store, asking the    *
+ *      kernel to write it out first, and closes its files.             *
+ ************************************************************************/
+void close_store(session_store *st) {
+    
+    if (st->header != NULL) {
+        msync(st->header, st->num_slots * sizeof(game_snapshot), MS_SYNC);
+        munmap(st->header, STORE_RESERVE);
+    }
+    if (st->index != NULL) {
+        msync(st->index, st->index_slots * sizeof(uint32_t), MS_SYNC);
+        munmap(st->index, STORE_RESERVE);
+    }
+    if (st->fd >= 0) {
+        close(st->fd);
+    }
+    if (st->index_fd >= 0) {
+        close(st->index_fd);
+    }
+    st->header = NULL;
+    st->index = NULL;
+    st->fd = st->index_fd = -1;
+    
+}
+
+
+/************************************************************************
+ * grow_store_file(): Function that makes sure a file of the session    *
+ *      store has room for needed slots of slot_size bytes, growing it  *
+ *      STORE_GROWTH slots at a time. Touching a mapped page past the   *
+ *      end of the file would raise SIGBUS, so every write into the     *
+ *      store is preceded by this. Returns 0, or -1 once the file has   *
+ *      outgrown STORE_RESERVE or the disk is full.                     *
+ ************************************************************************/
+int grow_store_file(int fd, size_t *slots, size_t needed, size_t slot_size) {
+    
+    if (needed <= *slots) {
+        return 0;
+    }
+    size_t num_slots = (needed / STORE_GROWTH + 1) * STORE_GROWTH;
+    if (num_slots * slot_size > STORE_RESERVE || ftruncate(fd, (off_t)(num_slots * slot_size)) != 0) {
+        return -1;
+    }
+    *slots = num_slots;
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * store_park(): Function that saves a Game Snapshot of a suspended     *
+ *      game in the session store. A game parked before is written over *
+ *      its own record, a new one gets the next record and the index is *
+ *      pointed at it. Returns 0, or -1 if the game could not be saved. *
+ ************************************************************************/
+int store_park(session_store *st, const game *g) {
+    
+    game_snapshot *records = (game_snapshot*)st->header;
+    uint32_t entry = (g->id < st->index_slots) ? st->index[g->id] : 0;
+    uint32_t record = entry & ~STORE_TAKEN;
+    
+    if (record == 0 || record > st->header->num_records) {
+        record = st->header->num_records + 1;
+    }
+    if (record >= STORE_TAKEN || grow_store_file(st->fd, &st->num_slots, (size_t)record + 1, sizeof(game_snapshot)) != 0
+        || grow_store_file(st->index_fd, &st->index_slots, (size_t)g->id + 1, sizeof(uint32_t)) != 0
+        || save_game(g, &records[record]) != 0) {
+        return -1;
+    }
+    if (record > st->header->num_records) {
+        st->header->num_records = record;
+    }
+    if (entry != record) { // Not parked until now, or taken back since
+        st->header->parked++;
+    }
+    st->index[g->id] = record;
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * store_take(): Function that restores game id from the session store  *
+ *      into a game set up by game_init() and marks it taken in the     *
+ *      index, so it cannot be taken twice. Returns 0, or -1 (with g as *
+ *      it was) if the store has no record of the game. A damaged       *
+ *      record or an index entry pointing past the last record is       *
+ *      dropped too.                                                    *
+ ************************************************************************/
+int store_take(session_store *st, uint32_t id, game *g) {
+    
+    if (st == NULL || st->header == NULL || id >= st->index_slots || st->index[id] == 0 || (st->index[id] & STORE_TAKEN)) {
+        return -1;
+    }
+    // The index is never checked as a whole, so a stale or damaged entry is caught here before it is followed
+    if (st->index[id] > st->header->num_records) {
+        st->index[id] = 0;
+        return -1;
+    }
+    
+    const game_snapshot *record = (const game_snapshot*)st->header + st->index[id];
+    st->index[id] |= STORE_TAKEN;
+    st->header->parked--;
+    if (restore_game(g, record) != 0) {
+        FILE *out = g->out;
+        engine_counters *counters = g->counters;
+        game_free(g);
+        game_init(g, out);
+        g->counters = counters;
+        return -1;
+    }
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * park_session(): Function that moves the game of a session waiting on *
+ *      its client into the session store and frees the session, which  *
+ *      leaves only the Idle Session behind. The session must have      *
+ *      nothing pending. Returns 0, or -1 (with the session untouched)  *
+ *      if the game could not be parked.                                *
+ ************************************************************************/
+int park_session(session *s, session_store *st, idle_session *idle) {
+    
+    if (store_park(st, &s->g) != 0) {
+        return -1;
+    }
+    idle->fd = s->fd;
+    idle->id = s->g.id;
+    game_free(&s->g);
+    free(s->pending);
+    free(s);
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * wake_session(): Function that brings the game of an idle client back *
+ *      from the session store. A plugin opponent starts over with a    *
+ *      fresh state on its next ask, plugin state is not in a snapshot. *
+ *      Returns the new session, or NULL if the record was lost (the    *
+ *      caller hangs up on the client then).                            *
+ ************************************************************************/
+session* wake_session(const idle_session *idle, session_store *st, FILE *out, engine_counters *counters, const bot *opponent, move_clock *clock) {
+    
+    session *s = (session*)malloc(sizeof(session));
+    
+    s->fd = idle->fd;
+    s->line_len = 0;
+    s->pending = NULL;
+    s->pending_len = 0;
+    s->opponent = opponent;
+    s->clock = clock;
+    s->last_active = monotonic_ns();
+    game_init(&s->g, out);
+    s->g.counters = counters;
+    if (store_take(st, idle->id, &s->g) != 0) {
+        game_free(&s->g);
+        free(s);
+        return NULL;
+    }
+    return s;
+    
+}
+
+
+/************************************************************************
+ * evict_sessions(): Function that parks the sessions idle for longer   *
+ *      than the store's idle time, then, while the games left in       *
+ *      memory are over the memory budget, the least recently active    *
+ *      ones. Only sessions waiting on their client with nothing        *
+ *      pending or half read can be parked, so the budget is exceeded   *
+ *      while too few are. Parked sessions are appended to idle (grown  *
+ *      as needed). Returns the number of sessions left in memory,      *
+ *      which stay at the start of sessions.                            *
+ ************************************************************************/
+int evict_sessions(session **sessions, int num_sessions, session_store *st, idle_session **idle, int *num_idle, int *cap_idle) {
+    
+    const size_t session_bytes = sizeof(session) + 52 * sizeof(card); // What a game in memory costs at most
+    uint64_t now = monotonic_ns();
+    size_t over = 0; // Sessions to park beyond the idle ones to get under budget
+    int kept = 0;
+    
+    if (st->budget > 0 && (size_t)num_sessions * session_bytes > st->budget) {
+        over = num_sessions - st->budget / session_bytes;
+        qsort(sessions, num_sessions, sizeof(session*), compare_sessions); // Least recently active first
+    }
+    
+    for (int i = 0; i < num_sessions; i++) {
+        session *s = sessions[i];
+        int idle_for_long = (now - s->last_active >= st->idle_ns);
+        if (s->fd >= 0 && s->g.state == GAME_AWAIT_GUESS && s->pending_len == 0 && s->line_len == 0 && (idle_for_long || over > 0)) {
+            if (*num_idle == *cap_idle) {
+                *cap_idle = (*cap_idle > 0) ? *cap_idle * 2 : 64;
+                *idle = (idle_session*)realloc(*idle, (size_t)*cap_idle * sizeof(idle_session));
+            }
+            if (park_session(s, st, &(*idle)[*num_idle]) == 0) {
+                (*num_idle)++;
+                over -= (over > 0);
+                continue;
+            }
+        }
+        sessions[kept++] = s;
+    }
+    return kept;
+    
+}
+
+
+/************************************************************************
+ * compare_sessions(): Function that orders sessions from the least to  *
+ *      the most recently active, for qsort().                          *
+ ************************************************************************/
+int compare_sessions(const void *a, const void *b) {
+    uint64_t x = (*(session* const*)a)->last_active;
+    uint64_t y = (*(session* const*)b)->last_active;
+    return (x > y) - (x < y);
+}
+
+
+/************************************************************************
+ * run_loadgen(): Function that measures how many games one server can  *
+ *      host, as in ./main --loadgen SOCKET_PATH. Clients connect in    *
+ *      --steps steps up to --clients, and every step is held for       *
+ *      --step-seconds. Each client plays its own game the way a person *
+ *      at a terminal would: it waits for the prompt, thinks for a time *
+ *      drawn from --think, then asks for a rank from the hand it was   *
+ *      shown. A finished game is followed by a new connection.         *
+ *                                                                      *
+ *      Each step reports the moves played per second, the time from    *
+ *      sending a move until its whole reply had arrived (p50, p99 and  *
+ *      p999), and the CPU and memory of the server. Without --pid the  *
+ *      server is started from this binary (./main --server) and        *
+ *      stopped afterwards, so two builds compare like for like. The    *
+ *      clients run on one thread of the same machine, their own CPU    *
+ *      use is reported alongside.                                      *
+ ************************************************************************/
+int run_loadgen(int argc, char *argv[]) {
+    
+    const char *path = argv[2];
+    const char *json_path = NULL;
+    const char *think_spec = "exp:1000";
+    think_time think;
+    long max_clients = 1000, num_steps = 5;
+    double step_seconds = 5, slo_ms = 10;
+    uint64_t seed = (uint64_t)time(NULL);
+    pid_t pid = 0, spawned = 0;
+    int usage = 0;
+    
+    for (int i = 3; i < argc && !usage; i += 2) {
+        if (i + 1 >= argc) {
+            usage = 1;
+        } else if (strcmp(argv[i], "--clients") == 0) {
+            max_clients = atol(argv[i + 1]);
+        } else if (strcmp(argv[i], "--steps") == 0) {
+            num_steps = atol(argv[i + 1]);
+        } else if (strcmp(argv[i], "--step-seconds") == 0) {
+            step_seconds = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "--think") == 0) {
+            think_spec = argv[i + 1];
+        } else if (strcmp(argv[i], "--slo") == 0) {
+            slo_ms = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "--pid") == 0) {
+            pid = (pid_t)atol(argv[i + 1]);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json_path = argv[i + 1];
+        } else {
+            usage = 1;
+        }
+    }
+    if (usage || max_clients <= 0 || num_steps <= 0 || num_steps > max_clients || step_seconds <= 0 || parse_think(think_spec, &think) != 0) {
+        printf("Usage: %s --loadgen SOCKET_PATH [--clients N] [--steps N] [--step-seconds S] [--think fixed:MS|uniform:MIN:MAX|exp:MEAN] [--slo MS] [--seed S] [--pid PID] [--json FILE]\n", argv[0]);
+        printf("Think times are in milliseconds. --pid measures a server that is already running instead of starting one.\n");
+        return 1;
+    }
+    
+    // Both ends of every connection live on this machine, raise the descriptor limit as far as allowed
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    
+    if (pid == 0) {
+        spawned = pid = fork();
+        if (pid == 0) {
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            execl("/proc/self/exe", argv[0], "--server", path, (char*)NULL);
+            _exit(127);
+        }
+        // Wait for the socket to come up
+        struct timespec pause = {0, 10000000};
+        for (int tries = 0; tries < 500; tries++) {
+            load_client probe;
+            if (connect_load_client(&probe, path) == 0) {
+                close(probe.fd);
+                break;
+            }
+            nanosleep(&pause, NULL);
+        }
+    }
+    
+    load_client *clients = (load_client*)calloc(max_clients, sizeof(load_client));
+    struct pollfd *fds = (struct pollfd*)malloc(max_clients * sizeof(struct pollfd));
+    load_step *steps = (load_step*)calloc(num_steps, sizeof(load_step));
+    long num_clients = 0;
+    int capacity = 0; // Clients of the last step before the first one over the SLO
+    int degraded = 0;
+    long ticks_per_second = sysconf(_SC_CLK_TCK);
+    
+    printf("Clients   Moves/s     p50      p99     p999      max  Games  Errors  Server CPU  Server RSS  Client CPU\n");
+    for (int step = 0; step < num_steps; step++) {
+        
+        load_step *s = &steps[step];
+        long target = max_clients * (step + 1) / num_steps;
+        while (num_clients < target) {
+            load_client *c = &clients[num_clients];
+            rng_init(&c->rng, seed, (uint32_t)num_clients, STREAM_LOAD);
+            if (connect_load_client(c, path) != 0) {
+                s->errors++;
+                break;
+            }
+            num_clients++;
+        }
+        s->clients = (int)num_clients;
+        
+        long server_ticks = 0, client_ticks = 0;
+        process_usage(pid, &server_ticks, &s->rss_kb);
+        process_usage(getpid(), &client_ticks, NULL);
+        uint64_t start_ns = monotonic_ns();
+        uint64_t end_ns = start_ns + (uint64_t)(step_seconds * 1e9);
+        uint64_t now = start_ns;
+        
+        while (now < end_ns) {
+            
+            // Clients done thinking send their move, the rest decide how long poll() may sleep
+            uint64_t wake_ns = end_ns;
+            for (long i = 0; i < num_clients; i++) {
+                load_client *c = &clients[i];
+                if (c->fd >= 0 && c->move_ns != 0 && c->move_ns <= now) {
+                    char ask[8];
+                    int len = pick_ask(c, ask);
+                    c->len = 0;
+                    c->move_ns = 0;
+                    c->sent_ns = monotonic_ns();
+                    if (write(c->fd, ask, len) != len) {
+                        s->errors++;
+                    }
+                } else if (c->fd >= 0 && c->move_ns != 0 && c->move_ns < wake_ns) {
+                    wake_ns = c->move_ns;
+                }
+                fds[i].fd = clients[i].fd;
+                fds[i].events = POLLIN;
+                fds[i].revents = 0;
+            }
+            
+            int timeout_ms = (wake_ns > now) ? (int)((wake_ns - now + 999999) / 1000000) : 0;
+            if (poll(fds, num_clients, timeout_ms) < 0 && errno != EINTR) {
+                break;
+            }
+            
+            for (long i = 0; i < num_clients; i++) {
+                if (fds[i].revents == 0) {
+                    continue;
+                }
+                int finished = read_load_client(&clients[i], &think, s);
+                if (finished && connect_load_client(&clients[i], path) != 0) {
+                    s->errors++;
+                }
+            }
+            now = monotonic_ns();
+        }
+        
+        long server_end = 0, client_end = 0;
+        s->seconds = (now - start_ns) / 1e9;
+        process_usage(pid, &server_end, &s->rss_kb);
+        process_usage(getpid(), &client_end, NULL);
+        s->server_cpu = 100.0 * (server_end - server_ticks) / ticks_per_second / s->seconds;
+        s->client_cpu = 100.0 * (client_end - client_ticks) / ticks_per_second / s->seconds;
+        degraded = degraded || s->latency.decisions == 0 || latency_percentile(&s->latency, 0.99) > slo_ms * 1e6;
+        capacity = degraded ? capacity : s->clients;
+        printf("%7d %9.1f %6.2fms %6.2fms %6.2fms %6.2fms %6llu %7llu %10.1f%% %8ld kB %10.1f%%\n", s->clients, s->latency.decisions / s->seconds,
+               latency_percentile(&s->latency, 0.5) / 1e6, latency_percentile(&s->latency, 0.99) / 1e6,
+               latency_percentile(&s->latency, 0.999) / 1e6, s->latency.max_ns / 1e6, (unsigned long long)s->games,
+               (unsigned long long)s->errors, s->server_cpu, s->rss_kb, s->client_cpu);
+        fflush(stdout);
+    }
+    printf("Capacity:       %d clients with a p99 move time within %gms\n", capacity, slo_ms);
+    
+    if (json_path != NULL && write_load_json(json_path, steps, num_steps, think_spec, slo_ms, capacity, seed) != 0) {
+        printf("ERROR: Could not write %s\n", json_path);
+    }
+    
+    for (long i = 0; i < num_clients; i++) {
+        if (clients[i].fd >= 0) {
+            close(clients[i].fd);
+        }
+    }
+    if (spawned > 0) {
+        kill(spawned, SIGTERM);
+        waitpid(spawned, NULL, 0);
+    }
+    free(clients);
+    free(fds);
+    free(steps);
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * parse_think(): Function that reads a think time distribution, one of *
+ *      fixed:MS, uniform:MIN:MAX or exp:MEAN (all in milliseconds).    *
+ *      Returns 0, or -1 if spec is none of them.                       *
+ ************************************************************************/
+int parse_think(const char *spec, think_time *t) {
+    
+    t->a = t->b = 0;
+    if (sscanf(spec, "fixed:%lf", &t->a) == 1) {
+        t->kind = THINK_FIXED;
+    } else if (sscanf(spec, "uniform:%lf:%lf", &t->a, &t->b) == 2 && t->b >= t->a) {
+        t->kind = THINK_UNIFORM;
+    } else if (sscanf(spec, "exp:%lf", &t->a) == 1) {
+        t->kind = THINK_EXP;
+    } else {
+        return -1;
+    }
+    return (t->a >= 0) ? 0 : -1;
+    
+}
+
+
+/************************************************************************
+ * think_ns(): Function that draws how long a client thinks over its    *
+ *      next move, in nanoseconds.                                      *
+ ************************************************************************/
+uint64_t think_ns(const think_time *t, rng_stream *rng) {
+    
+    double u = rng_next(rng) / 4294967296.0; // [0, 1)
+    double ms = t->a;
+    
+    if (t->kind == THINK_UNIFORM) {
+        ms = t->a + u * (t->b - t->a);
+    } else if (t->kind == THINK_EXP) {
+        ms = -t->a * log(1 - u);
+    }
+    return (uint64_t)(ms * 1e6) + 1; // Never 0, which marks a client that is not thinking
+    
+}
+
+
+/************************************************************************
+ * connect_load_client(): Function that connects a load generator       *
+ *      client to the server for a new game. Returns 0, or -1 if the    *
+ *      server did not take the connection.                             *
+ ************************************************************************/
+int connect_load_client(load_client *c, const char *path) {
+    
+    struct sockaddr_un addr;
+    
+    c->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    c->len = 0;
+    c->sent_ns = 0;
+    c->move_ns = 0;
+    if (c->fd < 0 || strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(c->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    fcntl(c->fd, F_SETFL, O_NONBLOCK);
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * read_load_client(): Function that takes in what the server sent a    *
+ *      client. Once the reply ends in the guess prompt, the time since *
+ *      the move was sent is added to the step's latency and the client *
+ *      starts thinking over its next move. Returns 1 if the server     *
+ *      hung up (the game is over), 0 otherwise.                        *
+ ************************************************************************/
+int read_load_client(load_client *c, const think_time *think, load_step *s) {
+    
+    ssize_t received;
+    
+    while (1) {
+        if (c->len > LOAD_BUFFER_SIZE * 3 / 4) {
+            // Only the end of the output is needed, it holds the hand to ask from
+            memmove(c->output, c->output + c->len - LOAD_BUFFER_SIZE / 4, LOAD_BUFFER_SIZE / 4);
+            c->len = LOAD_BUFFER_SIZE / 4;
+        }
+        received = recv(c->fd, c->output + c->len, LOAD_BUFFER_SIZE - 1 - c->len, 0);
+        if (received <= 0) {
+            break;
+        }
+        c->len += (size_t)received;
+    }
+    
+    uint64_t now = monotonic_ns();
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        // Server hangs up once the game is over, after its last reply
+        if (c->sent_ns != 0) {
+            record_latency(&s->latency, now - c->sent_ns);
+        }
+        s->games += (received == 0);
+        s->errors += (received < 0);
+        close(c->fd);
+        c->fd = -1;
+        return 1;
+    }
+    
+    c->output[c->len] = '\0';
+    if (c->move_ns == 0 && c->len >= 7 && strcmp(c->output + c->len - 7, "Guess: ") == 0) {
+        if (c->sent_ns != 0) {
+            record_latency(&s->latency, now - c->sent_ns);
+        }
+        c->sent_ns = 0;
+        c->move_ns = now + think_ns(think, &c->rng);
+    }
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * pick_ask(): Function that chooses the move of a client: a rank from  *
+ *      the last hand the server showed it, written as a player would   *
+ *      type it (letters in either case, see parse_rank()). Falls back  *
+ *      to any rank if no hand can be found. Writes the line to ask and *
+ *      returns its length.                                             *
+ ************************************************************************/
+int pick_ask(load_client *c, char ask[8]) {
+    
+    const char *names[NUM_RANKS + 1] = {"", "A", "2", "3", "4", "5", "6", "7", "8", "9", "10", "J", "Q", "K"};
+    int held[52];
+    int num_held = 0;
+    const char *hand = NULL;
+    
+    // Hand is the last one printed. The top row of every card starts with |RANK, other rows with | or |_
+    for (const char *p = strstr(c->output, "HAND:"); p != NULL; p = strstr(p + 1, "HAND:")) {
+        hand = p;
+    }
+    for (const char *p = hand; p != NULL && *p != '\0' && num_held < 52; p++) {
+        if (p[0] == '|' && p[1] != ' ' && p[1] != '_' && p[1] != '|') {
+            char letter[2] = {p[1], '\0'};
+            int rank = (p[1] == '1' && p[2] == '0') ? 10 : parse_rank(letter);
+            if (rank != 0) {
+                held[num_held++] = rank;
+            }
+        }
+    }
+    
+    int rank = (num_held > 0) ? held[rand_gen(num_held, &c->rng)] : rand_gen(NUM_RANKS, &c->rng) + 1;
+    int len = snprintf(ask, 8, "%s\n", names[rank]);
+    if (rank == 1 || rank > 10) {
+        ask[0] = (rng_next(&c->rng) & 1) ? (char)tolower(ask[0]) : ask[0];
+    }
+    return len;
+    
+}
+
+
+
+/************************************************************************
+ * process_usage(): Function that reads the CPU time (user and system,  *
+ *      in clock ticks) and, if rss_kb is not NULL, the resident memory *
+ *      of process pid from /proc. Leaves both as they were if the      *
+ *      process cannot be read.                                         *
+ ************************************************************************/
+void process_usage(pid_t pid, long *ticks, long *rss_kb) {
+    
+    char path[64], line[1024];
+    FILE *f;
+    
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if ((f = fopen(path, "r")) != NULL) {
+        // Fields after the command name, which may itself hold spaces: utime and stime are the 12th and 13th
+        unsigned long utime, stime;
+        char *end = (fgets(line, sizeof(line), f) != NULL) ? strrchr(line, ')') : NULL;
+        if (end != NULL && sscanf(end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+            *ticks = (long)(utime + stime);
+        }
+        fclose(f);
+    }
+    
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    if (rss_kb != NULL && (f = fopen(path, "r")) != NULL) {
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (sscanf(line, "VmRSS: %ld", rss_kb) == 1) {
+                break;
+            }
+        }
+        fclose(f);
+    }
+    
+}
+
+
+/************************************************************************
+ * write_load_json(): Function that writes the steps of a load test as  *
+ *      JSON, so the capacity of two builds can be compared by a script.*
+ *      Returns 0, or -1 if the file could not be written.              *
+ ************************************************************************/
+int write_load_json(const char *path, const load_step *steps, int num_steps, const char *think_spec, double slo_ms, int capacity, uint64_t seed) {
+    
+    FILE *f = fopen(path, "w");
+    
+    if (f == NULL) {
+        return -1;
+    }
+    fprintf(f, "{\n  \"think\": \"%s\",\n  \"slo_ms\": %g,\n  \"seed\": %llu,\n  \"capacity_clients\": %d,\n  \"steps\": [\n",
+            think_spec, slo_ms, (unsigned long long)seed, capacity);
+    for (int i = 0; i < num_steps; i++) {
+        const load_step *s = &steps[i];
+        fprintf(f, "    {\"clients\": %d, \"seconds\": %.3f, \"moves\": %llu, \"moves_per_sec\": %.1f, \"games\": %llu, \"errors\": %llu, "
+                "\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f, "
+                "\"server_cpu_pct\": %.1f, \"server_rss_kb\": %ld, \"client_cpu_pct\": %.1f}%s\n",
+                s->clients, s->seconds, (unsigned long long)s->latency.decisions, s->latency.decisions / s->seconds,
+                (unsigned long long)s->games, (unsigned long long)s->errors, latency_percentile(&s->latency, 0.5) / 1e3,
+                latency_percentile(&s->latency, 0.99) / 1e3, latency_percentile(&s->latency, 0.999) / 1e3, s->latency.max_ns / 1e3,
+                s->server_cpu, s->rss_kb, s->client_cpu, (i + 1 < num_steps) ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return (fclose(f) == 0) ? 0 : -1;
+    
+}
+
+
+/************************************************************************
+ * run_broadcast(): Function that streams bot matches to spectators,    *
+ *      as in ./main --broadcast SOCKET_PATH. Games of the seed are     *
+ *      played one after another, a move every --delay milliseconds,    *
+ *      and everything a move prints is published once to the channel   *
+ *      every connection to the socket watches (for example with        *
+ *      nc -U SOCKET_PATH). A new watcher starts from a snapshot of the *
+ *      game in progress. Stops after --games games (0 plays on until   *
+ *      SIGINT or SIGTERM). Every decision is made within --deadline    *
+ *      microseconds when given, see bot_decide(), and the decision     *
+ *      times of both bots are printed at the end.                      *
+ ************************************************************************/
+int run_broadcast(int argc, char *argv[]) {
+    
+    const char *path = argv[2];
+    bot bots[2];
+    uint64_t seed = (uint64_t)time(NULL);
+    long delay = 500;
+    long max_games = 0;
+    move_clock clock;
+    int usage = 0;
+    
+    memset(&clock, 0, sizeof(move_clock));
+    load_bot(&bots[0], "random");
+    load_bot(&bots[1], "random");
+    for (int i = 3; i < argc && !usage; i += 2) {
+        if (i + 1 >= argc) {
+            usage = 1;
+        } else if (strcmp(argv[i], "--bot1") == 0) {
+            usage = load_bot(&bots[0], argv[i + 1]);
+        } else if (strcmp(argv[i], "--bot2") == 0) {
+            usage = load_bot(&bots[1], argv[i + 1]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "--delay") == 0) {
+            delay = atol(argv[i + 1]);
+        } else if (strcmp(argv[i], "--games") == 0) {
+            max_games = atol(argv[i + 1]);
+        } else if (strcmp(argv[i], "--deadline") == 0) {
+            clock.budget_ns = atol(argv[i + 1]) * 1000;
+            usage = (clock.budget_ns <= 0);
+        } else {
+            usage = 1;
+        }
+    }
+    if (usage || delay < 0 || max_games < 0) {
+        printf("Usage: %s --broadcast SOCKET_PATH [--bot1 BOT] [--bot2 BOT] [--seed S] [--delay MS] [--games GAMES] [--deadline MICROSECONDS]\n", argv[0]);
+        return 1;
+    }
+    
+    int listen_fd = open_server_socket(path);
+    char *out_buf = NULL;
+    size_t out_len = 0;
+    FILE *out = open_memstream(&out_buf, &out_len);
+    if (listen_fd < 0 || out == NULL || pipe(server_stop_pipe) < 0) {
+        printf("ERROR: Could not start the broadcast on %s\n", path);
+        return 1;
+    }
+    fcntl(server_stop_pipe[1], F_SETFL, O_NONBLOCK);
+    signal(SIGPIPE, SIG_IGN); // A watcher hanging up is handled where writev() fails
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+    printf("Broadcasting Go Fish on %s\n", path);
+    
+    channel ch;
+    memset(&ch, 0, sizeof(channel));
+    struct pollfd *fds = NULL;
+    int cap_fds = 0;
+    game g;
+    game_init(&g, out);
+    uint32_t index = 0;
+    int state = GAME_OVER;
+    int stopped = 0;
+    struct timespec now, next_move;
+    clock_gettime(CLOCK_MONOTONIC, &next_move);
+    
+    while (!stopped) {
+        
+        // Make the next move once it is due, starting the next game when the last one is over
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long wait = (next_move.tv_sec - now.tv_sec) * 1000 + (next_move.tv_nsec - now.tv_nsec) / 1000000;
+        if (wait <= 0) {
+            if (state == GAME_OVER) {
+                if (max_games > 0 && index == (uint32_t)max_games) {
+                    break;
+                }
+                game_seed(&g, seed, index++);
+                game_reset(&g, NULL, 0);
+                shuffle_deck(g.deck_hl, &g.rng);
+                attach_bots(&g, bots);
+                fprintf(out, "\n*** GAME %u OF SEED %llu ***\n", g.id, (unsigned long long)seed);
+                state = game_resume(&g, 0);
+            } else {
+                state = game_resume(&g, bot_decide(&g, &bots[g.players_turn - 1], &clock));
+            }
+            fflush(out);
+            channel_publish(&ch, new_chunk(out_buf, out_len), &g);
+            fseeko(out, 0, SEEK_SET);
+            next_move = now;
+            next_move.tv_sec += (delay * ((state == GAME_OVER) ? 4 : 1)) / 1000; // Linger on the result
+            next_move.tv_nsec += ((delay * ((state == GAME_OVER) ? 4 : 1)) % 1000) * 1000000;
+            if (next_move.tv_nsec >= 1000000000) {
+                next_move.tv_sec++;
+                next_move.tv_nsec -= 1000000000;
+            }
+            continue;
+        }
+        
+        // Listening socket first, then the stop pipe, then every watcher
+        if (ch.num_watchers + 2 > cap_fds) {
+            cap_fds = (ch.num_watchers + 2) * 2;
+            fds = (struct pollfd*)realloc(fds, cap_fds * sizeof(struct pollfd));
+        }
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = server_stop_pipe[0];
+        fds[1].events = POLLIN;
+        for (int i = 0; i < ch.num_watchers; i++) {
+            fds[i + 2].fd = ch.watchers[i].fd;
+            fds[i + 2].events = (ch.watchers[i].queued > 0) ? POLLIN | POLLOUT : POLLIN;
+            fds[i + 2].revents = 0;
+        }
+        int num_fds = ch.num_watchers + 2;
+        if (poll(fds, num_fds, (int)wait) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            stopped = 1;
+        }
+        
+        // Watchers only ever send to hang up, anything else they send is ignored
+        for (int i = num_fds - 3; i >= 0; i--) {
+            watcher *w = &ch.watchers[i];
+            int gone = 0;
+            if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) {
+                char buffer[256];
+                ssize_t received = read(w->fd, buffer, sizeof(buffer));
+                gone = (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR));
+            }
+            if (!gone && (fds[i + 2].revents & POLLOUT)) {
+                gone = (flush_watcher(w) < 0);
+            }
+            if (gone) {
+                channel_drop(&ch, i);
+            }
+        }
+        
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+                channel_add(&ch, fd, &g);
+            }
+        }
+    }
+    
+    printf("Broadcast %u games in %llu chunks, watchers were skipped ahead %llu times\n", index, (unsigned long long)ch.published,
+           (unsigned long long)ch.skips);
+    print_latency("Bot 1 moves:", &clock.seat[0], clock.budget_ns);
+    print_latency("Bot 2 moves:", &clock.seat[1], clock.budget_ns);
+    while (ch.num_watchers > 0) {
+        channel_drop(&ch, ch.num_watchers - 1);
+    }
+    if (ch.snapshot != NULL) {
+        release_chunk(ch.snapshot);
+    }
+    free(ch.watchers);
+    free(fds);
+    game_free(&g);
+    close(listen_fd);
+    unlink(path);
+    fclose(out);
+    free(out_buf);
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * new_chunk(): Function that copies len bytes of a game stream into a  *
+ *      Broadcast Chunk, the only copy every watcher is sent from.      *
+ ************************************************************************/
+chunk* new_chunk(const char *data, size_t len) {
+    
+    chunk *c = (chunk*)malloc(sizeof(chunk) + len);
+    
+    c->refs = 0;
+    c->len = len;
+    memcpy(c->data, data, len);
+    return c;
+    
+}
+
+
+/************************************************************************
+ * release_chunk(): Function that drops a reference to a chunk, freeing *
+ *      it when nothing holds it any more.                              *
+ ************************************************************************/
+void release_chunk(chunk *c) {
+    if (--c->refs <= 0) {
+        free(c);
+    }
+}
+
+
+/************************************************************************
+ * broadcast_snapshot(): Function that renders a game as it stands for  *
+ *      a watcher joining or being skipped ahead: scores, pool and both *
+ *      hands, since a spectator sees every card.                       *
+ ************************************************************************/
+chunk* broadcast_snapshot(const game *g) {
+    
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+    
+    fprintf(out, "\n*** GAME %u, TURN %d: PLAYER 1 %d BOOKS, PLAYER 2 %d BOOKS, %d CARDS IN THE POOL ***\n", g->id, g->turn_count,
+            g->score[0], g->score[1], g->deck_count);
+    for (int i = 0; i < 2; i++) {
+        fprintf(out, "PLAYER %d HAND:\n", i + 1);
+        print_hand(out, g->hand_hl[i]);
+    }
+    fclose(out);
+    
+    chunk *c = new_chunk(text, len);
+    free(text);
+    return c;
+    
+}
+
+
+/************************************************************************
+ * channel_publish(): Function that queues a chunk for every watcher of *
+ *      a channel and sends what each one can take right away. Watchers *
+ *      with a full queue are skipped ahead to a snapshot of g instead, *
+ *      one snapshot shared by all of them.                             *
+ ************************************************************************/
+void channel_publish(channel *ch, chunk *c, const game *g) {
+    
+    c->refs++; // Held for the length of the publish
+    if (ch->snapshot != NULL) {
+        release_chunk(ch->snapshot); // Out of date now
+        ch->snapshot = NULL;
+    }
+    ch->published++;
+    
+    for (int i = ch->num_watchers - 1; i >= 0; i--) {
+        watcher *w = &ch->watchers[i];
+        chunk *next = c;
+        
+        if (w->queued == WATCH_QUEUE) {
+            // Keep only a chunk that is partly sent, so the stream never breaks off mid-line
+            int keep = (w->offset > 0) ? 1 : 0;
+            for (int k = keep; k < w->queued; k++) {
+                release_chunk(w->queue[k]);
+            }
+            w->queued = keep;
+            if (ch->snapshot == NULL) {
+                ch->snapshot = broadcast_snapshot(g);
+                ch->snapshot->refs = 1;
+            }
+            next = ch->snapshot;
+            ch->skips++;
+        }
+        next->refs++;
+        w->queue[w->queued++] = next;
+        if (flush_watcher(w) < 0) {
+            channel_drop(ch, i);
+        }
+    }
+    release_chunk(c);
+    
+}
+
+
+/************************************************************************
+ * channel_add(): Function that adds a spectator connection to a        *
+ *      channel, starting it off with a snapshot of the game g.         *
+ ************************************************************************/
+void channel_add(channel *ch, int fd, const game *g) {
+    
+    if (ch->num_watchers == ch->cap_watchers) {
+        ch->cap_watchers = (ch->cap_watchers == 0) ? 64 : ch->cap_watchers * 2;
+        ch->watchers = (watcher*)realloc(ch->watchers, ch->cap_watchers * sizeof(watcher));
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    
+    watcher *w = &ch->watchers[ch->num_watchers++];
+    memset(w, 0, sizeof(watcher));
+    w->fd = fd;
+    if (ch->snapshot == NULL) {
+        ch->snapshot = broadcast_snapshot(g);
+        ch->snapshot->refs = 1;
+    }
+    ch->snapshot->refs++;
+    w->queue[w->queued++] = ch->snapshot;
+    if (flush_watcher(w) < 0) {
+        channel_drop(ch, ch->num_watchers - 1);
+    }
+    
+}
+
+
+/************************************************************************
+ * channel_drop(): Function that hangs up on watcher i of a channel and *
+ *      lets go of the chunks it was still owed.                        *
+ ************************************************************************/
+void channel_drop(channel *ch, int i) {
+    
+    watcher *w = &ch->watchers[i];
+    
+    close(w->fd);
+    for (int k = 0; k < w->queued; k++) {
+        release_chunk(w->queue[k]);
+    }
+    ch->watchers[i] = ch->watchers[--ch->num_watchers];
+    
+}
+
+
+/************************************************************************
+ * flush_watcher(): Function that sends a watcher as much of its queue  *
+ *      as the socket takes, every queued chunk in one writev(), and    *
+ *      releases the chunks sent in full. Returns 0, or -1 if the       *
+ *      watcher is gone.                                                *
+ ************************************************************************/
+int flush_watcher(watcher *w) {
+    
+    struct iovec iov[WATCH_QUEUE];
+    ssize_t written;
+    
+    if (w->queued == 0) {
+        return 0;
+    }
+    for (int k = 0; k < w->queued; k++) {
+        iov[k].iov_base = w->queue[k]->data + ((k == 0) ? w->offset : 0);
+        iov[k].iov_len = w->queue[k]->len - ((k == 0) ? w->offset : 0);
+    }
+    written = writev(w->fd, iov, w->queued);
+    if (written < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    
+    // Release what went out in full, remember how far into the next chunk the socket got
+    int sent = 0;
+    size_t left = (size_t)written + w->offset;
+    while (sent < w->queued && left >= w->queue[sent]->len) {
+        left -= w->queue[sent]->len;
+        release_chunk(w->queue[sent]);
+        sent++;
+    }
+    memmove(w->queue, w->queue + sent, (w->queued - sent) * sizeof(chunk*));
+    w->queued -= sent;
+    w->offset = left;
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * metrics_option(): Function that takes one of the metrics options of  *
+ *      a run: --metrics ADDRESS (a port on 127.0.0.1, or the path of a *
+ *      Unix socket), --metrics-dump FILE or --metrics-interval SECONDS.*
+ *      Returns 1 if name was one of them, 0 if not.                    *
+ ************************************************************************/
+int metrics_option(metrics *m, const char *name, const char *value) {
+    
+    if (strcmp(name, "--metrics") == 0) {
+        m->address = value;
+    } else if (strcmp(name, "--metrics-dump") == 0) {
+        m->dump_path = value;
+    } else if (strcmp(name, "--metrics-interval") == 0) {
+        m->interval = atoi(value);
+    } else {
+        return 0;
+    }
+    return 1;
+    
+}
+
+
+/************************************************************************
+ * start_metrics(): Function that opens the metrics endpoint and starts *
+ *      the thread serving it and writing the dump file, if the options *
+ *      asked for either. Returns 0, or -1 if the endpoint could not be *
+ *      opened.                                                         *
+ ************************************************************************/
+int start_metrics(metrics *m, const char *mode) {
+    
+    m->mode = mode;
+    m->listen_fd = -1;
+    m->blocks = NULL;
+    m->start_ns = monotonic_ns();
+    if (m->interval <= 0) {
+        m->interval = 10;
+    }
+    if (m->address == NULL && m->dump_path == NULL) {
+        return 0;
+    }
+    
+    if (m->address != NULL) {
+        m->listen_fd = open_metrics_socket(m->address);
+        if (m->listen_fd < 0) {
+            printf("ERROR: Could not serve metrics on %s\n", m->address);
+            return -1;
+        }
+    }
+    if (pipe(m->wake) < 0) {
+        return -1;
+    }
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_create(&m->thread, NULL, metrics_worker, m);
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * stop_metrics(): Function that stops the metrics thread, which writes *
+ *      a last dump on its way out, and frees every counter block.      *
+ ************************************************************************/
+void stop_metrics(metrics *m) {
+    
+    if (m->address == NULL && m->dump_path == NULL) {
+        return;
+    }
+    
+    char stop = 1;
+    if (write(m->wake[1], &stop, 1) < 0) {
+        printf("ERROR: Could not stop the metrics thread\n");
+        return;
+    }
+    pthread_join(m->thread, NULL);
+    close(m->wake[0]);
+    close(m->wake[1]);
+    if (m->listen_fd >= 0) {
+        close(m->listen_fd);
+        if (strspn(m->address, "0123456789") != strlen(m->address)) {
+            unlink(m->address);
+        }
+    }
+    while (m->blocks != NULL) {
+        engine_counters *next = m->blocks->next;
+        free(m->blocks);
+        m->blocks = next;
+    }
+    pthread_mutex_destroy(&m->lock);
+    
+}
+
+
+/************************************************************************
+ * metrics_counters(): Function that hands a thread its own block of    *
+ *      counters, on a cache line of its own so threads never write to  *
+ *      the same line. Returns NULL when the run keeps no metrics.      *
+ ************************************************************************/
+engine_counters* metrics_counters(metrics *m) {
+    
+    if (m == NULL || (m->address == NULL && m->dump_path == NULL)) {
+        return NULL;
+    }
+    
+    size_t size = (sizeof(engine_counters) + 63) / 64 * 64;
+    engine_counters *c = (engine_counters*)aligned_alloc(64, size);
+    memset(c, 0, size);
+    pthread_mutex_lock(&m->lock);
+    c->next = m->blocks;
+    m->blocks = c;
+    pthread_mutex_unlock(&m->lock);
+    return c;
+    
+}
+
+
+/************************************************************************
+ * counter_add(): Function that adds n to a counter only its own thread *
+ *      writes to. A relaxed load and store is enough for that and is   *
+ *      as cheap as a plain increment, the metrics thread reading it    *
+ *      just sees the old or the new total.                             *
+ ************************************************************************/
+void counter_add(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+
+/************************************************************************
+ * count_move(): Function that counts a move that took ns nanoseconds   *
+ *      in the move time histogram of c.                                *
+ ************************************************************************/
+void count_move(engine_counters *c, uint64_t ns) {
+    
+    int bucket = (ns <= 256) ? 0 : 64 - __builtin_clzll(ns - 1) - 8; // Upper bound 256ns << bucket
+    
+    counter_add(&c->move_buckets[(bucket < METRICS_BUCKETS) ? bucket : METRICS_BUCKETS - 1], 1);
+    counter_add(&c->moves, 1);
+    counter_add(&c->move_ns, ns);
+    if (ns > atomic_load_explicit(&c->move_max_ns, memory_order_relaxed)) {
+        atomic_store_explicit(&c->move_max_ns, ns, memory_order_relaxed);
+    }
+    
+}
+
+
+/************************************************************************
+ * count_decision(): Function that counts a decision of the bot playing *
+ *      player that took ns nanoseconds in the histogram of its seat,   *
+ *      along with whether it went over budget or fell back.            *
+ ************************************************************************/
+void count_decision(engine_counters *c, int player, uint64_t ns, int overrun, int fallback) {
+    
+    int seat = player - 1;
+    int bucket = (ns <= 256) ? 0 : 64 - __builtin_clzll(ns - 1) - 8; // Same buckets as count_move()
+    
+    counter_add(&c->decision_buckets[seat][(bucket < METRICS_BUCKETS) ? bucket : METRICS_BUCKETS - 1], 1);
+    counter_add(&c->decisions[seat], 1);
+    counter_add(&c->decision_ns[seat], ns);
+    counter_add(&c->decision_overruns[seat], (uint64_t)overrun);
+    counter_add(&c->decision_fallbacks[seat], (uint64_t)fallback);
+    if (ns > atomic_load_explicit(&c->decision_max_ns[seat], memory_order_relaxed)) {
+        atomic_store_explicit(&c->decision_max_ns[seat], ns, memory_order_relaxed);
+    }
+    
+}
+
+
+/************************************************************************
+ * metrics_worker(): Metrics thread. Answers every scrape of the        *
+ *      endpoint and writes the dump file every --metrics-interval      *
+ *      seconds, until stop_metrics() wakes it to write the last dump.  *
+ ************************************************************************/
+void* metrics_worker(void *arg) {
+    
+    metrics *m = (metrics*)arg;
+    struct pollfd fds[2];
+    uint64_t next_dump_ns = monotonic_ns() + (uint64_t)m->interval * 1000000000;
+    
+    fds[0].fd = m->wake[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = m->listen_fd; // Ignored by poll() when there is no endpoint
+    fds[1].events = POLLIN;
+    
+    while (1) {
+        int timeout = -1;
+        if (m->dump_path != NULL) {
+            uint64_t now_ns = monotonic_ns();
+            timeout = (now_ns >= next_dump_ns) ? 0 : (int)((next_dump_ns - now_ns + 999999) / 1000000);
+        }
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(m->listen_fd, NULL, NULL)) >= 0) {
+                serve_metrics(m, fd);
+            }
+        }
+        if (m->dump_path != NULL && monotonic_ns() >= next_dump_ns) {
+            dump_metrics(m);
+            next_dump_ns += (uint64_t)m->interval * 1000000000;
+        }
+    }
+    
+    if (m->dump_path != NULL && dump_metrics(m) != 0) {
+        printf("ERROR: Could not write the metrics to %s\n", m->dump_path);
+    }
+    return NULL;
+    
+}
+
+
+/************************************************************************
+ * render_metrics(): Function that sums the counters of every thread    *
+ *      and prints them in the Prometheus text format. Rates are        *
+ *      averaged since the start of the run, move times are a           *
+ *      histogram in seconds, as are the decision times of each seat's  *
+ *      bot once there are any (p50 and p99 come from their buckets).   *
+ ************************************************************************/
+void render_metrics(metrics *m, FILE *out) {
+    
+    uint64_t games = 0, turns = 0, fish = 0, books = 0, cards = 0;
+    uint64_t moves = 0, move_ns = 0, move_max_ns = 0, buckets[METRICS_BUCKETS] = {0};
+    uint64_t decisions[2] = {0}, decision_ns[2] = {0}, decision_max_ns[2] = {0}, overruns[2] = {0}, fallbacks[2] = {0};
+    uint64_t decision_buckets[2][METRICS_BUCKETS] = {{0}};
+    double uptime = (monotonic_ns() - m->start_ns) / 1e9;
+    
+    pthread_mutex_lock(&m->lock);
+    for (engine_counters *c = m->blocks; c != NULL; c = c->next) {
+        games += atomic_load_explicit(&c->games, memory_order_relaxed);
+        turns += atomic_load_explicit(&c->turns, memory_order_relaxed);
+        fish += atomic_load_explicit(&c->fish, memory_order_relaxed);
+        books += atomic_load_explicit(&c->books, memory_order_relaxed);
+        cards += atomic_load_explicit(&c->cards_allocated, memory_order_relaxed);
+        moves += atomic_load_explicit(&c->moves, memory_order_relaxed);
+        move_ns += atomic_load_explicit(&c->move_ns, memory_order_relaxed);
+        uint64_t max_ns = atomic_load_explicit(&c->move_max_ns, memory_order_relaxed);
+        move_max_ns = (max_ns > move_max_ns) ? max_ns : move_max_ns;
+        for (int i = 0; i < METRICS_BUCKETS; i++) {
+            buckets[i] += atomic_load_explicit(&c->move_buckets[i], memory_order_relaxed);
+        }
+        for (int seat = 0; seat < 2; seat++) {
+            decisions[seat] += atomic_load_explicit(&c->decisions[seat], memory_order_relaxed);
+            decision_ns[seat] += atomic_load_explicit(&c->decision_ns[seat], memory_order_relaxed);
+            overruns[seat] += atomic_load_explicit(&c->decision_overruns[seat], memory_order_relaxed);
+            fallbacks[seat] += atomic_load_explicit(&c->decision_fallbacks[seat], memory_order_relaxed);
+            max_ns = atomic_load_explicit(&c->decision_max_ns[seat], memory_order_relaxed);
+            decision_max_ns[seat] = (max_ns > decision_max_ns[seat]) ? max_ns : decision_max_ns[seat];
+            for (int i = 0; i < METRICS_BUCKETS; i++) {
+                decision_buckets[seat][i] += atomic_load_explicit(&c->decision_buckets[seat][i], memory_order_relaxed);
+            }
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+    
+    const char *counter_names[5] = {"games", "turns", "fish_draws", "books", "cards_allocated"};
+    const char *counter_help[5] = {"Games finished", "Asks made", "Cards drawn from the pool on go fish", "Books completed",
+                                   "Cards allocated, low when games reuse their cards"};
+    uint64_t counter_values[5] = {games, turns, fish, books, cards};
+    for (int i = 0; i < 5; i++) {
+        fprintf(out, "# HELP gofish_%s_total %s.\n# TYPE gofish_%s_total counter\n", counter_names[i], counter_help[i], counter_names[i]);
+        fprintf(out, "gofish_%s_total{mode=\"%s\"} %llu\n", counter_names[i], m->mode, (unsigned long long)counter_values[i]);
+    }
+    fprintf(out, "# HELP gofish_games_per_second Games finished per second since the start of the run.\n"
+            "# TYPE gofish_games_per_second gauge\ngofish_games_per_second{mode=\"%s\"} %.1f\n", m->mode, (uptime > 0) ? games / uptime : 0);
+    fprintf(out, "# HELP gofish_turns_per_second Asks made per second since the start of the run.\n"
+            "# TYPE gofish_turns_per_second gauge\ngofish_turns_per_second{mode=\"%s\"} %.1f\n", m->mode, (uptime > 0) ? turns / uptime : 0);
+    fprintf(out, "# HELP gofish_uptime_seconds Time since the start of the run.\n"
+            "# TYPE gofish_uptime_seconds gauge\ngofish_uptime_seconds{mode=\"%s\"} %.3f\n", m->mode, uptime);
+    
+    if (strcmp(m->mode, "server") == 0) {
+        fprintf(out, "# HELP gofish_sessions Connected clients with their game in memory.\n# TYPE gofish_sessions gauge\ngofish_sessions{mode=\"%s\"} %lld\n",
+                m->mode, (long long)atomic_load(&m->sessions));
+        fprintf(out, "# HELP gofish_parked_games Checkpointed or stored games nobody has resumed yet.\n# TYPE gofish_parked_games gauge\n"
+                "gofish_parked_games{mode=\"%s\"} %lld\n", m->mode, (long long)atomic_load(&m->parked));
+        fprintf(out, "# HELP gofish_idle_sessions Connected clients whose game is parked in the session store.\n# TYPE gofish_idle_sessions gauge\n"
+                "gofish_idle_sessions{mode=\"%s\"} %lld\n", m->mode, (long long)atomic_load(&m->idle));
+        fprintf(out, "# HELP gofish_queued_bytes Output waiting for clients to read it.\n# TYPE gofish_queued_bytes gauge\n"
+                "gofish_queued_bytes{mode=\"%s\"} %lld\n", m->mode, (long long)atomic_load(&m->queued_bytes));
+    }
+    if (m->log != NULL) {
+        fprintf(out, "# HELP gofish_event_ring_depth Events queued for the log writer.\n# TYPE gofish_event_ring_depth gauge\n");
+        for (int i = 0; i < m->log->num_rings; i++) {
+            event_ring *ring = &m->log->rings[i];
+            size_t depth = atomic_load(&ring->head) - atomic_load(&ring->tail);
+            fprintf(out, "gofish_event_ring_depth{mode=\"%s\",thread=\"%d\"} %zu\n", m->mode, i, depth);
+        }
+        fprintf(out, "# HELP gofish_events_dropped_total Events lost to a full ring.\n# TYPE gofish_events_dropped_total counter\n");
+        for (int i = 0; i < m->log->num_rings; i++) {
+            fprintf(out, "gofish_events_dropped_total{mode=\"%s\",thread=\"%d\"} %llu\n", m->mode, i,
+                    (unsigned long long)atomic_load(&m->log->rings[i].dropped));
+        }
+    }
+    
+    fprintf(out, "# HELP gofish_move_seconds Time to choose a move (batch), or to play a guess or choose the opponent's (server).\n# TYPE gofish_move_seconds histogram\n");
+    uint64_t cumulative = 0;
+    for (int i = 0; i < METRICS_BUCKETS - 1; i++) {
+        cumulative += buckets[i];
+        fprintf(out, "gofish_move_seconds_bucket{mode=\"%s\",le=\"%.9g\"} %llu\n", m->mode, (256.0 * (1 << i)) / 1e9, (unsigned long long)cumulative);
+    }
+    fprintf(out, "gofish_move_seconds_bucket{mode=\"%s\",le=\"+Inf\"} %llu\n", m->mode, (unsigned long long)moves);
+    fprintf(out, "gofish_move_seconds_sum{mode=\"%s\"} %.9f\ngofish_move_seconds_count{mode=\"%s\"} %llu\n", m->mode, move_ns / 1e9, m->mode,
+            (unsigned long long)moves);
+    fprintf(out, "# HELP gofish_move_max_seconds Slowest move so far.\n# TYPE gofish_move_max_seconds gauge\n"
+            "gofish_move_max_seconds{mode=\"%s\"} %.9f\n", m->mode, move_max_ns / 1e9);
+    
+    // Bot decisions by seat, only once a bot has made one (a server without --opponent never does)
+    if (decisions[0] + decisions[1] == 0) {
+        return;
+    }
+    fprintf(out, "# HELP gofish_bot_decision_seconds Time the bot in a seat took to choose its ask.\n# TYPE gofish_bot_decision_seconds histogram\n");
+    for (int seat = 0; seat < 2; seat++) {
+        cumulative = 0;
+        for (int i = 0; i < METRICS_BUCKETS - 1; i++) {
+            cumulative += decision_buckets[seat][i];
+            fprintf(out, "gofish_bot_decision_seconds_bucket{mode=\"%s\",seat=\"%d\",le=\"%.9g\"} %llu\n", m->mode, seat + 1,
+                    (256.0 * (1 << i)) / 1e9, (unsigned long long)cumulative);
+        }
+        fprintf(out, "gofish_bot_decision_seconds_bucket{mode=\"%s\",seat=\"%d\",le=\"+Inf\"} %llu\n", m->mode, seat + 1,
+                (unsigned long long)decisions[seat]);
+        fprintf(out, "gofish_bot_decision_seconds_sum{mode=\"%s\",seat=\"%d\"} %.9f\ngofish_bot_decision_seconds_count{mode=\"%s\",seat=\"%d\"} %llu\n",
+                m->mode, seat + 1, decision_ns[seat] / 1e9, m->mode, seat + 1, (unsigned long long)decisions[seat]);
+    }
+    fprintf(out, "# HELP gofish_bot_decision_max_seconds Slowest decision of the bot in a seat so far.\n# TYPE gofish_bot_decision_max_seconds gauge\n");
+    for (int seat = 0; seat < 2; seat++) {
+        fprintf(out, "gofish_bot_decision_max_seconds{mode=\"%s\",seat=\"%d\"} %.9f\n", m->mode, seat + 1, decision_max_ns[seat] / 1e9);
+    }
+    fprintf(out, "# HELP gofish_bot_overruns_total Decisions that took longer than the deadline.\n# TYPE gofish_bot_overruns_total counter\n");
+    for (int seat = 0; seat < 2; seat++) {
+        fprintf(out, "gofish_bot_overruns_total{mode=\"%s\",seat=\"%d\"} %llu\n", m->mode, seat + 1, (unsigned long long)overruns[seat]);
+    }
+    fprintf(out, "# HELP gofish_bot_fallbacks_total Decisions that came back illegal and were replaced by the first card in hand.\n"
+            "# TYPE gofish_bot_fallbacks_total counter\n");
+    for (int seat = 0; seat < 2; seat++) {
+        fprintf(out, "gofish_bot_fallbacks_total{mode=\"%s\",seat=\"%d\"} %llu\n", m->mode, seat + 1, (unsigned long long)fallbacks[seat]);
+    }
+    
+}
+
+
+/************************************************************************
+ * serve_metrics(): Function that answers one scrape of the endpoint.   *
+ *      Whatever the client asks for, it gets the metrics as an HTTP    *
+ *      response and the connection is closed.                          *
+ ************************************************************************/
+void serve_metrics(metrics *m, int fd) {
+    
+    struct timeval timeout = {1, 0}; // A client that never sends its request only holds us up for a second
+    char request[1024];
+    char *body = NULL;
+    size_t body_len = 0;
+    char header[128];
+    
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (read(fd, request, sizeof(request)) >= 0) {
+        FILE *out = open_memstream(&body, &body_len);
+        render_metrics(m, out);
+        fclose(out);
+        
+        int header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                  "Content-Length: %zu\r\n\r\n", body_len);
+        struct iovec iov[2] = {{header, (size_t)header_len}, {body, body_len}};
+        if (writev(fd, iov, 2) < 0) {
+            // Scraper went away, nothing to clean up but the connection
+        }
+        free(body);
+    }
+    close(fd);
+    
+}
+
+
+/************************************************************************
+ * dump_metrics(): Function that writes the metrics to the dump file,   *
+ *      under a temporary name first so readers never see half a dump.  *
+ *      Returns 0, or -1 if it could not be written.                    *
+ ************************************************************************/
+int dump_metrics(metrics *m) {
+    
+    char tmp_path[4096];
+    
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", m->dump_path);
+    FILE *out = fopen(tmp_path, "w");
+    if (out == NULL) {
+        return -1;
+    }
+    render_metrics(m, out);
+    if (fclose(out) != 0 || rename(tmp_path, m->dump_path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+    
+}
+
+
+/************************************************************************
+ * open_metrics_socket(): Function that opens the non-blocking socket   *
+ *      the metrics are served on: a TCP port on 127.0.0.1 when address *
+ *      is a number, otherwise a Unix socket at that path. Returns the  *
+ *      descriptor or -1.                                               *
+ ************************************************************************/
+int open_metrics_socket(const char *address) {
+    
+    if (strspn(address, "0123456789") != strlen(address)) {
+        return open_server_socket(address);
+    }
+    
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)atoi(address));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Never reachable from other machines
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SESSION_BACKLOG) < 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+    
+}
+
+
+/************************************************************************
+ * play_opponent(): Function that has the bot playing Player 2 of a     *
+ *      session make its guesses until it is the client's turn again or *
+ *      the game is over, each within the budget of the server's clock. *
+ *      Does nothing when the client plays both seats.                  *
+ ************************************************************************/
+void play_opponent(session *s) {
+    
+    if (s->opponent == NULL) {
+        return;
+    }
+    while (s->g.state == GAME_AWAIT_GUESS && s->g.players_turn == PLAYER_TWO) {
+        int rank = bot_decide(&s->g, s->opponent, s->clock);
+        char name[3];
+        fprintf(s->g.out, "%s\n", rank_name(rank, name)); // Shows the bot's guess after its prompt as if typed
+        game_resume(&s->g, rank);
     }
     
 }
@@ -0,0 +1,244 @@
+#!/bin/sh
+#
+# Regression checks for the batch and server modes. Build first, then run from the top of the repo:
+#
+#   $ gcc -o main main.c -lm -pthread -ldl
+#   $ sh test-input-files/run_tests.sh [./main]
+#
+# Expected outputs live next to this script. Exits 1 if any check fails.
+
+MAIN=${1:-./main}
+DIR=$(dirname "$0")
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+failures=0
+
+pass() {
+    echo "PASS: $1"
+}
+
+fail() {
+    echo "FAIL: $1"
+    failures=$((failures + 1))
+}
+
+# expect_error NAME MESSAGE FILE: summarizing FILE must exit 1 and print MESSAGE
+expect_error() {
+    if "$MAIN" --results "$3" > "$TMP/out.txt"; then
+        fail "$1 (exit status 0)"
+    elif ! grep -q "$2" "$TMP/out.txt"; then
+        fail "$1 (no \"$2\" in the output)"
+    else
+        pass "$1"
+    fi
+}
+
+# expect_exit NAME STATUS MESSAGE COMMAND...: COMMAND must exit with STATUS and print MESSAGE
+expect_exit() {
+    name=$1
+    status=$2
+    message=$3
+    shift 3
+    "$@" > "$TMP/out.txt" 2>&1
+    result=$?
+    if [ "$result" -ne "$status" ]; then
+        fail "$name (exit status $result, expected $status)"
+    elif ! grep -q "$message" "$TMP/out.txt"; then
+        fail "$name (no \"$message\" in the output)"
+    else
+        pass "$name"
+    fi
+}
+
+# round_trip NAME SERVER_OPTIONS...: plays a few guesses on a server started with the options, stops it
+# with SIGINT while the client is still connected, starts it again and resumes the game. The hand
+# shown after resuming must be the one shown last before the stop.
+round_trip() {
+    name=$1
+    shift
+    if python3 - "$MAIN" "$TMP/gf.sock" "$@" << 'EOF'
+import signal, socket, subprocess, sys, time
+
+main, path, options = sys.argv[1], sys.argv[2], sys.argv[3:]
+
+def start():
+    server = subprocess.Popen([main, '--server', path] + options, stdout=subprocess.DEVNULL)
+    for _ in range(100):
+        client = socket.socket(socket.AF_UNIX)
+        client.settimeout(10)
+        try:
+            client.connect(path)
+            return server, client
+        except OSError:
+            client.close()
+            time.sleep(0.05)
+    server.kill()
+    sys.exit('server did not start')
+
+def stop(server):
+    server.send_signal(signal.SIGINT)
+    try:
+        server.wait(10)
+    except subprocess.TimeoutExpired:
+        server.kill()
+        sys.exit('server did not stop')
+
+def read_prompt(client):
+    text = b''
+    while not text.endswith(b'Guess: '):
+        chunk = client.recv(65536)
+        if not chunk:
+            break
+        text += chunk
+    return text.decode()
+
+def last_hand(text):
+    return text[text.rindex('* PLAYER'):] if '* PLAYER' in text else None
+
+server, client = start()
+text = read_prompt(client)
+game_id = int(text.split()[1])
+before = last_hand(text)
+for guess in ['5', '9', 'K', '2']:
+    time.sleep(0.3) # Long enough for --idle 0.1 to park the game in between
+    client.sendall(guess.encode() + b'\n')
+    before = last_hand(read_prompt(client)) or before # A guess not in hand only asks again
+stop(server)
+client.close()
+
+server, client = start()
+read_prompt(client)
+client.sendall(b'resume %d\n' % game_id)
+text = read_prompt(client)
+stop(server)
+if 'RESUMING GAME %d' % game_id not in text or last_hand(text) != before:
+    sys.exit('resumed game differs:\n%s\n---\n%s' % (before, text))
+EOF
+    then
+        pass "$name"
+    else
+        fail "$name"
+    fi
+}
+
+# patch FILE OFFSET BYTES: overwrites BYTES (printf escapes) at OFFSET in FILE
+patch() {
+    printf "$3" | dd of="$1" bs=1 seek="$2" conv=notrunc 2> /dev/null
+}
+
+
+# Results file: columns written by --simulate, summarized from the mapped blocks
+"$MAIN" --simulate 5000 --seed 1234 --threads 4 --results "$TMP/all.bin" > /dev/null
+if "$MAIN" --results "$TMP/all.bin" > "$TMP/out.txt" && diff "$DIR/results_seed1234.txt" "$TMP/out.txt"; then
+    pass "results summary"
+else
+    fail "results summary"
+fi
+
+cp "$TMP/all.bin" "$TMP/bad.bin"
+patch "$TMP/bad.bin" 12 '\000\000\000\000' # block_size
+expect_error "results block of size 0" "is damaged" "$TMP/bad.bin"
+
+cp "$TMP/all.bin" "$TMP/bad.bin"
+patch "$TMP/bad.bin" 8 '\377\377\377\000' # num_rows
+expect_error "results block with more rows than bytes" "is damaged" "$TMP/bad.bin"
+
+head -c 1000 "$TMP/all.bin" > "$TMP/bad.bin"
+expect_error "truncated results block" "is damaged" "$TMP/bad.bin"
+
+cp "$TMP/all.bin" "$TMP/bad.bin"
+patch "$TMP/bad.bin" 100 '\125\125\125\125' # inside the seed column
+expect_error "results column damaged" "fails its checksum" "$TMP/bad.bin"
+
+cp "$TMP/all.bin" "$TMP/bad.bin"
+patch "$TMP/bad.bin" 16 '\125' # run_seed
+expect_error "results header damaged" "fails its checksum" "$TMP/bad.bin"
+
+# A game index past the run, written with a valid checksum, is left out rather than counted
+python3 - "$TMP/all.bin" "$TMP/bad.bin" << 'EOF'
+import struct, sys, zlib
+data = bytearray(open(sys.argv[1], 'rb').read())
+num_rows, block_size = struct.unpack_from('<II', data, 8)
+struct.pack_into('<I', data, 40 + num_rows * 8, 999999) # game_index of the first row
+struct.pack_into('<I', data, 32, 0)
+struct.pack_into('<I', data, 32, zlib.crc32(bytes(data[:block_size])))
+open(sys.argv[2], 'wb').write(data)
+EOF
+expect_error "results game index past the run" "past the 5000 of their run" "$TMP/bad.bin"
+if grep -q "of 5000 games (1 missing, 0 duplicated)" "$TMP/out.txt"; then
+    pass "results game index past the run counted missing"
+else
+    fail "results game index past the run counted missing"
+fi
+
+
+# Random streams: every game draws from its own Philox streams keyed by (--seed, game index), so the
+# outcome of a run must not depend on the thread count or on how it is sharded
+for threads in 1 4; do
+    "$MAIN" --simulate 5000 --seed 1234 --threads $threads | tail -n +2 > "$TMP/out.txt"
+    if diff "$DIR/simulate_seed1234.txt" "$TMP/out.txt"; then
+        pass "seed 1234 on $threads thread(s)"
+    else
+        fail "seed 1234 on $threads thread(s)"
+    fi
+done
+
+"$MAIN" --simulate 5000 --seed 1234 --shard 0/3 --results "$TMP/shard0.bin" > /dev/null
+"$MAIN" --simulate 5000 --seed 1234 --shard 1/3 --threads 2 --results "$TMP/shard1.bin" > /dev/null
+"$MAIN" --simulate 5000 --seed 1234 --shard 2/3 --threads 3 --results "$TMP/shard2.bin" > /dev/null
+if "$MAIN" --results "$TMP/shard0.bin" "$TMP/shard1.bin" "$TMP/shard2.bin" > "$TMP/out.txt" && diff "$DIR/results_seed1234.txt" "$TMP/out.txt"; then
+    pass "seed 1234 merged from 3 shards"
+else
+    fail "seed 1234 merged from 3 shards"
+fi
+
+
+# Move scripts: a whole game plays to a known score, anything else exits with EXIT_EARLY_EOF (3)
+# or EXIT_BAD_INPUT (2) and the line at fault
+expect_exit "script replays seed 42" 0 "SCRIPT COMPLETE: 50 asks, PLAYER 1 SCORE: 1, PLAYER 2 SCORE: 7" \
+    "$MAIN" --script "$DIR/seed42_script.txt" --seed 42 --quiet
+head -n 20 "$DIR/seed42_script.txt" > "$TMP/script.txt"
+expect_exit "script ending mid-game" 3 "script ended before the game was over" \
+    "$MAIN" --script "$TMP/script.txt" --seed 42 --quiet
+echo "P1 Z" >> "$TMP/script.txt"
+expect_exit "script with an invalid rank" 2 "script.txt:21: \"Z\" is not a rank" \
+    "$MAIN" --script "$TMP/script.txt" --seed 42 --quiet
+head -n 4 "$DIR/seed42_script.txt" > "$TMP/script.txt"
+echo "P1 7" >> "$TMP/script.txt"
+expect_exit "script asking for a rank not in hand" 2 "script.txt:5: Player 1 does not possess a 7" \
+    "$MAIN" --script "$TMP/script.txt" --seed 42 --quiet
+echo "P1 A" > "$TMP/script.txt"
+expect_exit "deck file with aces" 3 "script ended before the game was over" \
+    "$MAIN" --script "$TMP/script.txt" --deck "$DIR/ordered_deck.txt" --quiet
+head -n 3 "$DIR/ordered_deck.txt" > "$TMP/deck.txt"
+expect_exit "deck file too short" 2 "deck.txt:4: the deck ends before all 52 cards" \
+    "$MAIN" --script "$TMP/script.txt" --deck "$TMP/deck.txt" --quiet
+sed '7s/.*/7 heartsandsomethingmuchlonger/' "$DIR/ordered_deck.txt" > "$TMP/deck.txt"
+expect_exit "deck file with a bad suit" 2 "deck.txt:7: not a card" \
+    "$MAIN" --script "$TMP/script.txt" --deck "$TMP/deck.txt" --quiet
+
+
+# Broadcast: every decision goes through the move clock, so both bots' decision times are reported
+expect_exit "broadcast with a deadline" 0 "Bot 1 moves: *[0-9][0-9]* decisions.*over 300us" \
+    "$MAIN" --broadcast "$TMP/tv.sock" --bot1 search:most --bot2 most --seed 42 --delay 0 --games 2 --deadline 300
+
+
+# Checkpoint: games waiting on a guess are saved on SIGINT and resumed from the mapped file
+round_trip "checkpoint save and resume" --checkpoint "$TMP/games.ckpt"
+
+# Session store: the game is parked after every guess by --idle and woken by the next one, parked
+# once more on SIGINT and taken back from the store by resume
+round_trip "session store park and resume" --store "$TMP/games.store" --idle 0.1
+# Parked five times, the game must still have one record (a second is the game dealt before resume)
+if [ "$(od -An -tu4 -j8 -N4 "$TMP/games.store")" -le 2 ]; then
+    pass "session store reuses the record of a game parked again"
+else
+    fail "session store reuses the record of a game parked again"
+fi
+
+
+if [ "$failures" -ne 0 ]; then
+    echo "$failures check(s) failed"
+    exit 1
+fi
+echo "All checks passed"